@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Lock contention benchmark for `bootcount -i`
+#
+# Starts N writer processes that each increment an emulated backend M times,
+# with and without the cross-process lock, and reports throughput and lost
+# updates (expected final value minus actual final value).  The EEPROM
+# backend saturates at 255, so its per-writer count is capped to stay below.
+#
+# Usage: bench/contention.sh [-n writers] [-m increments] [path/to/bootcount]
+# (a bootcount built with ./configure --enable-emulate)
+#
+# This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+# Copyright (c) 2018 VoltServer.
+# SPDX-License-Identifier: GPL-3.0-only
+
+set -e
+
+writers=8
+iterations=100
+while getopts n:m: opt; do
+    case $opt in
+    n) writers=$OPTARG ;;
+    m) iterations=$OPTARG ;;
+    *) echo "Usage: $0 [-n writers] [-m increments] [bootcount]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+bootcount=${1:-src/bootcount}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+now_ns() { date +%s%N; }
+
+# run <backend> <lock file or "off"> <increments per writer> <max value>
+run() {
+    backend=$1 lock=$2 per_writer=$3 max=$4
+    dev=$tmp/$backend
+    : > "$dev"
+    export BOOTCOUNT_EMULATE="$backend:$dev" BOOTCOUNT_LOCK="$lock"
+    "$bootcount" -r >/dev/null
+
+    start=$(now_ns)
+    w=0
+    while [ $w -lt "$writers" ]; do
+        (
+            i=0
+            while [ $i -lt "$per_writer" ]; do
+                "$bootcount" -i >/dev/null 2>&1 || true
+                i=$((i + 1))
+            done
+        ) &
+        w=$((w + 1))
+    done
+    wait
+    end=$(now_ns)
+
+    final=$("$bootcount")
+    ops=$((writers * per_writer))
+    expected=$ops
+    [ $expected -gt "$max" ] && expected=$max
+    elapsed_us=$(( (end - start) / 1000 ))
+    [ $elapsed_us -gt 0 ] || elapsed_us=1
+    label=locked
+    [ "$lock" = off ] && label=unlocked
+    printf '%-7s %-9s writers=%-3s ops=%-6s final=%-6s lost=%-6s elapsed_ms=%-7s ops/s=%s\n' \
+        "$backend" "$label" "$writers" "$ops" "$final" $((expected - final)) \
+        $((elapsed_us / 1000)) $((ops * 1000000 / elapsed_us))
+}
+
+eeprom_iterations=$iterations
+[ $((writers * iterations)) -gt 255 ] && eeprom_iterations=$((255 / writers))
+
+for lock in "$tmp/bootcount.lock" off; do
+    run reg "$lock" "$iterations" 65535
+    run eeprom "$lock" "$eeprom_iterations" 255
+done
@@ -0,0 +1,78 @@
+/**
+ * Exec-to-exit latency and peak RSS of a command, for bench/startup.sh
+ *
+ * Runs the command N times and prints the median, 99th percentile and
+ * maximum time from spawning it to reaping it, and the largest peak RSS
+ * any run reached (ru_maxrss from wait4()).  The command's stdout goes to
+ * /dev/null.
+ *
+ * Usage: execstat <runs> <command> [args...]
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    long runs = argc > 2 ? strtol(argv[1], NULL, 10) : 0;
+    long maxrss = 0;
+
+    if (runs < 1) {
+        fprintf(stderr, "Usage: %s <runs> <command> [args...]\n", argv[0]);
+        return 1;
+    }
+    long *us = calloc((size_t)runs, sizeof(*us));
+    if (!us)
+        return 1;
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+
+    for (long i = 0; i < runs; i++) {
+        struct timespec start, end;
+        struct rusage ru;
+        pid_t pid;
+        int status;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (posix_spawn(&pid, argv[2], &fa, NULL, argv + 2, environ) != 0) {
+            perror(argv[2]);
+            return 1;
+        }
+        if (wait4(pid, &status, 0, &ru) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s failed\n", argv[2]);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        us[i] = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L;
+        if (ru.ru_maxrss > maxrss)
+            maxrss = ru.ru_maxrss;
+    }
+
+    qsort(us, (size_t)runs, sizeof(*us), cmp_long);
+    printf("median_us=%ld p99_us=%ld max_us=%ld maxrss_kb=%ld\n",
+           us[runs / 2], us[runs * 99 / 100], us[runs - 1], maxrss);
+    posix_spawn_file_actions_destroy(&fa);
+    free(us);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * Client-side command latency of `bootcount --serve`, for bench/latency.sh
+ *
+ * Writes N alternating "set" commands to the service's FIFO, one at a
+ * time, and times each from just before its write() to the arrival of its
+ * reply line, so the service's wakeup and scheduling delay is included.
+ * Prints the median, 99th percentile and maximum.
+ *
+ * Usage: fifostat <runs> <command fifo> <reply fifo>
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ * SPDX-License-Identifier: GPL-3.0-only
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/* Read up to and including the next newline */
+static int read_line(int fd)
+{
+    char c;
+
+    for (;;) {
+        if (read(fd, &c, 1) != 1)
+            return -1;
+        if (c == '\n')
+            return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long runs = argc > 3 ? strtol(argv[1], NULL, 10) : 0;
+
+    if (runs < 1) {
+        fprintf(stderr, "Usage: %s <runs> <command fifo> <reply fifo>\n", argv[0]);
+        return 1;
+    }
+    long *us = calloc((size_t)runs, sizeof(*us));
+    int cmd = open(argv[2], O_WRONLY);
+    int reply = open(argv[3], O_RDONLY);
+    if (!us || cmd < 0 || reply < 0) {
+        perror("fifostat");
+        return 1;
+    }
+
+    for (long i = 0; i < runs; i++) {
+        struct timespec start, end;
+        char line[32];
+        int len = snprintf(line, sizeof(line), "set %ld\n", i % 200);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (write(cmd, line, (size_t)len) != len || read_line(reply) != 0) {
+            fprintf(stderr, "fifostat: service went away\n");
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        us[i] = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L;
+    }
+
+    qsort(us, (size_t)runs, sizeof(*us), cmp_long);
+    printf("median_us=%ld p99_us=%ld max_us=%ld\n", us[runs / 2], us[runs * 99 / 100], us[runs - 1]);
+    free(us);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# Worst-case latency benchmark for `bootcount --serve`
+#
+# Starts a synthetic load (stress-ng if installed, else one busy loop and one
+# memory churner per CPU), runs the resident service on an emulated backend,
+# sends N alternating set commands through its FIFO, one at a time, and
+# prints the time from each write to the FIFO to its reply (bench/fifostat.c),
+# which includes the service's wakeup, then the service's own statistics from
+# wakeup to completed write.  For comparison it also times N one-shot
+# `bootcount -s` processes under the same load.  --rt needs CAP_SYS_NICE;
+# without it the service warns and runs with the default policy.
+#
+# Usage: bench/latency.sh [-n commands] [-b reg|eeprom] [-r prio] [path/to/bootcount]
+# (a bootcount built with ./configure --enable-emulate)
+#
+# This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+# Copyright (c) 2018 VoltServer.
+# SPDX-License-Identifier: GPL-3.0-only
+
+set -e
+
+commands=1000
+backend=reg
+prio=50
+while getopts n:b:r: opt; do
+    case $opt in
+    n) commands=$OPTARG ;;
+    b) backend=$OPTARG ;;
+    r) prio=$OPTARG ;;
+    *) echo "Usage: $0 [-n commands] [-b reg|eeprom] [-r prio] [bootcount]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+bootcount=${1:-src/bootcount}
+
+tmp=$(mktemp -d)
+srcdir=$(cd "$(dirname "$0")/.." && pwd)
+load_pids=
+cleanup() {
+    [ -n "$load_pids" ] && kill $load_pids 2>/dev/null
+    [ -n "$serve_pid" ] && kill "$serve_pid" 2>/dev/null
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+${CC:-cc} -O2 -o "$tmp/fifostat" "$srcdir/bench/fifostat.c"
+export BOOTCOUNT_EMULATE="$backend:$tmp/dev" BOOTCOUNT_LOCK="$tmp/bootcount.lock"
+: > "$tmp/dev"
+"$bootcount" -r >/dev/null
+
+cpus=$(nproc 2>/dev/null || echo 1)
+if command -v stress-ng >/dev/null 2>&1; then
+    stress-ng --cpu "$cpus" --vm "$cpus" --vm-bytes 64M --quiet &
+    load_pids=$!
+else
+    i=0
+    while [ $i -lt "$cpus" ]; do
+        sh -c 'while :; do :; done' &
+        load_pids="$load_pids $!"
+        sh -c 'while :; do head -c 16777216 /dev/zero | tr "\0" x > /dev/null; done' &
+        load_pids="$load_pids $!"
+        i=$((i + 1))
+    done
+fi
+
+# one-shot processes under load, for comparison
+worst=0
+i=0
+while [ $i -lt "$commands" ]; do
+    start=$(date +%s%N)
+    "$bootcount" -s $((i % 200)) >/dev/null
+    us=$(( ($(date +%s%N) - start) / 1000 ))
+    [ $us -gt $worst ] && worst=$us
+    i=$((i + 1))
+done
+printf '%-8s %-7s count=%s max_us=%s\n' oneshot "$backend" "$commands" "$worst"
+
+# one command in flight at a time: wait for each reply before the next
+mkfifo "$tmp/cmd" "$tmp/reply"
+exec 4<> "$tmp/reply"
+"$bootcount" --serve="$tmp/cmd" --rt="$prio" > "$tmp/reply" &
+serve_pid=$!
+printf '%-8s %-7s count=%s %s\n' serve "$backend" "$commands" \
+    "$("$tmp/fifostat" "$commands" "$tmp/cmd" "$tmp/reply")"
+exec 3> "$tmp/cmd"
+echo latency >&3
+read -r reply <&4
+printf '%-8s %-7s %s\n' internal "$backend" "$reply"
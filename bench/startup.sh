@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Startup benchmark for `bootcount`, run by `make bench-startup`
+#
+# Builds each profile (default, and --enable-initramfs) out of tree, then
+# runs a plain read N times against an emulated register and reports the
+# binary size, exec-to-exit latency (median, p99, max) and peak RSS.  If
+# BENCH_STARTUP_MAX_US is set, fails when a profile's median exceeds it.
+#
+# The profiles are configured from a pristine copy of the sources, since
+# automake refuses to build out of tree from a source directory that is
+# configured in place: a `make dist` tarball, or else a `git worktree` of
+# HEAD of the given checkout (without its uncommitted changes).
+#
+# Usage: bench/startup.sh [-n runs] [tarball|srcdir]
+#
+# This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+# Copyright (c) 2018 VoltServer.
+# SPDX-License-Identifier: GPL-3.0-only
+
+set -e
+
+runs=1000
+while getopts n: opt; do
+    case $opt in
+    n) runs=$OPTARG ;;
+    *) echo "Usage: $0 [-n runs] [tarball|srcdir]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+src=${1:-$(dirname "$0")/..}
+
+tmp=$(mktemp -d)
+worktree=
+trap '[ -z "$worktree" ] || git -C "$worktree" worktree remove --force "$tmp/src"; rm -rf "$tmp"' EXIT
+trap 'exit 1' INT TERM
+
+if [ -f "$src" ]; then
+    mkdir "$tmp/src"
+    tar -xzf "$src" -C "$tmp/src" --strip-components=1
+else
+    worktree=$(cd "$src" && pwd)
+    git -C "$worktree" worktree add --detach "$tmp/src" HEAD >/dev/null 2>&1
+    (cd "$tmp/src" && autoreconf -i >/dev/null 2>&1)
+fi
+srcdir=$tmp/src
+
+${CC:-cc} -O2 -o "$tmp/execstat" "$srcdir/bench/execstat.c"
+printf '\001\000\001\260' > "$tmp/reg"
+export BOOTCOUNT_EMULATE="reg:$tmp/reg" BOOTCOUNT_LOCK="$tmp/bootcount.lock"
+unset BOOTCOUNT_HISTORY BOOTCOUNT_PMSG
+
+status=0
+for profile in default initramfs; do
+    flags=--enable-emulate
+    [ $profile = initramfs ] && flags="$flags --enable-initramfs"
+    mkdir "$tmp/$profile"
+    (cd "$tmp/$profile" && "$srcdir/configure" $flags >/dev/null && make >/dev/null)
+    bin=$tmp/$profile/src/bootcount
+    result=$("$tmp/execstat" "$runs" "$bin")
+    printf '%-10s size=%-8s %s\n' $profile "$(wc -c < "$bin")" "$result"
+
+    median=${result#median_us=}
+    median=${median%% *}
+    if [ -n "$BENCH_STARTUP_MAX_US" ] && [ "$median" -gt "$BENCH_STARTUP_MAX_US" ]; then
+        echo "$profile: median ${median} us exceeds BENCH_STARTUP_MAX_US=$BENCH_STARTUP_MAX_US" >&2
+        status=1
+    fi
+done
+exit $status
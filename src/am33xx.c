@@ -39,6 +39,8 @@
 #include "./memory.h"
 #include "./dt.h"
 #include "./am33xx.h"
+#include "./reset_cause.h"
+#include "./trace.h"
 
 // See u-boot arch/arm/include/asm/davinci_rtc.h:
 #define RTCSS                0x44E3E000ul
@@ -50,9 +52,24 @@
 #define KICK0_MAGIC       0x83E70B13ul
 #define KICK1_MAGIC       0x95A4F1E0ul
 
+#define RTCSS_LEN         0x100ul
+
 #define AM33XX_MEM_OFFSET (RTCSS + SCRATCH2_REG_OFFSET)
 #define AM33XX_MEM_LEN    (KICK1R_REG_OFFSET + REG_SIZE - SCRATCH2_REG_OFFSET)
 
+// PRM_DEVICE PRM_RSTST, see TRM section 8.1.13.3.1
+#define PRM_DEVICE        0x44E00F00ul
+#define PRM_RSTST_OFFSET  0x08ul
+
+static const struct reset_flag am33_reset_flags[] = {
+    {0x001, "GLOBAL_COLD_RST", "power-on"},
+    {0x002, "GLOBAL_WARM_SW_RST", "software"},
+    {0x010, "WDT1_RST", "watchdog"},
+    {0x020, "EXTERNAL_WARM_RST", "external"},
+    {0x200, "ICEPICK_RST", "debugger"},
+    {0, NULL, NULL}
+};
+
 bool is_am33() {
     return is_compatible_soc("ti,am33xx");
 }
@@ -65,8 +82,10 @@ int am33_read_bootcount(uint16_t* val) {
     }
 
     uint32_t scratch2_val = memory_read(scratch2_addr);
+    trace_event(TRACE_READ, "/dev/mem", AM33XX_MEM_OFFSET, scratch2_val, 0);
     // low two bytes are the value, high two bytes are magic
     if ((scratch2_val & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000)) {
+        trace_event(TRACE_BADMAGIC, "/dev/mem", AM33XX_MEM_OFFSET, scratch2_val, E_BADMAGIC);
         return E_BADMAGIC;
     }
 
@@ -76,6 +95,14 @@ int am33_read_bootcount(uint16_t* val) {
 
 
 int am33_write_bootcount(uint16_t val) {
+    // Skip the unlock and write if the register already holds this value
+    uint16_t cur_val;
+    if ( am33_read_bootcount(&cur_val) == 0 && cur_val == val ) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", val);
+        trace_event(TRACE_SKIP, "/dev/mem", AM33XX_MEM_OFFSET, cur_val, 0);
+        return 0;
+    }
+
     // NOTE: These must be volatile.
     // See https://github.com/brgl/busybox/blob/master/miscutils/devmem.c
     volatile uint32_t *scratch2_addr =
@@ -85,20 +112,37 @@ int am33_write_bootcount(uint16_t val) {
     }
 
     volatile uint32_t *kick0r = scratch2_addr + 1;    // next 32-bit register after SCRATCH2
-    volatile uint32_t *kick1r = kick0r + 1;      // next 32-bit register after KICK0R
 
     // Disable write protection, then write to SCRATCH2
-    *kick0r = KICK0_MAGIC;
-    *kick1r = KICK1_MAGIC;
+    am33_rtc_unlock(kick0r);
+    trace_event(TRACE_UNLOCK, "/dev/mem", AM33XX_MEM_OFFSET + 4, KICK0_MAGIC, 0);
     uint32_t scratch2_val = (BOOTCOUNT_MAGIC & 0xffff0000) | (val & 0xffff);
     memory_write(scratch2_addr, scratch2_val);
+    trace_event(TRACE_WRITE, "/dev/mem", AM33XX_MEM_OFFSET, scratch2_val, 0);
 
     // read back to verify:
     uint16_t read_val = 0;
     am33_read_bootcount(&read_val);
     if ( read_val != val ) {
+        trace_event(TRACE_VERIFY, "/dev/mem", AM33XX_MEM_OFFSET, read_val, E_WRITE_FAILED);
         return E_WRITE_FAILED;
     }
 
     return 0;
 }
+
+volatile uint32_t *am33_rtc_kick_regs(off_t phys_addr) {
+    if ( phys_addr < (off_t)RTCSS || phys_addr >= (off_t)(RTCSS + RTCSS_LEN) || !is_am33() ) {
+        return NULL;
+    }
+    return (volatile uint32_t *)memory_open(RTCSS + KICK0R_REG_OFFSET, 2 * REG_SIZE);
+}
+
+void am33_rtc_unlock(volatile uint32_t *kick0r) {
+    kick0r[0] = KICK0_MAGIC;
+    kick0r[1] = KICK1_MAGIC;    // KICK1R is the next 32-bit register
+}
+
+int am33_read_reset_cause(struct reset_cause *rc, bool clear) {
+    return reset_cause_read_reg(PRM_DEVICE + PRM_RSTST_OFFSET, am33_reset_flags, clear, rc);
+}
@@ -1,9 +1,24 @@
 # pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define AM33_PLAT_NAME "TI AM335x"
 
 bool is_am33();
 int am33_read_bootcount(uint16_t* val);
 int am33_write_bootcount(uint16_t val);
+
+/*
+ * On an AM33xx, map the KICK0R/KICK1R pair that write-protects the RTC
+ * register at phys_addr.  Returns the KICK0R pointer, NULL if phys_addr is
+ * not an RTC register of an AM33xx, or (void *)E_DEVICE.
+ */
+volatile uint32_t *am33_rtc_kick_regs(off_t phys_addr);
+
+/* Disable the RTC write protection: two stores, async-signal-safe */
+void am33_rtc_unlock(volatile uint32_t *kick0r);
+
+struct reset_cause;
+int am33_read_reset_cause(struct reset_cause *rc, bool clear);
@@ -0,0 +1,274 @@
+/**
+ * Non-blocking backend operations for event loops
+ *
+ * The backends talk to I2C buses, sysfs and the device tree with plain
+ * blocking system calls; an EEPROM write with its verify poll or a device
+ * tree walk can take tens of milliseconds, and none of it can be made
+ * non-blocking from user space.  So every operation is split into short
+ * steps that run on one worker thread, and the worker signals the end of
+ * each step on an eventfd.  An event loop polls that fd with the rest of
+ * its I/O and calls bootcount_async_step(), which starts the next step, so
+ * it gets control back between steps: detection is one step per backend, a
+ * read or a write one step.
+ *
+ * The CLI keeps calling the backends directly: platform_probe() runs the
+ * same detection steps inline.  This file and the backends make up the
+ * async part of libbootcount.a, and reads and writes go through the same
+ * history and --once bookkeeping as the CLI's.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "constants.h"
+#include "bootcount_async.h"
+#include "lock.h"
+#include "oplog.h"
+#include "platform.h"
+
+/* room for the recursive device tree scans, which keep two paths per level */
+#define ASYNC_STACK_SIZE (256 * 1024)
+
+/* The programs define their own; library users get no debug output unless they set it */
+bool bootcount_debug = DEBUG;
+
+enum async_op {
+    ASYNC_IDLE,
+    ASYNC_DETECT,
+    ASYNC_READ,
+    ASYNC_WRITE,
+};
+
+static int g_fd = -1;
+static pthread_t g_thread;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static bool g_queued;           /* a step is waiting for the worker */
+static bool g_quit;
+
+/* The operation.  The worker only touches it between g_queued and the eventfd write. */
+static enum async_op g_op = ASYNC_IDLE;
+static const struct platform *g_plat;
+static uint16_t g_val;
+static int g_next;              /* detection: next platforms[] entry */
+static int g_err;
+static bool g_done;             /* set by the worker after the last step */
+static bool g_collected;        /* bootcount_async_step() has seen g_done */
+
+static void run_step(void)
+{
+    int lock;
+
+    switch (g_op) {
+    case ASYNC_DETECT:
+        g_err = platform_probe_step(&g_next, &g_plat);
+        g_done = g_err <= 0;
+        break;
+    case ASYNC_READ:
+        lock = bootcount_lock();
+        g_err = g_plat->read_bootcount(&g_val);
+        oplog_append(HISTORY_READ, g_plat, g_err ? HISTORY_NO_VALUE : g_val,
+                     g_err ? HISTORY_NO_VALUE : g_val, g_err);
+        bootcount_unlock(lock);
+        g_done = true;
+        break;
+    case ASYNC_WRITE:
+        lock = bootcount_lock();
+        g_err = oplog_write(g_plat, HISTORY_SET, g_val);
+        bootcount_unlock(lock);
+        g_done = true;
+        break;
+    case ASYNC_IDLE:
+        g_done = true;
+        break;
+    }
+}
+
+static void *worker(void *arg)
+{
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        while (!g_queued && !g_quit)
+            pthread_cond_wait(&g_cond, &g_lock);
+        if (g_quit)
+            break;
+        g_queued = false;
+        pthread_mutex_unlock(&g_lock);
+        run_step();
+        pthread_mutex_lock(&g_lock);
+        while (write(g_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+static void dispatch(void)
+{
+    pthread_mutex_lock(&g_lock);
+    g_queued = true;
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+int bootcount_async_open(void)
+{
+    pthread_attr_t attr;
+    sigset_t all, old;
+    int err;
+
+    if (g_fd >= 0)
+        return g_fd;
+
+    g_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_fd < 0) {
+        DEBUG_PRINTF("eventfd failed: %s\n", strerror(errno));
+        return E_DEVICE;
+    }
+
+    /* signals stay with the event loop, and never interrupt a bus transfer */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, ASYNC_STACK_SIZE);
+    g_quit = false;
+    err = pthread_create(&g_thread, &attr, worker, NULL);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        DEBUG_PRINTF("Cannot start the async worker: %s\n", strerror(err));
+        close(g_fd);
+        g_fd = -1;
+        return E_DEVICE;
+    }
+    return g_fd;
+}
+
+void bootcount_async_close(void)
+{
+    if (g_fd < 0)
+        return;
+
+    pthread_mutex_lock(&g_lock);
+    g_quit = true;
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+    pthread_join(g_thread, NULL);
+
+    close(g_fd);
+    g_fd = -1;
+    g_queued = false;
+    g_op = ASYNC_IDLE;
+}
+
+static int start(enum async_op op, const struct platform *plat, uint16_t val)
+{
+    if (g_fd < 0 || g_op != ASYNC_IDLE)
+        return E_INVALID;
+
+    g_op = op;
+    g_plat = plat;
+    g_val = val;
+    g_next = 0;
+    g_err = 0;
+    g_done = false;
+    g_collected = false;
+    dispatch();
+    return 0;
+}
+
+int bootcount_async_detect(void)
+{
+    return start(ASYNC_DETECT, NULL, 0);
+}
+
+int bootcount_async_read(const struct platform *plat)
+{
+    return start(ASYNC_READ, plat, 0);
+}
+
+int bootcount_async_write(const struct platform *plat, uint16_t val)
+{
+    return start(ASYNC_WRITE, plat, val);
+}
+
+const char *bootcount_async_name(const struct platform *plat)
+{
+    return plat->name;
+}
+
+int bootcount_async_step(void)
+{
+    uint64_t n;
+
+    if (g_op == ASYNC_IDLE)
+        return E_INVALID;
+    if (g_collected)
+        return 0;
+    if (read(g_fd, &n, sizeof(n)) != (ssize_t)sizeof(n))
+        return BOOTCOUNT_ASYNC_PENDING;   /* the step is still running */
+
+    /* pairs with the worker's lock around the eventfd write */
+    pthread_mutex_lock(&g_lock);
+    g_collected = g_done;
+    pthread_mutex_unlock(&g_lock);
+
+    if (!g_collected) {
+        dispatch();
+        return BOOTCOUNT_ASYNC_PENDING;
+    }
+    return 0;
+}
+
+int bootcount_async_complete(const struct platform **plat, uint16_t *val)
+{
+    if (g_op == ASYNC_IDLE || !g_collected)
+        return E_INVALID;
+
+    if (plat && g_op == ASYNC_DETECT)
+        *plat = g_plat;
+    if (val && g_op == ASYNC_READ)
+        *val = g_val;
+    g_op = ASYNC_IDLE;
+    return g_err;
+}
+
+int bootcount_async_wait(const struct platform **plat, uint16_t *val)
+{
+    struct pollfd pfd = { .fd = g_fd, .events = POLLIN };
+    int err;
+
+    while ((err = bootcount_async_step()) == BOOTCOUNT_ASYNC_PENDING) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return E_DEVICE;
+    }
+    if (err < 0)
+        return err;
+    return bootcount_async_complete(plat, val);
+}
@@ -0,0 +1,196 @@
+/**
+ * Batch command mode
+ *
+ * Commands, one per line (blank lines and lines starting with '#' are skipped):
+ *
+ *   read              print the current value
+ *   set <val>         set the value
+ *   inc               add one (saturating) and print the new value
+ *   cas <old> <new>   set <new> only if the current value is <old>
+ *   reset             same as "set 0"
+ *   force             same as "set 65534"
+ *   detect            print the detected platform
+ *   expect <val>      fail unless the current value is <val>
+ *   stats             print EEPROM write-cycle statistics
+ *
+ * Each command prints exactly one line: the value for "read" and "inc",
+ * "Detected <platform>" for "detect", the statistics for "stats", "OK" for
+ * the others on success, or "Error <code>" on failure (E_MISMATCH for a
+ * "cas" or "expect" that does not match).
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "batch.h"
+#include "bootid.h"
+#include "dm_eeprom.h"
+#include "oplog.h"
+#include "lock.h"
+
+#define BATCH_LINE_MAX 128
+#define BATCH_DELIMS " \t\r\n"
+
+static bool parse_value(const char *arg, uint16_t *val)
+{
+    char *end;
+    unsigned long v;
+
+    if (arg == NULL)
+        return false;
+    v = strtoul(arg, &end, 10);
+    if (*end != '\0' || v > UINT16_MAX)
+        return false;
+    *val = (uint16_t)v;
+    return true;
+}
+
+static int batch_write(const struct platform *plat, enum history_op op, uint16_t val, FILE *out)
+{
+    int err = oplog_write(plat, op, val);
+    if (err != 0) {
+        fprintf(out, "Error %d\n", err);
+        return err;
+    }
+    fprintf(out, "OK\n");
+    return 0;
+}
+
+int batch_command(const struct platform *plat, char *line, FILE *out)
+{
+    char *cmd = strtok(line, BATCH_DELIMS);
+    char *arg = strtok(NULL, BATCH_DELIMS);
+    char *arg2 = arg ? strtok(NULL, BATCH_DELIMS) : NULL;
+    uint16_t val, old, cur;
+    int err;
+
+    if (arg2 && strtok(NULL, BATCH_DELIMS) != NULL)
+        goto invalid;
+
+    if (strcmp(cmd, "cas") == 0 && parse_value(arg, &old) && parse_value(arg2, &val)) {
+        int32_t old_val = oplog_prior_value(plat);
+        err = platform_cas(plat, old, val, &cur);
+        oplog_append(HISTORY_CAS, plat, old_val, val, err);
+        if (err != 0) {
+            fprintf(out, "Error %d\n", err);
+            return err;
+        }
+        bootid_marker_clear();
+        fprintf(out, "OK\n");
+        return 0;
+    }
+    if (arg2)
+        goto invalid;
+
+    if (strcmp(cmd, "read") == 0 && !arg) {
+        err = plat->read_bootcount(&cur);
+        oplog_append(HISTORY_READ, plat, err ? HISTORY_NO_VALUE : cur,
+                 err ? HISTORY_NO_VALUE : cur, err);
+        if (err != 0) {
+            fprintf(out, "Error %d\n", err);
+            return err;
+        }
+        fprintf(out, "%u\n", cur);
+        return 0;
+    }
+    if (strcmp(cmd, "set") == 0 && parse_value(arg, &val))
+        return batch_write(plat, HISTORY_SET, val, out);
+    if (strcmp(cmd, "inc") == 0 && !arg) {
+        int32_t old_val = oplog_prior_value(plat);
+        err = platform_increment(plat, &cur);
+        oplog_append(HISTORY_INCREMENT, plat, old_val, err ? HISTORY_NO_VALUE : cur, err);
+        if (err != 0) {
+            fprintf(out, "Error %d\n", err);
+            return err;
+        }
+        bootid_marker_clear();
+        fprintf(out, "%u\n", cur);
+        return 0;
+    }
+    if (strcmp(cmd, "reset") == 0 && !arg)
+        return batch_write(plat, HISTORY_RESET, 0, out);
+    if (strcmp(cmd, "force") == 0 && !arg)
+        return batch_write(plat, HISTORY_FORCE, UINT16_MAX - 1, out);
+    if (strcmp(cmd, "detect") == 0 && !arg) {
+        fprintf(out, "Detected %s\n", plat->name);
+        return 0;
+    }
+    if (strcmp(cmd, "stats") == 0 && !arg) {
+        const struct eeprom_write_stats *st = dm_eeprom_write_stats();
+        fprintf(out, "writes=%u polls=%u min_us=%lu max_us=%lu avg_us=%lu\n",
+                st->writes, st->polls, st->writes ? st->min_us : 0, st->max_us,
+                st->writes ? st->total_us / st->writes : 0);
+        return 0;
+    }
+    if (strcmp(cmd, "expect") == 0 && parse_value(arg, &val)) {
+        err = plat->read_bootcount(&cur);
+        if (err == 0 && cur != val) {
+            DEBUG_PRINTF("Expected %u, read %u\n", val, cur);
+            err = E_MISMATCH;
+        }
+        if (err != 0) {
+            fprintf(out, "Error %d\n", err);
+            return err;
+        }
+        fprintf(out, "OK\n");
+        return 0;
+    }
+
+invalid:
+    fprintf(out, "Error %d\n", E_INVALID);
+    fprintf(stderr, "Invalid batch command '%s'\n", cmd);
+    return E_INVALID;
+}
+
+int batch_run(const struct platform *plat, FILE *in, FILE *out, bool keep_going)
+{
+    char line[BATCH_LINE_MAX];
+    unsigned lineno = 0;
+    int first_err = 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+        if (strchr(line, '\n') == NULL && !feof(in)) {
+            fprintf(stderr, "Line %u too long\n", lineno);
+            return E_INVALID;
+        }
+
+        char *p = line + strspn(line, BATCH_DELIMS);
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        DEBUG_PRINTF("Batch line %u: %s", lineno, p);
+        /* lock per command, so a long batch does not starve other writers */
+        int lock_fd = bootcount_lock();
+        int err = batch_command(plat, p, out);
+        bootcount_unlock(lock_fd);
+        fflush(out);
+        if (err != 0) {
+            if (first_err == 0)
+                first_err = err;
+            if (!keep_going)
+                break;
+        }
+    }
+
+    return first_err;
+}
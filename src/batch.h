@@ -0,0 +1,38 @@
+/**
+ * Batch command mode: run a script of operations against one backend
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "platform.h"
+
+/*
+ * Read newline-separated commands from `in` and print one result line per
+ * command to `out`.  Returns 0 if every command succeeded, otherwise the
+ * error of the first failed command.
+ */
+int batch_run(const struct platform *plat, FILE *in, FILE *out, bool keep_going);
+
+/*
+ * Run one non-blank command line (modified in place) and print its result
+ * line.  The caller holds the bootcount lock.  Returns 0 or the error.
+ */
+int batch_command(const struct platform *plat, char *line, FILE *out);
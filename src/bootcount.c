@@ -17,109 +17,419 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <getopt.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <unistd.h>
 //#include <inttypes.h> // used for PRIx32 macro
 #include <config.h>
 
 #include "constants.h"
-#include "dt.h"
-#include "am33xx.h"
-#include "imx8m.h"
-#include "imx93.h"
-#include "stm32mp1.h"
-#include "i2c_eeprom.h"
-#include "dm_eeprom.h"
-#include "dm_rtc.h"
-
-struct platform {
-    const char *name;
-    bool (*detect)();
-    int (*read_bootcount)(uint16_t *val);
-    int (*write_bootcount)(uint16_t val);
+#include "batch.h"
+#include "bootid.h"
+#include "capture.h"
+#include "counter_layout.h"
+#include "env.h"
+#include "fs_file.h"
+#include "health.h"
+#include "history.h"
+#include "oplog.h"
+#include "lock.h"
+#include "platform.h"
+#include "reset_cause.h"
+#include "pmsg.h"
+#include "quorum.h"
+#include "service.h"
+#include "trace.h"
+#include "watch.h"
+
+enum action {
+    ACTION_READ,
+    ACTION_WRITE,
+    ACTION_DETECT,
+    ACTION_BATCH,
+    ACTION_INCREMENT,
+    ACTION_CAS,
+    ACTION_HISTORY,
+    ACTION_PMSG,
+    ACTION_RESET_CAUSE,
+    ACTION_REMAINING,
+    ACTION_MARK_GOOD,
+    ACTION_COUNTERS,
+    ACTION_COMMIT_AFTER,
+    ACTION_SERVE,
+    ACTION_WATCH,
+    ACTION_CAPTURE,
+    ACTION_REPLAY,
 };
 
-bool debug = DEBUG;
-
-static const struct platform platforms[] = {
-    {.name = AM33_PLAT_NAME,
-     .detect = is_am33,
-     .read_bootcount = am33_read_bootcount,
-     .write_bootcount = am33_write_bootcount
-    },
-    {.name = IMX8M_PLAT_NAME,
-     .detect = is_imx8m,
-     .read_bootcount = imx8m_read_bootcount,
-     .write_bootcount = imx8m_write_bootcount
-    },
-    {.name = IMX93_PLAT_NAME,
-     .detect = is_imx93,
-     .read_bootcount = imx93_read_bootcount,
-     .write_bootcount = imx93_write_bootcount
-    },
-    {.name = STM32MP1_PLAT_NAME,
-     .detect = is_stm32mp1,
-     .read_bootcount = stm32mp1_read_bootcount,
-     .write_bootcount = stm32mp1_write_bootcount
-    },
-    {.name = DM_EEPROM_NAME,
-     .detect = dm_eeprom_exists,
-     .read_bootcount = dm_eeprom_read_bootcount,
-     .write_bootcount = dm_eeprom_write_bootcount
-    },
-    {.name = DM_RTC_NAME,
-     .detect = dm_rtc_exists,
-     .read_bootcount = dm_rtc_read_bootcount,
-     .write_bootcount = dm_rtc_write_bootcount
-    },
-    {.name = EEPROM_NAME,
-     .detect = eeprom_exists,
-     .read_bootcount = eeprom_read_bootcount,
-     .write_bootcount = eeprom_write_bootcount
-    },
-    {.name = NULL} /* sentinel */
+/* What one invocation asked for, as parsed from the command line */
+struct request {
+    enum action action;
+    enum history_op write_op;   /* which write -r, -f or -s is, for the records */
+    uint16_t val_arg;
+    uint16_t cas_old;
+    bool once;
+    bool json;
+    bool clear_reset;
+    const char *counter_updates;
 };
 
-static int platform_detect(const struct platform **platform, bool verbose) {
-    const struct platform *plat;
-    int i;
+static const struct option long_options[] = {
+    {"all",         no_argument,    NULL, 'a'},
+    {"batch",       no_argument,    NULL, 'b'},
+    {"increment",   no_argument,    NULL, 'i'},
+    {"cas",         required_argument, NULL, 'c'},
+    {"history",     optional_argument, NULL, 'H'},
+    {"pmsg",        optional_argument, NULL, 'P'},
+    {"reset-cause", optional_argument, NULL, 'R'},
+    {"remaining",   no_argument,    NULL, 'L'},
+    {"mark-good",   no_argument,    NULL, 'G'},
+    {"counters",    optional_argument, NULL, 'C'},
+    {"commit-after", required_argument, NULL, 'A'},
+    {"serve",       optional_argument, NULL, 'S'},
+    {"rt",          optional_argument, NULL, 'T'},
+    {"cpu",         required_argument, NULL, 'U'},
+    {"coalesce",    optional_argument, NULL, 'M'},
+    {"watch",       optional_argument, NULL, 'W'},
+    {"json",        no_argument,    NULL, 'j'},
+    {"keep-going",  no_argument,    NULL, 'k'},
+    {"once",        no_argument,    NULL, 'o'},
+    {"wait",        optional_argument, NULL, 'w'},
+    {"capture",     required_argument, NULL, 'X'},
+    {"replay",      required_argument, NULL, 'Y'},
+    {"help",        no_argument,    NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+#define WAIT_DEFAULT_SEC 30
+
+/* Multicall: a link with this name runs as "bootcount -r" */
+#define MULTICALL_RESET "bootcount-reset"
+
+bool bootcount_debug = DEBUG;
+
+static int usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-a] [--wait[=<sec>]] [-r] [-f] [-s <val>] [-i] [--cas <old> <new>] [--once] [--history[=<file>]] [--pmsg[=<file>]]\n"
+                    "       [--reset-cause[=clear]] [--remaining] [--mark-good] [--counters[=<updates>]] [--json]\n"
+                    "       [--commit-after <dir>] [--watch[=<reads/min>]] [-d] [--batch [-k]] [--serve[=<fifo>] [--rt[=<prio>]] [--cpu=<n>]\n"
+                    "       [--coalesce[=<ms>]]] [--capture <tar>] [--replay <tar>]\n\n"
+                    "Read or set the u-boot 'bootcount'.  Presently supports the following:\n"
+                    "  * RTC SCRATCH2 register on TI AM33xx devices\n"
+                    "  * TAMP_BKP21R register on STM32MP1 devices\n"
+                    "  * SNVS_LPGPR0 register on IMX8M devices\n"
+                    "  * BBNSM_GPR0 register on IMX93 devices\n"
+                    "  * generic DM I2C EEPROM via /sys/bus/i2c/devices/\n"
+                    "  * DM RTC via /sys/bus/nvmem/devices/\n"
+                    "  * DM I2C EEPROM or RTC via raw /dev/i2c-N, before its driver binds\n"
+                    "  * bootcount file on an unmounted FAT or ext2/3/4 partition\n"
+                    "  * reserved RAM region (reserved-memory DT node)\n"
+                    "If invoked without any arguments, this prints the current 'bootcount'\n"
+                    "value to stdout.  Invoked as '" MULTICALL_RESET "', it resets it like -r.\n\n"
+                    "OPTIONS:\n\n"
+                    "\t-r\t\tReset the bootcount to 0.  Same as '-s 0'\n\n"
+                    "\t-s <val>\tSet the bootcount to the given value.\n\n"
+                    "\t-f\t\tForce 'altbootcmd' by setting bootcount to UINT16_MAX - 1\n\n"
+                    "\t-i, --increment\tAdd one to the bootcount and print the new value.\n"
+                    "\t\t\tSaturates at the backend's maximum (255 for EEPROM/RTC).\n\n"
+                    "\t--cas <old> <new>\tSet the bootcount to <new> only if it is <old>.\n"
+                    "\t\t\tFails with Error %d if it is not.\n\n"
+                    "\t--once\t\tWith -r, -f or -s: do nothing if the same value was\n"
+                    "\t\t\talready written with --once during this boot\n"
+                    "\t\t\t(keyed on " BOOT_ID_PATH ")\n\n"
+                    "\t-d\t\tPrint platform detection details to stdout\n\n"
+                    "\t-a, --all\tUse every detected backend, not just the first:\n"
+                    "\t\t\twrites go to all of them in parallel, reads return\n"
+                    "\t\t\tthe majority value (or the first backend's, without\n"
+                    "\t\t\tone) and report disagreement on stderr.  Combines with\n"
+                    "\t\t\tany action.\n\n"
+                    "\t--reset-cause[=clear]\tPrint the bootcount and the decoded SoC\n"
+                    "\t\t\treset status (AM33xx, i.MX8M, STM32MP1).  With\n"
+                    "\t\t\t'clear', clear the status bits after reading them.\n\n"
+                    "\t--remaining\tPrint how many boot attempts are left before U-Boot\n"
+                    "\t\t\truns 'altbootcmd': 'bootlimit' from the U-Boot\n"
+                    "\t\t\tenvironment minus the bootcount\n\n"
+                    "\t--mark-good\tAfter a successful update: set 'upgrade_available'\n"
+                    "\t\t\tto 0 in the U-Boot environment (if it is not already),\n"
+                    "\t\t\tthen reset the bootcount to 0.  Prints what was written.\n\n"
+                    "\t--commit-after <dir>\tRun every executable in <dir> concurrently and\n"
+                    "\t\t\treset the bootcount only if all exit 0.  Each check\n"
+                    "\t\t\tgets %d s, or the seconds in <dir>/<check>.timeout.\n"
+                    "\t\t\tExit 1 fails the check; any other exit, a signal or\n"
+                    "\t\t\ta timeout also kills the remaining checks.\n\n"
+                    "\t--counters[=<updates>]\tPrint the named counters stored after the\n"
+                    "\t\t\tU-Boot cell in the EEPROM/RTC nvmem, after applying\n"
+                    "\t\t\t<updates>: 'name=<val>' or 'name+', comma separated\n\n"
+                    "\t--watch[=<reads/min>]\tPrint the bootcount, then a line with the old\n"
+                    "\t\t\tand new value each time it changes.  Polls every\n"
+                    "\t\t\t%d ms after a change, backing off to %d ms while\n"
+                    "\t\t\tit is stable, and never more than <reads/min>\n"
+                    "\t\t\t(default %d) times a minute.\n\n"
+                    "\t--json\t\tWith a read, --reset-cause, --remaining, --counters\n"
+                    "\t\t\tor --watch, print JSON objects\n\n"
+                    "\t--history[=<file>]\tPrint the boot history recorded in <file>\n"
+                    "\t\t\t(default $" HISTORY_ENV "), oldest first\n\n"
+                    "\t--pmsg[=<file>]\tPrint the records the previous boot left in\n"
+                    "\t\t\t" PMSG_PSTORE_GLOB " (or <file>) and\n"
+                    "\t\t\tcompare the last one with the current bootcount\n\n"
+                    "\t--batch\t\tRead commands from stdin, one per line, and run them\n"
+                    "\t\t\tagainst a single detected backend:\n"
+                    "\t\t\t  read | set <val> | reset | force | inc | cas <old> <new> |\n"
+                    "\t\t\t  detect | expect <val> | stats\n"
+                    "\t\t\tOne result line is printed per command.  Stops at the\n"
+                    "\t\t\tfirst failing command unless -k is given.\n\n"
+                    "\t-k, --keep-going\tWith --batch, keep running after a failed command\n\n",
+                    prog, E_MISMATCH, HEALTH_TIMEOUT_SEC, WATCH_MIN_MS, WATCH_MAX_MS,
+                    WATCH_READS_PER_MIN);
+    fprintf(stderr, "\t--serve[=<fifo>]\tStay resident and run --batch commands from <fifo>\n"
+                    "\t\t\t(created if missing) or stdin, with the backend open\n"
+                    "\t\t\tand all memory locked.  'latency' prints the command\n"
+                    "\t\t\twakeup to write time in us.  Stops on SIGTERM/SIGINT.\n\n"
+                    "\t--rt[=<prio>]\tWith --serve, run SCHED_FIFO at <prio> (default %d)\n\n"
+                    "\t--cpu=<n>\tWith --serve, pin to CPU <n>\n\n"
+                    "\t--coalesce[=<ms>]\tWith --serve, keep writes in memory and write\n"
+                    "\t\t\tthe latest value once <ms> (default %d) after the\n"
+                    "\t\t\tfirst, on 'flush', or at exit.  'coalesced' prints\n"
+                    "\t\t\thow many writes were avoided.\n\n"
+                    "\t--wait[=<sec>]\tIf the device tree names a bootcount device whose\n"
+                    "\t\t\tdriver has not probed yet, wait up to <sec> seconds\n"
+                    "\t\t\t(default %d) for it to appear.  Combines with any action.\n\n"
+                    "\t--capture <tar>\tRun detection under ptrace and save what it read in\n"
+                    "\t\t\t/proc, /sys and /dev, the syscalls it made and their\n"
+                    "\t\t\ttimes, and the result, to the tar archive <tar>\n\n"
+                    "\t--replay <tar>\tRe-run detection chrooted into a --capture archive\n"
+                    "\t\t\tand compare the result and the syscall count\n\n",
+                    SERVICE_RT_PRIO_DEFAULT, SERVICE_COALESCE_DEFAULT_MS, WAIT_DEFAULT_SEC);
+    fprintf(stderr, "ENVIRONMENT:\n\n"
+                    "\tDEBUG=1\t\tPrint debugging data to stderr\n\n"
+                    "\tBOOTCOUNT_TRACE=<file>\tOn failure, write the flight recorder dump to <file>\n"
+                    "\t\t\tinstead of stderr.  Use 'off' to disable.\n\n"
+                    "\tBOOTCOUNT_EEPROM_STATS=<file>\tAppend i2c-dev EEPROM write-cycle timings to <file>\n\n"
+                    "\t" HISTORY_ENV "=<file>\tAppend a record of every operation to <file>\n\n"
+                    "\t" PMSG_ENV "=<dev>\tWrite a binary record of every operation to <dev>,\n"
+                    "\t\t\te.g. /dev/pmsg0\n\n"
+                    "\tBOOTCOUNT_LOCK=<file>\tLock file serializing concurrent invocations\n"
+                    "\t\t\t(default " BOOTCOUNT_LOCK_PATH ")\n\n"
+                    "\t" ENV_CONFIG_ENV "=<file>\tRead the U-Boot environment location\n"
+                    "\t\t\tfrom <file> instead of " ENV_CONFIG_PATH "\n\n"
+                    "\t" COUNTERS_ENV "=<name>:<width>,...\tLayout of the named counters\n"
+                    "\t\t\t(widths 1, 2 or 4 bytes), instead of the device tree\n\n"
+                    "\tBOOTCOUNT_EMULATE=reg:<file>|eeprom:<file>\tUse a file as an emulated\n"
+                    "\t\t\tregister or EEPROM instead of real hardware (--enable-emulate builds)\n\n"
+                    "\t" FS_FILE_ENV "=<device>[:<path>]\tUse the bootcount file <path>\n"
+                    "\t\t\t(default " FS_FILE_DEFAULT_PATH ") on the FAT or ext partition <device>\n\n"
+                    "Package details:\t\t" PACKAGE_STRING "\n"
+                    "Bug Reports:\t\t" PACKAGE_BUGREPORT "\n"
+                    "Homepage:\t\t" PACKAGE_URL "\n\n");
+    return 1;
+}
 
-    for (i = 0; platforms[i].name; i++) {
-        plat = &platforms[i];
-        if (plat->detect()) {
-            if (platform)
-                *platform = plat;
+/* Print "<val>\n" with a single write(2), without stdio: reads at boot are the hot path */
+static void print_value(uint16_t val) {
+    char buf[8], *p = buf + sizeof(buf);
+
+    *--p = '\n';
+    do {
+        *--p = (char)('0' + val % 10);
+        val /= 10;
+    } while (val);
+    if (write(STDOUT_FILENO, p, (size_t)(buf + sizeof(buf) - p)) < 0)
+        DEBUG_PRINTF("stdout write failed\n");
+}
 
-            if (verbose)
-                printf("Detected %s\n", plat->name);
+static bool parse_value(const char *arg, uint16_t *val) {
+    char *end;
+    unsigned long v = strtoul(arg, &end, 10);
 
-            return 0;
+    if (*arg == '\0' || *end != '\0' || v > UINT16_MAX)
+        return false;
+    *val = (uint16_t)v;
+    return true;
+}
+
+/* Run one read or write action.  The caller holds the bootcount lock. */
+static int run_action(const struct platform *plat, const struct request *req) {
+    uint16_t val = 0;
+    int32_t old_val;
+    int err;
+
+    switch (req->action) {
+    // no args: read value and print to stdout
+    case ACTION_READ:
+        DEBUG_PRINTF("Action=read\n");
+        err = plat->read_bootcount(&val);
+        if (err == 0 && req->json)
+            printf("{\"bootcount\":%u}\n", val);
+        else if (err == 0)
+            print_value(val);
+        oplog_append(HISTORY_READ, plat, err ? HISTORY_NO_VALUE : val,
+                 err ? HISTORY_NO_VALUE : val, err);
+        return err;
+
+    case ACTION_WRITE:
+        err = oplog_write(plat, req->write_op, req->val_arg);
+        if (err == 0 && req->once)
+            bootid_marker_update(req->val_arg);
+        return err;
+
+    case ACTION_INCREMENT:
+        old_val = oplog_prior_value(plat);
+        err = platform_increment(plat, &val);
+        oplog_append(HISTORY_INCREMENT, plat, old_val, err ? HISTORY_NO_VALUE : val, err);
+        if (err == 0) {
+            bootid_marker_clear();
+            print_value(val);
+        }
+        return err;
+
+    case ACTION_CAS:
+        DEBUG_PRINTF("Compare %u, set %u\n", req->cas_old, req->val_arg);
+        old_val = oplog_prior_value(plat);
+        err = platform_cas(plat, req->cas_old, req->val_arg, &val);
+        oplog_append(HISTORY_CAS, plat, old_val, req->val_arg, err);
+        if (err == 0)
+            bootid_marker_clear();
+        return err;
+
+    // the counter and the reset status, through the same /dev/mem session
+    case ACTION_RESET_CAUSE: {
+        struct reset_cause rc;
+        int bc_err;
+
+        if (!plat->read_reset_cause) {
+            fprintf(stderr, "Reset cause is not available on %s\n", plat->name);
+            return E_INVALID;
         }
+        bc_err = plat->read_bootcount(&val);
+        err = plat->read_reset_cause(&rc, req->clear_reset);
+        if (err != 0)
+            return err;
+
+        // a power-on reset usually leaves a blank counter; still report the cause
+        if (req->json) {
+            if (bc_err)
+                printf("{\"bootcount\":null,\"bootcount_error\":%d,", bc_err);
+            else
+                printf("{\"bootcount\":%u,", val);
+            reset_cause_print(&rc, stdout, true);
+            printf("}\n");
+        } else {
+            if (bc_err)
+                printf("Bootcount: Error %d\n", bc_err);
+            else
+                printf("Bootcount: %u\n", val);
+            reset_cause_print(&rc, stdout, false);
+        }
+        return 0;
     }
 
-    fprintf(stderr, "Warning: unknown platform\n");
-    fprintf(stderr, "Current support is for:\n");
-    for (i = 0; platforms[i].name; i++) {
-        plat = &platforms[i];
-        fprintf(stderr, " * %s", plat->name);
-        if (!strcmp(plat->name, EEPROM_NAME))
-            fprintf(stderr, " at " EEPROM_PATH,
-                    DEFAULT_I2C_BUS, DEFFAULT_I2C_ADDR);
+    // bootlimit - bootcount, the attempts left before altbootcmd
+    case ACTION_REMAINING: {
+        const char *limit_str, *upgrade;
+        char *end;
+        unsigned long limit;
+        long remaining;
+
+        err = env_load();
+        if (err != 0) {
+            fprintf(stderr, "U-Boot environment not found or corrupt\n");
+            return err;
+        }
+        limit_str = env_get("bootlimit");
+        if (!limit_str) {
+            fprintf(stderr, "'bootlimit' is not set in the U-Boot environment\n");
+            return E_INVALID;
+        }
+        limit = strtoul(limit_str, &end, 10);
+        if (*limit_str == '\0' || *end != '\0') {
+            fprintf(stderr, "Invalid 'bootlimit': %s\n", limit_str);
+            return E_INVALID;
+        }
+        err = plat->read_bootcount(&val);
+        if (err != 0)
+            return err;
+        remaining = (long)limit - (long)val;
+        if (remaining < 0)
+            remaining = 0;
+
+        if (req->json) {
+            upgrade = env_get("upgrade_available");
+            printf("{\"bootcount\":%u,\"bootlimit\":%lu,\"remaining\":%ld,\"upgrade_available\":",
+                   val, limit, remaining);
+            printf(upgrade ? "\"%s\"" : "null", upgrade);
+            printf(",\"altbootcmd\":%s}\n", env_get("altbootcmd") ? "true" : "false");
+        } else {
+            printf("%ld\n", remaining);
+        }
+        return 0;
+    }
+
+    /*
+     * The environment goes first: if it cannot be written the counter keeps
+     * running and U-Boot still falls back, and if power fails in between,
+     * the next --mark-good finds the environment done and only resets the
+     * counter.
+     */
+    case ACTION_MARK_GOOD: {
+        const char *upgrade;
+        struct env_write_stats st;
+
+        err = env_load();
+        if (err != 0) {
+            fprintf(stderr, "U-Boot environment not found or corrupt\n");
+            return err;
+        }
+        upgrade = env_get("upgrade_available");
+        if (!upgrade || strcmp(upgrade, "0") == 0) {
+            printf("upgrade_available: %s, environment not written\n", upgrade ? "already 0" : "not set");
+        } else {
+            printf("upgrade_available: %s -> 0, ", upgrade);
+            err = env_set("upgrade_available", "0");
+            if (err == 0)
+                err = env_save(&st);
+            if (err != 0) {
+                printf("environment write failed\n");
+                return err;
+            }
+            printf("%zu bytes in %u of %u sectors written\n", st.bytes, st.sectors, st.sectors_total);
+        }
 
-        fprintf(stderr, "\n");
+        err = oplog_write(plat, HISTORY_RESET, 0);
+        if (err == 0)
+            printf("bootcount: 0\n");
+        return err;
     }
 
-    return E_PLATFORM_UNKNOWN;
+    // all named counters in one read, the changed ones in one write
+    case ACTION_COUNTERS:
+        return counters_run(plat, req->counter_updates, req->json, stdout);
+
+    default:
+        return E_INVALID;
+    }
 }
 
 int main(int argc, char *argv[]) {
-    int err;
-    bool detect_only;
+    int err, opt;
+    struct request req = { .action = ACTION_READ, .write_op = HISTORY_SET };
+    bool keep_going = false;
+    bool all = false;
+    int wait_ms = -1;
+    const char *history_path = getenv(HISTORY_ENV);
+    const char *pmsg_path = NULL;
+    const char *checks_dir = NULL;
+    const char *capture_path = NULL;
+    struct service_opts serve = { .cpu = -1 };
+    unsigned long watch_rate = WATCH_READS_PER_MIN;
+    int lock_fd;
     const struct platform *plat;
 
     char *debug_env = getenv("DEBUG");
@@ -128,92 +438,272 @@ int main(int argc, char *argv[]) {
         debug_env != NULL &&
         (strcmp(debug_env, "1") == 0 || strcmp(debug_env, "true") == 0)
      ) {
-        debug = true;
+        bootcount_debug = true;
     }
     DEBUG_PRINTF("DEBUG=%s\n", debug_env);
 
-    detect_only = argc == 2 && strcmp(argv[1], "-d") == 0;
-    err = platform_detect(&plat, detect_only);
-
-    // "-d" print platform detection to stdout and exit
-    if (detect_only) {
-        DEBUG_PRINTF("Action=detect\n");
-        return err;
+    const char *name = strrchr(argv[0], '/');
+    if (strcmp(name ? name + 1 : argv[0], MULTICALL_RESET) == 0) {
+        DEBUG_PRINTF("Action=reset (" MULTICALL_RESET ")\n");
+        req.action = ACTION_WRITE;
+        req.write_op = HISTORY_RESET;
+        req.val_arg = 0;
     }
 
-    if (err)
-        return err;
+    while ((opt = getopt_long(argc, argv, "rfs:dkia", long_options, NULL)) != -1) {
+        enum action next;
 
-    // no args: read value and print to stdout
-    if (argc == 1) {
-        DEBUG_PRINTF("Action=read\n");
+        switch (opt) {
+        // "-r" = Reset bootcount to zero
+        case 'r':
+            DEBUG_PRINTF("Action=reset\n");
+            next = ACTION_WRITE;
+            req.write_op = HISTORY_RESET;
+            req.val_arg = 0;
+            break;
+        // "-f" = set bootcount to max, force 'altbootcmd' to run if bootlimit is set
+        case 'f':
+            DEBUG_PRINTF("Action=force\n");
+            next = ACTION_WRITE;
+            req.write_op = HISTORY_FORCE;
+            req.val_arg = UINT16_MAX-1;
+            break;
+        // "-s" = set to a specific value
+        case 's':
+            DEBUG_PRINTF("Action=set\n");
+            next = ACTION_WRITE;
+            req.write_op = HISTORY_SET;
+            req.val_arg = strtoul(optarg, NULL, 10);
+            break;
+        // "-d" print platform detection to stdout and exit
+        case 'd':
+            DEBUG_PRINTF("Action=detect\n");
+            next = ACTION_DETECT;
+            break;
+        // "-i" = increment, saturating at the backend width
+        case 'i':
+            DEBUG_PRINTF("Action=increment\n");
+            next = ACTION_INCREMENT;
+            break;
+        // "--cas OLD NEW" = set NEW only if the current value is OLD
+        case 'c':
+            DEBUG_PRINTF("Action=cas\n");
+            next = ACTION_CAS;
+            if (optind >= argc || !parse_value(optarg, &req.cas_old) ||
+                !parse_value(argv[optind++], &req.val_arg))
+                return usage(argv[0]);
+            break;
+        // "--history[=file]" = print the boot history log
+        case 'H':
+            DEBUG_PRINTF("Action=history\n");
+            next = ACTION_HISTORY;
+            if (optarg)
+                history_path = optarg;
+            break;
+        // "--pmsg[=file]" = print records from the previous boot's pmsg
+        case 'P':
+            DEBUG_PRINTF("Action=pmsg\n");
+            next = ACTION_PMSG;
+            pmsg_path = optarg;
+            break;
+        // "--reset-cause[=clear]" = print the bootcount and the SoC reset status
+        case 'R':
+            DEBUG_PRINTF("Action=reset-cause\n");
+            next = ACTION_RESET_CAUSE;
+            if (optarg && strcmp(optarg, "clear") != 0)
+                return usage(argv[0]);
+            req.clear_reset = optarg != NULL;
+            break;
+        // "--remaining" = bootlimit from the U-Boot environment minus bootcount
+        case 'L':
+            DEBUG_PRINTF("Action=remaining\n");
+            next = ACTION_REMAINING;
+            break;
+        // "--mark-good" = clear upgrade_available, then reset the bootcount
+        case 'G':
+            DEBUG_PRINTF("Action=mark-good\n");
+            next = ACTION_MARK_GOOD;
+            break;
+        // "--counters[=name=val,name+]" = print and update the named counters
+        case 'C':
+            DEBUG_PRINTF("Action=counters\n");
+            next = ACTION_COUNTERS;
+            req.counter_updates = optarg;
+            break;
+        // "--commit-after <dir>" = run the health checks, reset if all pass
+        case 'A':
+            DEBUG_PRINTF("Action=commit-after\n");
+            next = ACTION_COMMIT_AFTER;
+            checks_dir = optarg;
+            break;
+        // "--serve[=fifo]" = stay resident, run batch commands with bounded latency
+        case 'S':
+            DEBUG_PRINTF("Action=serve\n");
+            next = ACTION_SERVE;
+            serve.path = optarg;
+            break;
+        case 'T': {
+            char *end = NULL;
+            long prio = optarg ? strtol(optarg, &end, 10) : SERVICE_RT_PRIO_DEFAULT;
+            if ((optarg && *end != '\0') || prio < 1 || prio > 99)
+                return usage(argv[0]);
+            serve.rt_prio = (int)prio;
+            continue;
+        }
+        case 'U': {
+            char *end;
+            long cpu = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || cpu < 0 || cpu >= CPU_SETSIZE)
+                return usage(argv[0]);
+            serve.cpu = (int)cpu;
+            continue;
+        }
+        case 'M': {
+            char *end = NULL;
+            long ms = optarg ? strtol(optarg, &end, 10) : SERVICE_COALESCE_DEFAULT_MS;
+            if ((optarg && *end != '\0') || ms < 1 || ms > INT_MAX)
+                return usage(argv[0]);
+            serve.coalesce_ms = (int)ms;
+            continue;
+        }
+        // "--watch[=reads/min]" = stream changes of the bootcount
+        case 'W':
+            DEBUG_PRINTF("Action=watch\n");
+            next = ACTION_WATCH;
+            if (optarg) {
+                char *end;
+                watch_rate = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || watch_rate == 0 || watch_rate > 60000)
+                    return usage(argv[0]);
+            }
+            break;
+        // "--capture <tar>" = save detection's inputs and syscalls for offline replay
+        case 'X':
+            DEBUG_PRINTF("Action=capture\n");
+            next = ACTION_CAPTURE;
+            capture_path = optarg;
+            break;
+        // "--replay <tar>" = re-run detection against a capture
+        case 'Y':
+            DEBUG_PRINTF("Action=replay\n");
+            next = ACTION_REPLAY;
+            capture_path = optarg;
+            break;
+        case 'j':
+            req.json = true;
+            continue;
+        case 'b':
+            DEBUG_PRINTF("Action=batch\n");
+            next = ACTION_BATCH;
+            break;
+        case 'k':
+            keep_going = true;
+            continue;
+        case 'a':
+            all = true;
+            continue;
+        case 'o':
+            req.once = true;
+            continue;
+        case 'w': {
+            char *end = NULL;
+            long sec = optarg ? strtol(optarg, &end, 10) : WAIT_DEFAULT_SEC;
+            if ((optarg && *end != '\0') || sec < 0 || sec > INT_MAX / 1000)
+                return usage(argv[0]);
+            wait_ms = (int)sec * 1000;
+            continue;
+        }
+        default:
+            return usage(argv[0]);
+        }
 
-        uint16_t val = 0;
+        // only one action per invocation
+        if (req.action != ACTION_READ)
+            return usage(argv[0]);
+        req.action = next;
+    }
 
-        err = plat->read_bootcount(&val);
-        if (err != 0) {
-            printf("Error %d\n", err);
-            return err;
-        }
+    if (optind != argc || (keep_going && req.action != ACTION_BATCH) ||
+        ((serve.rt_prio || serve.cpu >= 0 || serve.coalesce_ms) && req.action != ACTION_SERVE) ||
+        (req.once && req.action != ACTION_WRITE) ||
+        (req.json && req.action != ACTION_READ && req.action != ACTION_RESET_CAUSE &&
+         req.action != ACTION_REMAINING && req.action != ACTION_COUNTERS &&
+         req.action != ACTION_WATCH))
+        return usage(argv[0]);
+
+    // the history file is read directly, no backend needed
+    if (req.action == ACTION_HISTORY)
+        return history_print(history_path, stdout);
+    // pmsg records are printed even without a backend, then compared with it if there is one
+    if (req.action == ACTION_PMSG)
+        return pmsg_print(pmsg_path, platform_probe(), stdout);
+    // both run detection themselves, in a traced child
+    if (req.action == ACTION_CAPTURE)
+        return capture_write(capture_path, stdout);
+    if (req.action == ACTION_REPLAY)
+        return capture_replay(capture_path, stdout);
 
-        printf("%u\n", val);
+    // "--once": the same value was already written this boot, don't touch the bus
+    if (req.once && bootid_marker_matches(req.val_arg)) {
+        DEBUG_PRINTF("Value %u already written during this boot\n", req.val_arg);
         return 0;
     }
 
-    else {
-        uint16_t val_arg;
-        bool write_valid = true;
+    if (all)
+        err = quorum_detect(&plat, req.action == ACTION_DETECT, wait_ms);
+    else if (wait_ms >= 0)
+        err = platform_detect_wait(&plat, req.action == ACTION_DETECT, wait_ms);
+    else
+        err = platform_detect(&plat, req.action == ACTION_DETECT);
+    if (req.action == ACTION_DETECT) {
+        // like every history write, under the lock that orders the ring's sequence numbers
+        lock_fd = bootcount_lock();
+        oplog_append(HISTORY_DETECT, err ? NULL : plat, HISTORY_NO_VALUE, HISTORY_NO_VALUE, err);
+        bootcount_unlock(lock_fd);
+    }
+    if (err) {
+        trace_dump_on_failure();
+        return err;
+    }
 
-        // "-r" = Reset bootcount to zero
-        if (argc == 2 && strcmp(argv[1], "-r") == 0) {
-            DEBUG_PRINTF("Action=reset\n");
-            val_arg = 0;
-        }
+    if (req.action == ACTION_DETECT)
+        return 0;
 
-        // "-f" = set bootcount to max, force 'altbootcmd' to run if bootlimit is set
-        else if (argc == 2 && strcmp(argv[1], "-f") == 0) {
-            DEBUG_PRINTF("Action=force\n");
-            val_arg = UINT16_MAX-1;
-        }
+    if (req.action == ACTION_BATCH) {
+        err = batch_run(plat, stdin, stdout, keep_going);
+        if (err != 0)
+            trace_dump_on_failure();
+        return err;
+    }
 
-        // "-s" = set to a specific value
-        else if (argc == 3 && strcmp(argv[1], "-s") == 0) {
-            DEBUG_PRINTF("Action=set\n");
-            val_arg = strtoul(argv[2], NULL, 10);
-        }
-        else {
-            write_valid = false;
-        }
+    if (req.action == ACTION_SERVE) {
+        err = service_run(plat, &serve);
+        if (err != 0)
+            trace_dump_on_failure();
+        return err;
+    }
 
-        if ( write_valid ) {
-            DEBUG_PRINTF("Write %d\n", val_arg);
+    if (req.action == ACTION_WATCH)
+        return watch_run(plat, (unsigned)watch_rate, req.json, stdout);
 
-            err = plat->write_bootcount(val_arg);
-            if (err != 0) {
-                printf("Error %d\n", err);
-                return err;
-            }
-            return 0;
-        }
+    // the checks run before the lock is taken: they may take a while, or run bootcount themselves
+    if (req.action == ACTION_COMMIT_AFTER) {
+        err = health_run(checks_dir, stdout);
+        if (err != 0)
+            return err;
+        req.action = ACTION_WRITE;
+        req.write_op = HISTORY_RESET;
+        req.val_arg = 0;
     }
 
-    // if we fall through, print help and exit
-    fprintf(stderr, "Usage: %s [-r] [-f] [-s <val>]\n\n"
-                    "Read or set the u-boot 'bootcount'.  Presently supports the following:\n"
-                    "  * RTC SCRATCH2 register on TI AM33xx devices\n"
-                    "  * TAMP_BKP21R register on STM32MP1 devices\n"
-                    "  * SNVS_LPGPR0 register on IMX8M devices\n"
-                    "  * BBNSM_GPR0 register on IMX93 devices\n"
-                    "  * generic DM I2C EEPROM via /sys/bus/i2c/devices/\n"
-                    "If invoked without any arguments, this prints the current 'bootcount'\n"
-                    "value to stdout.\n\n"
-                    "OPTIONS:\n\n"
-                    "\t-r\t\tReset the bootcount to 0.  Same as '-s 0'\n\n"
-                    "\t-s <val>\tSet the bootcount to the given value.\n\n"
-                    "\t-f\t\tForce 'altbootcmd' by setting bootcount to UINT16_MAX - 1\n\n"
-                    "\t-d\t\tPrint platform detection details to stdout\n\n"
-                    "Package details:\t\t" PACKAGE_STRING "\n"
-                    "Bug Reports:\t\t" PACKAGE_BUGREPORT "\n"
-                    "Homepage:\t\t" PACKAGE_URL "\n\n", argv[0]);
-    return 1;
+    lock_fd = bootcount_lock();
+    err = run_action(plat, &req);
+    bootcount_unlock(lock_fd);
+    if (err != 0) {
+        printf(req.json ? "{\"error\":%d}\n" : "Error %d\n", err);
+        // a failed compare is an answer, not a fault worth a trace
+        if (err != E_MISMATCH)
+            trace_dump_on_failure();
+    }
+    return err;
 }
@@ -0,0 +1,73 @@
+/**
+ * Non-blocking backend operations for event loops
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* libbootcount.a hides everything else (-fvisibility=hidden) */
+#pragma GCC visibility push(default)
+
+/* A detected backend; only passed back to these functions */
+struct platform;
+
+/* bootcount_async_step(): the operation has not finished yet, poll the fd again */
+#define BOOTCOUNT_ASYNC_PENDING 1
+
+/*
+ * Start the worker thread.  Returns the fd to poll for POLLIN, which stays
+ * the same until bootcount_async_close(), or E_DEVICE.
+ */
+int bootcount_async_open(void);
+
+/* Wait for a running step to finish, then stop the worker and close the fd */
+void bootcount_async_close(void);
+
+/*
+ * Start an operation.  Only one runs at a time (the backends keep their
+ * state in statics); starting another before bootcount_async_complete() returns
+ * E_INVALID.  Reads and writes take the same lock as the bootcount CLI on
+ * the worker, and are recorded in its history like the CLI's (a write also
+ * clears the `--once` marker).
+ */
+int bootcount_async_detect(void);
+int bootcount_async_read(const struct platform *plat);
+int bootcount_async_write(const struct platform *plat, uint16_t val);
+
+/* Name of a detected backend, e.g. for logging */
+const char *bootcount_async_name(const struct platform *plat);
+
+/*
+ * Never blocks.  Call when the fd is readable: collects the finished step
+ * and starts the next one.  Returns BOOTCOUNT_ASYNC_PENDING, or 0 once the operation
+ * can be completed.
+ */
+int bootcount_async_step(void);
+
+/*
+ * Finish the operation and return its result: 0 or an E_* error.  A
+ * detection stores the platform in *plat, a read the value in *val; either
+ * may be NULL.
+ */
+int bootcount_async_complete(const struct platform **plat, uint16_t *val);
+
+/* Blocking wrapper: poll the fd and step until the operation completes */
+int bootcount_async_wait(const struct platform **plat, uint16_t *val);
+
+#pragma GCC visibility pop
@@ -0,0 +1,91 @@
+/**
+ * Named counters packed next to the U-Boot bootcount in nvmem/EEPROM
+ *
+ * Besides U-Boot's 2-byte bootcount cell [value, 0xbc], a board can keep a
+ * few more fixed-width counters (per-slot boot attempts, crash counts, ...)
+ * in the bytes that follow it.  The layout is a list "name:width,..." with
+ * widths of 1, 2 or 4 bytes, stored little-endian and packed in order
+ * right after the U-Boot cell.  The cell and all counters are read with a
+ * single pread(), and any subset is written back with a single pwrite()
+ * spanning just the counters that changed.
+ *
+ * Link with -lbootcount.  Callers serialize writers (see bootcount_lock()).
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* libbootcount.a hides everything else (-fvisibility=hidden) */
+#pragma GCC visibility push(default)
+
+#define BOOTCOUNT_COUNTERS_MAX 16
+#define BOOTCOUNT_COUNTER_NAME_LEN 24
+/* Bytes after the U-Boot cell the counters may occupy */
+#define BOOTCOUNT_COUNTERS_REGION 64
+
+struct bootcount_counter {
+    char name[BOOTCOUNT_COUNTER_NAME_LEN];
+    uint8_t width;              /* 1, 2 or 4 bytes */
+    uint8_t offset;             /* from the end of the U-Boot cell */
+    uint32_t value;             /* as last read, or as set for the next write */
+};
+
+struct bootcount_counters {
+    int fd;
+    off_t offset;               /* file offset of the U-Boot cell */
+    unsigned n;
+    struct bootcount_counter c[BOOTCOUNT_COUNTERS_MAX];
+    size_t len;                 /* U-Boot cell plus all counters */
+    uint8_t raw[2 + BOOTCOUNT_COUNTERS_REGION];  /* as last read or written */
+    int bootcount;              /* U-Boot value, or -1 if its magic is bad */
+    off_t wr_offset;            /* span of the last write */
+    size_t wr_len;
+};
+
+/*
+ * Open the nvmem/EEPROM sysfs file whose U-Boot cell is at offset, with the
+ * given layout ("name:width,...").  Returns 0, E_INVALID for a bad layout
+ * or E_DEVICE.
+ */
+int bootcount_counters_open(struct bootcount_counters *h, const char *path, off_t offset,
+                            const char *layout);
+
+/* Index of the named counter, or -1 */
+int bootcount_counters_find(const struct bootcount_counters *h, const char *name);
+
+/* Read the U-Boot cell and every counter with one pread() */
+int bootcount_counters_read(struct bootcount_counters *h);
+
+/*
+ * Write the counters whose bit is set in mask (bit i = h->c[i]) with one
+ * pwrite() covering the first to the last of them; counters in between
+ * are written back with the values last read.  Values are truncated to
+ * their width.  Call bootcount_counters_read() first.
+ */
+int bootcount_counters_write(struct bootcount_counters *h, uint32_t mask);
+
+/* Largest value a counter can hold */
+uint32_t bootcount_counter_max(const struct bootcount_counter *c);
+
+void bootcount_counters_close(struct bootcount_counters *h);
+
+#pragma GCC visibility pop
@@ -0,0 +1,74 @@
+/**
+ * Crash counter that can be bumped from a fatal-signal handler
+ *
+ * bootcount_crash_open_*() does everything that is not async-signal-safe up
+ * front: opening the device, mapping the register, validating the magic.
+ * bootcount_crash_increment() then uses only pread/pwrite on the preopened
+ * fd or plain loads/stores to the mapped register -- no allocation, stdio,
+ * locks or lazy mmap -- so it can be called from a SIGSEGV/SIGABRT handler
+ * of a dying process.
+ *
+ * The counter uses the same encoding as the bootcount itself:
+ *   register: 32-bit word, magic 0xB001 in the high half, value in the low half
+ *   file:     2 bytes [value, 0xbc] (EEPROM/RTC nvmem cell, or a plain file)
+ * so it must live at a location other than U-Boot's bootcount.
+ *
+ * All functions return 0 or a negative error code:
+ *   -1 bad magic, -2 device error, -4 write failed, -6 invalid argument.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* libbootcount.a hides everything else (-fvisibility=hidden) */
+#pragma GCC visibility push(default)
+
+struct bootcount_crash {
+    volatile uint32_t *reg;     /* mapped register, or NULL */
+    volatile uint32_t *kick;    /* AM33xx RTC KICK0R/KICK1R guarding reg, or NULL */
+    int fd;                     /* preopened file, or -1 */
+    off_t offset;               /* file offset of the 2-byte cell */
+    int busy;                   /* an increment is in flight */
+};
+
+/*
+ * Use the 32-bit register at physical address phys_addr, through /dev/mem.
+ * The caller picks the register; no platform detection is done, except that
+ * an AM33xx RTC register gets its write protection lifted on every write.
+ */
+int bootcount_crash_open_reg(struct bootcount_crash *h, off_t phys_addr);
+
+/* Use the 2-byte cell at offset of an nvmem/EEPROM sysfs file */
+int bootcount_crash_open_file(struct bootcount_crash *h, const char *path, off_t offset);
+
+/*
+ * Add one to the counter, saturating at the cell's maximum.  A blank cell
+ * (bad magic) counts from 0.  Async-signal-safe and thread-safe: if another
+ * thread is already incrementing through the same handle this returns 0
+ * without a second increment, since the process is dying once.
+ */
+int bootcount_crash_increment(struct bootcount_crash *h);
+
+/* Read the counter.  Not needed by the signal handler; async-signal-safe too. */
+int bootcount_crash_read(struct bootcount_crash *h, uint16_t *val);
+
+void bootcount_crash_close(struct bootcount_crash *h);
+
+#pragma GCC visibility pop
@@ -0,0 +1,153 @@
+/**
+ * bootcount_sim.c
+ *
+ * Simulate a fleet of devices booting, failing and rolling back, each with
+ * its own emulated bootcount backend, to load-test update orchestration
+ * and to measure how many backend operations per second one core sustains.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <config.h>
+
+#include "constants.h"
+#include "sim.h"
+
+bool bootcount_debug = DEBUG;
+
+static int usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n <devices>] [-c <boots>] [-b <backend>,...] [-p <pattern>,...]\n"
+                    "       [-l <bootlimit>] [-t <ms>] [-j <threads>] [-r] [-o]\n\n"
+                    "Simulate a fleet of devices with emulated bootcount backends.  Every boot,\n"
+                    "U-Boot increments the count and rolls back past the bootlimit; the device's\n"
+                    "pattern then decides what userspace does, one letter per boot, repeating:\n"
+                    "  g  healthy, the count is reset    f  failed, the watchdog reboots\n"
+                    "  p  power lost before the reset, registers without backup are cleared\n\n"
+                    "\t-n <devices>\tNumber of devices (default 10000)\n"
+                    "\t-c <boots>\tBoots per device (default 100)\n"
+                    "\t-b <list>\tBackends, assigned round robin: am33xx, imx8m,\n"
+                    "\t\t\ti2c-eeprom, dm-rtc (default all)\n"
+                    "\t-p <list>\tPatterns, assigned round robin (default g,ffg,fffff,gpg)\n"
+                    "\t-l <n>\t\tU-Boot bootlimit (default 3)\n"
+                    "\t-t <ms>\t\tSimulated time between boots, +-25%% (default 30000)\n"
+                    "\t-j <threads>\tSimulating threads, one per core (default 1)\n"
+                    "\t-r\t\tPace boots in real time instead of running flat out\n"
+                    "\t-o\t\tPrint one JSON line per boot to stdout\n\n"
+                    "Package details:\t\t" PACKAGE_STRING "\n", prog);
+    return 1;
+}
+
+static bool parse_uint(const char *arg, unsigned min, unsigned max, unsigned *val)
+{
+    char *end;
+    unsigned long v = strtoul(arg, &end, 10);
+
+    if (*arg == '\0' || *end != '\0' || v < min || v > max)
+        return false;
+    *val = (unsigned)v;
+    return true;
+}
+
+static bool parse_backends(const char *arg, unsigned *mask)
+{
+    *mask = 0;
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        int b = sim_backend_parse(arg, len);
+        if (b < 0)
+            return false;
+        *mask |= 1u << b;
+        arg += len + (arg[len] == ',');
+    }
+    return *mask != 0;
+}
+
+static bool parse_patterns(const char *arg, struct sim_config *cfg)
+{
+    cfg->npatterns = 0;
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+        if (len == 0 || len > SIM_PATTERN_LEN || cfg->npatterns == SIM_PATTERNS_MAX)
+            return false;
+        memcpy(cfg->patterns[cfg->npatterns], arg, len);
+        cfg->patterns[cfg->npatterns][len] = '\0';
+        if (!sim_pattern_valid(cfg->patterns[cfg->npatterns]))
+            return false;
+        cfg->npatterns++;
+        arg += len + (arg[len] == ',');
+    }
+    return cfg->npatterns > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sim_config cfg = {
+        .devices = 10000, .boots = 100, .bootlimit = 3, .threads = 1,
+        .backends = (1u << SIM_BACKENDS) - 1, .boot_ms = 30000,
+    };
+    struct sim_stats st;
+    struct timespec start, end;
+    int opt;
+
+    parse_patterns("g,ffg,fffff,gpg", &cfg);
+    while ((opt = getopt(argc, argv, "n:c:b:p:l:t:j:ro")) != -1) {
+        bool ok = true;
+
+        switch (opt) {
+        case 'n': ok = parse_uint(optarg, 1, 100000000, &cfg.devices); break;
+        case 'c': ok = parse_uint(optarg, 1, 1000000, &cfg.boots); break;
+        case 'b': ok = parse_backends(optarg, &cfg.backends); break;
+        case 'p': ok = parse_patterns(optarg, &cfg); break;
+        case 'l': ok = parse_uint(optarg, 0, 65535, &cfg.bootlimit); break;
+        case 't': ok = parse_uint(optarg, 1, 86400000, &cfg.boot_ms); break;
+        case 'j': ok = parse_uint(optarg, 1, 1024, &cfg.threads); break;
+        case 'r': cfg.realtime = true; break;
+        case 'o': cfg.report = stdout; break;
+        default: ok = false; break;
+        }
+        if (!ok)
+            return usage(argv[0]);
+    }
+    if (optind != argc)
+        return usage(argv[0]);
+    if (cfg.threads > cfg.devices)
+        cfg.threads = cfg.devices;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = sim_run(&cfg, &st);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (err)
+        return 1;
+
+    double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    unsigned long long ops = st.reads + st.writes;
+    fprintf(stderr, "devices=%u threads=%u boots=%llu rollbacks=%llu badmagic=%llu wraps=%llu\n"
+                    "reads=%llu writes=%llu skipped=%llu ops=%llu wall_s=%.3f cpu_s=%.3f\n"
+                    "ops/s=%.0f ops/s/core=%.0f\n",
+            cfg.devices, cfg.threads, st.boots, st.rollbacks, st.badmagic, st.wraps,
+            st.reads, st.writes, st.skipped, ops, wall, st.cpu_s,
+            wall > 0 ? ops / wall : 0, st.cpu_s > 0 ? ops / st.cpu_s : 0);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * bootcount_trace.c
+ *
+ * Decoder for the binary flight recorder dumps written by `bootcount` when
+ * BOOTCOUNT_TRACE=<file> is set and an operation fails.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <config.h>
+
+#include "constants.h"
+#include "trace.h"
+
+bool bootcount_debug = DEBUG;
+
+int main(int argc, char *argv[]) {
+    FILE *in = stdin;
+    int err;
+
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "Usage: %s [<dump file>]\n\n"
+                        "Decode a bootcount flight recorder dump.  Reads stdin if no file is given.\n\n"
+                        "Package details:\t\t" PACKAGE_STRING "\n", argv[0]);
+        return 1;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "-") != 0) {
+        in = fopen(argv[1], "rb");
+        if (!in) {
+            perror("open failed");
+            return 1;
+        }
+    }
+
+    err = trace_decode(in, stdout);
+    if (in != stdin)
+        fclose(in);
+    return err ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Per-boot idempotence marker keyed on the kernel boot_id
+ *
+ * With `bootcount --once`, a successful write records "<boot_id> <value>" in
+ * BOOTID_MARKER_PATH.  A later `--once` write of the same value during the
+ * same boot returns without touching the hardware at all.  Writes made
+ * without `--once` remove the marker, so it never hides a change made by
+ * another invocation.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "bootid.h"
+
+bool bootid_read(char *out, size_t outlen)
+{
+    if (outlen < BOOT_ID_LEN + 1)
+        return false;
+
+    FILE *f = fopen(BOOT_ID_PATH, "r");
+    if (!f)
+        return false;
+    size_t r = fread(out, 1, BOOT_ID_LEN, f);
+    fclose(f);
+    if (r != BOOT_ID_LEN)
+        return false;
+    out[BOOT_ID_LEN] = '\0';
+    return true;
+}
+
+bool bootid_read_raw(uint8_t out[16])
+{
+    char text[BOOT_ID_LEN + 1];
+    int n = 0;
+
+    memset(out, 0, 16);
+    if (!bootid_read(text, sizeof(text)))
+        return false;
+    for (const char *p = text; *p && n < 32; p++) {
+        int nibble;
+        if (*p >= '0' && *p <= '9')
+            nibble = *p - '0';
+        else if (*p >= 'a' && *p <= 'f')
+            nibble = *p - 'a' + 10;
+        else
+            continue;
+        out[n / 2] |= (uint8_t)(n % 2 ? nibble : nibble << 4);
+        n++;
+    }
+    return n == 32;
+}
+
+bool bootid_marker_matches(uint16_t val)
+{
+    char boot_id[BOOT_ID_LEN + 1];
+    char marker_id[BOOT_ID_LEN + 1];
+    unsigned marker_val;
+
+    if (!bootid_read(boot_id, sizeof(boot_id)))
+        return false;
+
+    FILE *f = fopen(BOOTID_MARKER_PATH, "r");
+    if (!f)
+        return false;
+    int n = fscanf(f, "%36s %u", marker_id, &marker_val);
+    fclose(f);
+    if (n != 2)
+        return false;
+
+    DEBUG_PRINTF("Marker boot_id %s value %u\n", marker_id, marker_val);
+    return strcmp(marker_id, boot_id) == 0 && marker_val == val;
+}
+
+void bootid_marker_update(uint16_t val)
+{
+    char boot_id[BOOT_ID_LEN + 1];
+
+    if (!bootid_read(boot_id, sizeof(boot_id))) {
+        DEBUG_PRINTF("Cannot read " BOOT_ID_PATH ", no marker written\n");
+        return;
+    }
+
+    FILE *f = fopen(BOOTID_MARKER_PATH, "w");
+    if (!f) {
+        DEBUG_PRINTF("Cannot write " BOOTID_MARKER_PATH "\n");
+        return;
+    }
+    fprintf(f, "%s %u\n", boot_id, val);
+    fclose(f);
+}
+
+void bootid_marker_clear(void)
+{
+    unlink(BOOTID_MARKER_PATH);
+}
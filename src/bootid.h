@@ -0,0 +1,43 @@
+/**
+ * Per-boot idempotence marker keyed on the kernel boot_id
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+#define BOOT_ID_LEN 36
+#define BOOTID_MARKER_PATH "/run/bootcount.marker"
+
+/* Read the current boot_id (36 character UUID).  Returns true on success. */
+bool bootid_read(char *out, size_t outlen);
+
+/* The boot_id as 16 raw bytes.  Returns false (and zeroes out) if unavailable. */
+bool bootid_read_raw(uint8_t out[16]);
+
+/* True if the marker says `val` was already written during this boot */
+bool bootid_marker_matches(uint16_t val);
+
+/* Record that `val` was written during this boot */
+void bootid_marker_update(uint16_t val);
+
+/* Forget the marker, e.g. after a write that did not use it */
+void bootid_marker_clear(void);
@@ -0,0 +1,1235 @@
+/**
+ * Board fixture capture and offline replay of platform detection
+ *
+ * bootcount --capture <tar> runs platform detection in a child under
+ * ptrace(2) and logs every file syscall it makes, with the path, the
+ * result and how long the syscall took.  Everything detection looked up,
+ * opened or listed under /proc, /sys and /dev is then written to a ustar
+ * archive (with GNU long name members for longer paths and link targets)
+ * as it is on the board:
+ *
+ *   opened files      their contents (up to CAPTURE_MAX_FILE bytes)
+ *   looked-up files   empty; the size is kept in the manifest, since e.g.
+ *                     the DM RTC check compares the nvmem size
+ *   directories       every entry of a listed directory, so that a replay
+ *                     scan sees the same names
+ *   symlinks          as symlinks to their canonical absolute target, so
+ *                     of_node links still resolve to the captured DT node
+ *                     (replay refuses targets outside /proc, /sys and /dev)
+ *
+ * plus /proc/device-tree/compatible and the of_node, type, nvmem and eeprom
+ * entries of every device in /sys/bus/i2c/devices and /sys/bus/nvmem/devices.
+ * Device nodes become empty files.  The manifest (CAPTURE_MANIFEST) holds
+ * the detected backend, the syscall counts, the untraced detection time and
+ * the access log.
+ *
+ * bootcount --replay <tar> extracts the archive to a temporary directory,
+ * runs the same traced detection chrooted into it (in a new user namespace
+ * if chroot needs privileges we lack) and compares the backend and the
+ * number of file syscalls with the manifest, naming the first access that
+ * differs.  BOOTCOUNT_EMULATE and BOOTCOUNT_FILE are ignored by both.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <config.h>
+
+#include "capture.h"
+#include "constants.h"
+#include "emulate.h"
+#include "fs_file.h"
+#include "platform.h"
+
+/* Syscall number, first three arguments and return value at a ptrace stop */
+#if defined(__x86_64__)
+typedef struct user_regs_struct sc_regs;
+#define SC_NR(r)        ((long)(r).orig_rax)
+#define SC_ARGS(r, a)   ((a)[0] = (r).rdi, (a)[1] = (r).rsi, (a)[2] = (r).rdx)
+#define SC_RET(r)       ((long)(r).rax)
+#elif defined(__i386__)
+typedef struct user_regs_struct sc_regs;
+#define SC_NR(r)        ((long)(r).orig_eax)
+#define SC_ARGS(r, a)   ((a)[0] = (r).ebx, (a)[1] = (r).ecx, (a)[2] = (r).edx)
+#define SC_RET(r)       ((long)(r).eax)
+#elif defined(__aarch64__)
+typedef struct user_regs_struct sc_regs;
+#define SC_NR(r)        ((long)(r).regs[8])
+#define SC_ARGS(r, a)   ((a)[0] = (r).regs[0], (a)[1] = (r).regs[1], (a)[2] = (r).regs[2])
+#define SC_RET(r)       ((long)(r).regs[0])
+#elif defined(__arm__)
+typedef struct user_regs sc_regs;
+#define SC_NR(r)        ((long)(r).uregs[7])
+#define SC_ARGS(r, a)   ((a)[0] = (r).uregs[0], (a)[1] = (r).uregs[1], (a)[2] = (r).uregs[2])
+#define SC_RET(r)       ((long)(r).uregs[0])
+#elif defined(__riscv)
+typedef struct user_regs_struct sc_regs;
+#define SC_NR(r)        ((long)(r).a7)
+#define SC_ARGS(r, a)   ((a)[0] = (r).a0, (a)[1] = (r).a1, (a)[2] = (r).a2)
+#define SC_RET(r)       ((long)(r).a0)
+#else
+#define CAPTURE_UNSUPPORTED
+#endif
+
+#ifndef CAPTURE_UNSUPPORTED
+
+/* Child exit status when it could not enter the capture root or be traced */
+#define EXIT_SETUP 0xfd
+
+#define MAX_FDS 64
+#define MAX_LINK_DEPTH 8
+#define TAR_BLOCK 512
+
+enum sc_kind {
+    SC_PATH,        /* path in arg 0 */
+    SC_AT,          /* dirfd in arg 0, path in arg 1 */
+    SC_OPEN,        /* like SC_PATH, returns an fd */
+    SC_OPENAT,      /* like SC_AT, returns an fd */
+    SC_FD,          /* fd in arg 0 */
+    SC_CLOSE,
+    SC_GETDENTS,    /* fd in arg 0, lists a directory */
+};
+
+struct sc_desc {
+    long nr;
+    const char *name;
+    enum sc_kind kind;
+};
+
+/* The syscalls that count as file accesses; anything else is only counted */
+static const struct sc_desc file_syscalls[] = {
+#ifdef SYS_open
+    { SYS_open,         "open",         SC_OPEN },
+#endif
+    { SYS_openat,       "openat",       SC_OPENAT },
+#ifdef SYS_stat
+    { SYS_stat,         "stat",         SC_PATH },
+#endif
+#ifdef SYS_lstat
+    { SYS_lstat,        "lstat",        SC_PATH },
+#endif
+#ifdef SYS_stat64
+    { SYS_stat64,       "stat64",       SC_PATH },
+#endif
+#ifdef SYS_lstat64
+    { SYS_lstat64,      "lstat64",      SC_PATH },
+#endif
+#ifdef SYS_newfstatat
+    { SYS_newfstatat,   "newfstatat",   SC_AT },
+#endif
+#ifdef SYS_fstatat64
+    { SYS_fstatat64,    "fstatat64",    SC_AT },
+#endif
+#ifdef SYS_statx
+    { SYS_statx,        "statx",        SC_AT },
+#endif
+#ifdef SYS_access
+    { SYS_access,       "access",       SC_PATH },
+#endif
+    { SYS_faccessat,    "faccessat",    SC_AT },
+#ifdef SYS_faccessat2
+    { SYS_faccessat2,   "faccessat2",   SC_AT },
+#endif
+#ifdef SYS_readlink
+    { SYS_readlink,     "readlink",     SC_PATH },
+#endif
+    { SYS_readlinkat,   "readlinkat",   SC_AT },
+#ifdef SYS_getdents
+    { SYS_getdents,     "getdents",     SC_GETDENTS },
+#endif
+    { SYS_getdents64,   "getdents64",   SC_GETDENTS },
+    { SYS_read,         "read",         SC_FD },
+    { SYS_pread64,      "pread64",      SC_FD },
+    { SYS_write,        "write",        SC_FD },
+#ifdef SYS_lseek
+    { SYS_lseek,        "lseek",        SC_FD },
+#endif
+#ifdef SYS__llseek
+    { SYS__llseek,      "_llseek",      SC_FD },
+#endif
+#ifdef SYS_fstat
+    { SYS_fstat,        "fstat",        SC_FD },
+#endif
+#ifdef SYS_fstat64
+    { SYS_fstat64,      "fstat64",      SC_FD },
+#endif
+#ifdef SYS_fcntl
+    { SYS_fcntl,        "fcntl",        SC_FD },
+#endif
+#ifdef SYS_fcntl64
+    { SYS_fcntl64,      "fcntl64",      SC_FD },
+#endif
+    { SYS_ioctl,        "ioctl",        SC_FD },
+    { SYS_close,        "close",        SC_CLOSE },
+};
+
+/* What the capture must reproduce of a path */
+#define PS_STAT     1   /* looked up: must exist, with its type */
+#define PS_CONTENT  2   /* opened: keep the bytes */
+#define PS_LIST     4   /* listed: every entry must exist */
+
+struct pathset {
+    struct pathent {
+        char *path;
+        int flags;
+    } *v;
+    size_t n, cap;
+};
+
+struct tracer {
+    FILE *log;                  /* one line per file syscall */
+    struct pathset *paths;      /* if set, collects what to capture */
+    unsigned long calls;        /* file syscalls */
+    unsigned long other;        /* all other syscalls */
+    unsigned long access_us;    /* time spent in the file syscalls */
+    char fds[MAX_FDS][PATH_MAX];
+};
+
+struct replay {
+    const char *tar_path;
+    const char *root;           /* empty directory to mount the capture on */
+    const char *manifest;
+};
+
+struct tar {
+    FILE *f;
+    FILE *sizes;                /* manifest lines for the empty placeholders */
+    struct pathset done;
+    size_t files;
+    time_t mtime;
+};
+
+static long elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1000000L + (b->tv_nsec - a->tv_nsec) / 1000L;
+}
+
+static bool captured_tree(const char *path)
+{
+    return strncmp(path, "/proc/", 6) == 0 || strncmp(path, "/sys/", 5) == 0 ||
+           strncmp(path, "/dev/", 5) == 0;
+}
+
+static struct pathent *pathset_find(struct pathset *ps, const char *path)
+{
+    for (size_t i = 0; i < ps->n; i++) {
+        if (strcmp(ps->v[i].path, path) == 0)
+            return &ps->v[i];
+    }
+    return NULL;
+}
+
+/* Returns false if path was already in the set or memory ran out */
+static bool pathset_add(struct pathset *ps, const char *path, int flags)
+{
+    struct pathent *e = pathset_find(ps, path);
+    if (e) {
+        e->flags |= flags;
+        return false;
+    }
+    if (ps->n == ps->cap) {
+        size_t cap = ps->cap ? ps->cap * 2 : 256;
+        struct pathent *v = realloc(ps->v, cap * sizeof(*v));
+        if (!v)
+            return false;
+        ps->v = v;
+        ps->cap = cap;
+    }
+    if (!(ps->v[ps->n].path = strdup(path)))
+        return false;
+    ps->v[ps->n++].flags = flags;
+    return true;
+}
+
+static void pathset_free(struct pathset *ps)
+{
+    for (size_t i = 0; i < ps->n; i++)
+        free(ps->v[i].path);
+    free(ps->v);
+    memset(ps, 0, sizeof(*ps));
+}
+
+static const struct sc_desc *file_syscall(long nr)
+{
+    for (size_t i = 0; i < sizeof(file_syscalls) / sizeof(file_syscalls[0]); i++) {
+        if (file_syscalls[i].nr == nr)
+            return &file_syscalls[i];
+    }
+    return NULL;
+}
+
+static void read_string(pid_t pid, unsigned long addr, char *out, size_t len)
+{
+    size_t n = 0;
+
+    while (n < len - 1) {
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, pid, (void *)(addr + n), NULL);
+        if (errno != 0)
+            break;
+        for (size_t i = 0; i < sizeof(word) && n < len - 1; i++, n++) {
+            out[n] = ((const char *)&word)[i];
+            if (out[n] == '\0')
+                return;
+        }
+    }
+    out[n] = '\0';
+}
+
+static bool get_regs(pid_t pid, sc_regs *regs)
+{
+    struct iovec iov = { .iov_base = regs, .iov_len = sizeof(*regs) };
+    return ptrace(PTRACE_GETREGSET, pid, (void *)NT_PRSTATUS, &iov) == 0;
+}
+
+/* Log one completed syscall and note the path it touched */
+static void record(struct tracer *t, pid_t pid, long nr, const unsigned long *args, long ret, long us)
+{
+    const struct sc_desc *d = file_syscall(nr);
+    char path[PATH_MAX] = "";
+    int fd = (int)args[0];
+    int flags = 0;
+
+    if (!d) {
+        t->other++;
+        return;
+    }
+    switch (d->kind) {
+    case SC_PATH:
+    case SC_OPEN:
+        read_string(pid, args[0], path, sizeof(path));
+        flags = PS_STAT;
+        break;
+    case SC_AT:
+    case SC_OPENAT:
+        read_string(pid, args[1], path, sizeof(path));
+        if (path[0] != '/' && fd >= 0 && fd < MAX_FDS && t->fds[fd][0]) {
+            char rel[PATH_MAX];
+            snprintf(rel, sizeof(rel), "%s", path);
+            if (snprintf(path, sizeof(path), "%s/%s", t->fds[fd], rel) >= (int)sizeof(path))
+                DEBUG_PRINTF("Path truncated: %s\n", path);
+        }
+        flags = PS_STAT;
+        break;
+    case SC_GETDENTS:
+        flags = PS_LIST;
+        /* fall through */
+    case SC_FD:
+    case SC_CLOSE:
+        if (fd >= 0 && fd < MAX_FDS && t->fds[fd][0])
+            snprintf(path, sizeof(path), "%s", t->fds[fd]);
+        else
+            snprintf(path, sizeof(path), "fd:%d", fd);
+        if (d->kind == SC_CLOSE && fd >= 0 && fd < MAX_FDS)
+            t->fds[fd][0] = '\0';
+        break;
+    }
+    if ((d->kind == SC_OPEN || d->kind == SC_OPENAT) && ret >= 0) {
+        flags |= PS_CONTENT;
+        if (ret < MAX_FDS)
+            snprintf(t->fds[ret], sizeof(t->fds[ret]), "%s", path);
+    }
+
+    t->calls++;
+    t->access_us += (unsigned long)us;
+    fprintf(t->log, "%lu %s %ld %ld %s\n", t->calls, d->name, ret, us, path[0] ? path : "-");
+    if (t->paths && ret >= 0 && flags && captured_tree(path))
+        pathset_add(t->paths, path, flags);
+}
+
+/* Relative, without "." or ".." components */
+static bool safe_member(const char *name)
+{
+    if (name[0] == '/' || name[0] == '\0')
+        return false;
+    for (const char *p = name; *p; p += strcspn(p, "/"), p += *p == '/') {
+        size_t n = strcspn(p, "/");
+        if ((n == 1 && p[0] == '.') || (n == 2 && p[0] == '.' && p[1] == '.'))
+            return false;
+    }
+    return true;
+}
+
+/* A symlink target as captured: canonical, absolute and inside a captured tree */
+static bool safe_link(const char *target)
+{
+    return target[0] == '/' && safe_member(target + 1) && captured_tree(target);
+}
+
+static unsigned long octal(const unsigned char *field, size_t len)
+{
+    char buf[16];
+    memcpy(buf, field, len);
+    buf[len] = '\0';
+    return strtoul(buf, NULL, 8);
+}
+
+static int copy_out(FILE *f, int fd, unsigned long size)
+{
+    char buf[TAR_BLOCK];
+    while (size > 0) {
+        size_t n = size < sizeof(buf) ? size : sizeof(buf);
+        if (fread(buf, n, 1, f) != 1 || write(fd, buf, n) != (ssize_t)n)
+            return E_INVALID;
+        size -= n;
+    }
+    return 0;
+}
+
+struct member {
+    char *name;
+    char *link;
+    char type;
+    long offset;                /* of the data in the archive */
+    unsigned long size;
+};
+
+static void free_members(struct member *members, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        free(members[i].name);
+        free(members[i].link);
+    }
+    free(members);
+}
+
+/* Data of a GNU long name ('L') or long link ('K') member */
+static char *read_long(FILE *f, unsigned long size)
+{
+    char *s;
+
+    if (size == 0 || size > PATH_MAX || !(s = malloc(size + 1)))
+        return NULL;
+    if (fread(s, size, 1, f) != 1) {
+        free(s);
+        return NULL;
+    }
+    s[size] = '\0';
+    return s;
+}
+
+/* Read every member header; the manifest goes to *manifest instead */
+static int read_members(FILE *f, struct member **members, size_t *n, char **manifest)
+{
+    unsigned char h[TAR_BLOCK];
+    char *long_name = NULL, *long_link = NULL;
+    size_t cap = 0;
+    int err = 0;
+
+    while (!err && fread(h, sizeof(h), 1, f) == 1 && h[0]) {
+        struct member m = { NULL, NULL, 0, 0, 0 };
+        char name[155 + 1 + 100 + 1];
+        unsigned sum = 0;
+
+        for (size_t i = 0; i < sizeof(h); i++)
+            sum += (i >= 148 && i < 156) ? ' ' : h[i];
+        if (memcmp(h + 257, "ustar", 5) != 0 || sum != octal(h + 148, 7)) {
+            err = E_INVALID;
+            break;
+        }
+        m.type = h[156] ? (char)h[156] : '0';
+        m.offset = ftell(f);
+        m.size = octal(h + 124, 11);
+
+        if (m.type == 'L' || m.type == 'K') {
+            /* the full name or link target of the next member */
+            char **s = m.type == 'L' ? &long_name : &long_link;
+            free(*s);
+            if (!(*s = read_long(f, m.size)))
+                err = E_INVALID;
+        } else {
+            if (h[345])
+                snprintf(name, sizeof(name), "%.155s/%.100s", (const char *)h + 345, (const char *)h);
+            else
+                snprintf(name, sizeof(name), "%.100s", (const char *)h);
+            m.name = long_name ? long_name : strdup(name);
+            m.link = long_link ? long_link : strndup((const char *)h + 157, 100);
+            long_name = long_link = NULL;
+            if (!m.name || !m.link) {
+                free(m.name);
+                free(m.link);
+                err = E_INVALID;
+                break;
+            }
+            /* GNU tar writes directories as "name/" */
+            size_t len = strlen(m.name);
+            while (len > 1 && m.name[len - 1] == '/')
+                m.name[--len] = '\0';
+
+            bool is_manifest = strcmp(m.name, CAPTURE_MANIFEST) == 0 && m.type == '0';
+            if (!safe_member(m.name) || (m.type == '2' && !safe_link(m.link))) {
+                err = E_INVALID;
+            } else if (is_manifest) {
+                free(*manifest);
+                if (!(*manifest = malloc(m.size + 1)) || (m.size && fread(*manifest, m.size, 1, f) != 1))
+                    err = E_INVALID;
+                else
+                    (*manifest)[m.size] = '\0';
+            } else if (*n == cap) {
+                cap = cap ? cap * 2 : 256;
+                struct member *v = realloc(*members, cap * sizeof(*v));
+                if (v)
+                    *members = v;
+                else
+                    err = E_INVALID;
+            }
+            if (!err && !is_manifest) {
+                (*members)[(*n)++] = m;
+            } else {
+                free(m.name);
+                free(m.link);
+            }
+        }
+        if (!err && fseek(f, m.offset + (long)((m.size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK), SEEK_SET) != 0)
+            err = E_INVALID;
+    }
+    free(long_name);
+    free(long_link);
+    return !err && *manifest ? 0 : E_INVALID;
+}
+
+/* True if readdir() in dir returns the newest entry first (tmpfs on some kernels) */
+static bool lists_newest_first(const char *dir)
+{
+    char a[PATH_MAX], b[PATH_MAX];
+    bool newest_first = false;
+
+    snprintf(a, sizeof(a), "%s/.order-a", dir);
+    snprintf(b, sizeof(b), "%s/.order-b", dir);
+    if (mkdir(a, 0700) == 0 && mkdir(b, 0700) == 0) {
+        DIR *d = opendir(dir);
+        struct dirent *de;
+        while (d && (de = readdir(d))) {
+            if (strncmp(de->d_name, ".order-", 7) == 0) {
+                newest_first = de->d_name[7] == 'b';
+                break;
+            }
+        }
+        if (d)
+            closedir(d);
+    }
+    rmdir(a);
+    rmdir(b);
+    return newest_first;
+}
+
+static bool is_child(const char *name, const char *dir)
+{
+    size_t len = strlen(dir);
+    if (len == 0)
+        return !strchr(name, '/');
+    return strncmp(name, dir, len) == 0 && name[len] == '/' && !strchr(name + len + 1, '/');
+}
+
+/*
+ * Create the members directly inside dir (relative to root), then recurse
+ * into the directories among them.  Siblings are created in archive order,
+ * or the reverse if the filesystem lists the newest entry first, so that
+ * readdir() returns them in archive order.  Only directories created here
+ * are descended into, so a symlink in the archive is never written through.
+ */
+static int create_children(FILE *f, const struct member *members, size_t n, size_t *order,
+                           const char *root, const char *dir, bool newest_first)
+{
+    size_t count = 0;
+    int err = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (is_child(members[i].name, dir))
+            order[count++] = i;
+    }
+    for (size_t k = 0; k < count && !err; k++) {
+        const struct member *m = &members[order[newest_first ? count - 1 - k : k]];
+        char dst[PATH_MAX];
+        int fd;
+
+        if (snprintf(dst, sizeof(dst), "%s/%s", root, m->name) >= (int)sizeof(dst))
+            return E_INVALID;
+        if (m->type == '5') {
+            if (mkdir(dst, 0755) != 0)
+                err = E_INVALID;
+        } else if (m->type == '2') {
+            if (symlink(m->link, dst) != 0)
+                err = E_INVALID;
+        } else if (m->type == '0') {
+            if ((fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0444)) < 0)
+                return E_INVALID;
+            if (fseek(f, m->offset, SEEK_SET) != 0 || copy_out(f, fd, m->size) != 0)
+                err = E_INVALID;
+            close(fd);
+        }
+    }
+    /* order[] is reused by the recursion: collect the directories again for each step */
+    for (size_t i = 0; i < n && !err; i++) {
+        if (members[i].type == '5' && is_child(members[i].name, dir))
+            err = create_children(f, members, n, order, root, members[i].name, newest_first);
+    }
+    return err;
+}
+
+/*
+ * Extract the capture into root, or only read the manifest into *manifest
+ * if root is NULL.
+ */
+static int extract(const char *tar_path, const char *root, char **manifest)
+{
+    FILE *f = fopen(tar_path, "rb");
+    struct member *members = NULL;
+    size_t n = 0;
+    char *own_manifest = NULL;
+    int err;
+
+    if (!f) {
+        perror(tar_path);
+        return E_INVALID;
+    }
+    err = read_members(f, &members, &n, manifest ? manifest : &own_manifest);
+    if (!err && root) {
+        size_t *order = malloc((n ? n : 1) * sizeof(*order));
+        err = order ? create_children(f, members, n, order, root, "", lists_newest_first(root)) : E_INVALID;
+        free(order);
+    }
+    fclose(f);
+    free_members(members, n);
+    free(own_manifest);
+    if (err)
+        fprintf(stderr, "%s is not a bootcount capture\n", tar_path);
+    return err;
+}
+
+/* Value of "<key> <value>" in the manifest header, or NULL */
+static const char *manifest_value(const char *manifest, const char *key, char *out, size_t len)
+{
+    size_t key_len = strlen(key);
+    for (const char *p = manifest; *p; p += strcspn(p, "\n"), p += *p == '\n') {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == ' ') {
+            snprintf(out, len, "%.*s", (int)strcspn(p + key_len + 1, "\n"), p + key_len + 1);
+            return out;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Give the placeholders their sizes from the board.  Runs chrooted into the
+ * capture, so that no path, through whatever symlinks, leads out of it.
+ */
+static void apply_sizes(const char *manifest)
+{
+    for (const char *p = manifest; *p; p += strcspn(p, "\n"), p += *p == '\n') {
+        char line[PATH_MAX + 32], file[PATH_MAX];
+        long long size;
+        struct stat st;
+
+        if (strncmp(p, "size /", 6) != 0)
+            continue;
+        snprintf(line, sizeof(line), "%.*s", (int)strcspn(p, "\n"), p);
+        char *sp = strrchr(line, ' ');
+        if (sp == line + 4 || sscanf(sp + 1, "%lld", &size) != 1)
+            continue;
+        snprintf(file, sizeof(file), "%.*s", (int)(sp - line - 5), line + 5);
+        if (safe_member(file + 1) && lstat(file, &st) == 0 && S_ISREG(st.st_mode) &&
+            truncate(file, (off_t)size) != 0)
+            DEBUG_PRINTF("Cannot size %s\n", file);
+    }
+}
+
+static bool write_file(const char *path, const char *buf, size_t len)
+{
+    int fd = open(path, O_WRONLY);
+    bool ok = fd >= 0 && write(fd, buf, len) == (ssize_t)len;
+    if (fd >= 0)
+        close(fd);
+    return ok;
+}
+
+/*
+ * Unpack the capture into a tmpfs at root, private to a new mount namespace
+ * (and user namespace, if we lack the privileges), and chroot into it.  On
+ * tmpfs, directories list their entries in the order they were created,
+ * which is the order the board listed them in.
+ */
+static int enter_capture(const struct replay *r)
+{
+    if (unshare(CLONE_NEWNS) != 0) {
+        char map[32];
+        int len = snprintf(map, sizeof(map), "0 %lu 1", (unsigned long)getuid());
+        int glen = snprintf(map + 16, sizeof(map) - 16, "0 %lu 1", (unsigned long)getgid());
+
+        if (errno != EPERM || unshare(CLONE_NEWUSER | CLONE_NEWNS) != 0 ||
+            !write_file("/proc/self/uid_map", map, (size_t)len) ||
+            !write_file("/proc/self/setgroups", "deny", 4) ||
+            !write_file("/proc/self/gid_map", map + 16, (size_t)glen))
+            return -1;
+    }
+    if (mount("none", "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0 ||
+        mount("bootcount-replay", r->root, "tmpfs", 0, "mode=0755") != 0 ||
+        extract(r->tar_path, r->root, NULL) != 0)
+        return -1;
+    if (chroot(r->root) != 0 || chdir("/") != 0)
+        return -1;
+    apply_sizes(r->manifest);
+    return 0;
+}
+
+/* The same starting point for capture and replay: no environment overrides, no debug output */
+static void detect_setup(void)
+{
+    unsetenv(EMULATE_ENV);
+    unsetenv(FS_FILE_ENV);
+    bootcount_debug = false;
+}
+
+/*
+ * Run platform_probe() in a traced child, inside the capture r if given.
+ * Returns the platform index, or E_DEVICE if the child could not be run.
+ */
+static int traced_detect(const struct replay *r, struct tracer *t)
+{
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return E_DEVICE;
+    if (pid == 0) {
+        if ((r && enter_capture(r) != 0) || ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0)
+            _exit(EXIT_SETUP);
+        detect_setup();
+        raise(SIGSTOP);
+        _exit(platform_index(platform_probe()));
+    }
+
+    if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status) ||
+        ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return E_DEVICE;
+    }
+
+    bool in_call = false;
+    int sig = 0;
+    long nr = -1;
+    unsigned long args[3] = { 0, 0, 0 };
+    struct timespec start = { 0, 0 }, end;
+    sc_regs regs;
+
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) != 0 || waitpid(pid, &status, 0) != pid)
+            break;
+        sig = 0;
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+            break;
+        if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+            sig = WSTOPSIG(status);
+            continue;
+        }
+        if (!in_call) {
+            if (get_regs(pid, &regs)) {
+                nr = SC_NR(regs);
+                SC_ARGS(regs, args);
+            }
+            in_call = true;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            in_call = false;
+            if (get_regs(pid, &regs))
+                record(t, pid, nr, args, SC_RET(regs), elapsed_us(&start, &end));
+        }
+    }
+    if (!WIFEXITED(status) && !WIFSIGNALED(status)) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == EXIT_SETUP)
+        return E_DEVICE;
+    return WEXITSTATUS(status);
+}
+
+/* Wall time of platform_probe() in a child that is not traced, or -1 */
+static long untraced_detect_us(void)
+{
+    int fds[2];
+    long us = -1;
+
+    if (pipe(fds) != 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct timespec start, end;
+        close(fds[0]);
+        detect_setup();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        platform_probe();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        us = elapsed_us(&start, &end);
+        _exit(write(fds[1], &us, sizeof(us)) == (ssize_t)sizeof(us) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid > 0) {
+        if (read(fds[0], &us, sizeof(us)) != (ssize_t)sizeof(us))
+            us = -1;
+        waitpid(pid, NULL, 0);
+    }
+    close(fds[0]);
+    return us;
+}
+
+static const char *result_name(int idx)
+{
+    const char *name = platform_index_name((uint8_t)idx);
+    return name ? name : "none";
+}
+
+static int tar_data(struct tar *t, const void *buf, size_t len)
+{
+    static const unsigned char zero[TAR_BLOCK];
+    size_t pad = (TAR_BLOCK - len % TAR_BLOCK) % TAR_BLOCK;
+
+    if ((len && fwrite(buf, len, 1, t->f) != 1) || (pad && fwrite(zero, pad, 1, t->f) != 1))
+        return E_DEVICE;
+    return 0;
+}
+
+static int tar_block(struct tar *t, const char *name, size_t name_len, char type, unsigned mode,
+                     size_t size, const char *link, size_t link_len)
+{
+    unsigned char h[TAR_BLOCK];
+    unsigned sum = 0;
+
+    memset(h, 0, sizeof(h));
+    if (name_len <= 100) {
+        memcpy(h, name, name_len);
+    } else {
+        /* split into prefix (155) and name (100) at a '/' */
+        const char *slash = name + name_len - 101;
+        while (*slash != '/')
+            slash++;
+        memcpy(h + 345, name, (size_t)(slash - name));
+        memcpy(h, slash + 1, name_len - (size_t)(slash + 1 - name));
+    }
+    snprintf((char *)h + 100, 8, "%07o", mode);
+    snprintf((char *)h + 108, 8, "%07o", 0);
+    snprintf((char *)h + 116, 8, "%07o", 0);
+    snprintf((char *)h + 124, 12, "%011lo", (unsigned long)size);
+    snprintf((char *)h + 136, 12, "%011lo", (unsigned long)t->mtime);
+    h[156] = (unsigned char)type;
+    if (link)
+        memcpy(h + 157, link, link_len);
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+    memcpy(h + 265, "root", 4);
+    memcpy(h + 297, "root", 4);
+    memset(h + 148, ' ', 8);
+    for (size_t i = 0; i < sizeof(h); i++)
+        sum += h[i];
+    snprintf((char *)h + 148, 7, "%06o", sum);
+    return fwrite(h, sizeof(h), 1, t->f) == 1 ? 0 : E_DEVICE;
+}
+
+/* True if name fits the ustar name and prefix fields */
+static bool ustar_name(const char *name, size_t len)
+{
+    if (len <= 100)
+        return true;
+    const char *slash = name + len - 101;
+    while (*slash && *slash != '/')
+        slash++;
+    return *slash && slash - name <= 155;
+}
+
+/* GNU long name ('L') or long link target ('K') member for the header that follows */
+static int tar_long(struct tar *t, char type, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    int err = tar_block(t, "././@LongLink", 13, type, 0644, len, NULL, 0);
+    return err ? err : tar_data(t, s, len);
+}
+
+/*
+ * Member header.  A name or link target too long for ustar (such as sysfs
+ * device paths) goes into a GNU long name member before it, truncated in
+ * the header itself; GNU tar, bsdtar and read_members() all read them.
+ */
+static int tar_header(struct tar *t, const char *name, char type, unsigned mode, size_t size, const char *link)
+{
+    size_t name_len = strlen(name), link_len = link ? strlen(link) : 0;
+    int err = 0;
+
+    if (!ustar_name(name, name_len)) {
+        err = tar_long(t, 'L', name);
+        name_len = 100;
+    }
+    if (!err && link_len > 100) {
+        err = tar_long(t, 'K', link);
+        link_len = 100;
+    }
+    return err ? err : tar_block(t, name, name_len, type, mode, size, link, link_len);
+}
+
+/* End of archive: two zero blocks */
+static int tar_end(struct tar *t)
+{
+    static const unsigned char zero[TAR_BLOCK * 2];
+    return fwrite(zero, sizeof(zero), 1, t->f) == 1 ? 0 : E_DEVICE;
+}
+
+static int tar_file(struct tar *t, const char *name, const void *buf, size_t len)
+{
+    int err = tar_header(t, name, '0', 0444, len, NULL);
+    return err ? err : tar_data(t, buf, len);
+}
+
+/* Archive one object at path (no symlinks in it), once */
+static void tar_object(struct tar *t, const char *path, const struct stat *st, int flags)
+{
+    static unsigned char buf[CAPTURE_MAX_FILE];
+    const char *name = path + 1;
+    size_t len = 0;
+
+    if (!pathset_add(&t->done, path, 0))
+        return;
+    if (S_ISDIR(st->st_mode)) {
+        tar_header(t, name, '5', 0755, 0, NULL);
+        return;
+    }
+    if (S_ISREG(st->st_mode) && (flags & PS_CONTENT)) {
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            ssize_t r;
+            while (len < sizeof(buf) && (r = read(fd, buf + len, sizeof(buf) - len)) > 0)
+                len += (size_t)r;
+            close(fd);
+        }
+    } else if (S_ISREG(st->st_mode) && st->st_size > 0) {
+        fprintf(t->sizes, "size %s %lld\n", path, (long long)st->st_size);
+    }
+    if (tar_file(t, name, buf, len) == 0)
+        t->files++;
+}
+
+/* Archive path and each directory above it, following symlinks to their canonical targets */
+static void tar_add(struct tar *t, const char *path, int flags, int depth)
+{
+    char cur[PATH_MAX] = "";
+    size_t cur_len = 0;
+    const char *p = path;
+
+    while (*p) {
+        while (*p == '/')
+            p++;
+        size_t n = strcspn(p, "/");
+        if (n == 0)
+            break;
+        if (cur_len + 1 + n >= sizeof(cur))
+            return;
+        cur[cur_len++] = '/';
+        memcpy(cur + cur_len, p, n);
+        cur_len += n;
+        cur[cur_len] = '\0';
+        p += n;
+
+        struct stat st;
+        if (lstat(cur, &st) != 0)
+            return;
+        if (S_ISLNK(st.st_mode)) {
+            char target[PATH_MAX], next[PATH_MAX];
+            if (depth >= MAX_LINK_DEPTH || !realpath(cur, target) || !captured_tree(target))
+                return;
+            if (pathset_add(&t->done, cur, 0))
+                tar_header(t, cur + 1, '2', 0777, 0, target);
+            if (snprintf(next, sizeof(next), "%s%s", target, p) < (int)sizeof(next))
+                tar_add(t, next, flags, depth + 1);
+            return;
+        }
+        /* only the last component gets its contents */
+        tar_object(t, cur, &st, *p ? 0 : flags);
+        if (!S_ISDIR(st.st_mode))
+            return;
+    }
+}
+
+/* The bus device entries the DM EEPROM, DM RTC and i2c-dev checks look at */
+static void add_bus_devices(struct pathset *ps, const char *bus)
+{
+    static const char *const entries[] = { "of_node", "type", "nvmem", "eeprom" };
+    DIR *d = opendir(bus);
+    struct dirent *de;
+
+    if (!d)
+        return;
+    pathset_add(ps, bus, PS_LIST);
+    while ((de = readdir(d))) {
+        char path[PATH_MAX];
+        if (de->d_name[0] == '.')
+            continue;
+        for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+            if (snprintf(path, sizeof(path), "%s/%s/%s", bus, de->d_name, entries[i]) < (int)sizeof(path) &&
+                access(path, F_OK) == 0)
+                pathset_add(ps, path, strcmp(entries[i], "type") == 0 ? PS_CONTENT : PS_STAT);
+        }
+    }
+    closedir(d);
+}
+
+/*
+ * Every entry of a listed directory must exist in the capture.  They are
+ * archived first, in the order the board lists them, so that a replay scan
+ * visits them in the same order.
+ */
+static void tar_listed(struct tar *t, struct pathset *ps)
+{
+    for (size_t i = 0; i < ps->n; i++) {
+        if (!(ps->v[i].flags & PS_LIST))
+            continue;
+        DIR *d = opendir(ps->v[i].path);
+        struct dirent *de;
+        if (!d)
+            continue;
+        while ((de = readdir(d))) {
+            char path[PATH_MAX];
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+                snprintf(path, sizeof(path), "%s/%s", ps->v[i].path, de->d_name) >= (int)sizeof(path))
+                continue;
+            struct pathent *e = pathset_find(ps, path);
+            tar_add(t, path, e ? e->flags : PS_STAT, 0);
+        }
+        closedir(d);
+    }
+}
+
+int capture_write(const char *tar_path, FILE *out)
+{
+    static struct tracer t;
+    struct pathset ps = { 0 };
+    struct tar tar = { 0 };
+    char *log = NULL, *sizes = NULL;
+    size_t log_len = 0, sizes_len = 0;
+    struct utsname uts;
+    int err = 0;
+
+    memset(&t, 0, sizeof(t));
+    t.paths = &ps;
+    if (!(t.log = open_memstream(&log, &log_len)))
+        return E_DEVICE;
+    int idx = traced_detect(NULL, &t);
+    fclose(t.log);
+    if (idx < 0) {
+        fprintf(stderr, "Cannot trace detection (is ptrace allowed?)\n");
+        err = idx;
+        goto out;
+    }
+    long detect_us = untraced_detect_us();
+
+    pathset_add(&ps, "/proc/device-tree/compatible", PS_CONTENT);
+    add_bus_devices(&ps, "/sys/bus/i2c/devices");
+    add_bus_devices(&ps, "/sys/bus/nvmem/devices");
+
+    tar.mtime = time(NULL);
+    tar.f = fopen(tar_path, "wb");
+    tar.sizes = open_memstream(&sizes, &sizes_len);
+    if (!tar.f || !tar.sizes) {
+        perror(tar_path);
+        err = E_INVALID;
+        goto out;
+    }
+    tar_listed(&tar, &ps);
+    for (size_t i = 0; i < ps.n; i++)
+        tar_add(&tar, ps.v[i].path, ps.v[i].flags, 0);
+    fclose(tar.sizes);
+    tar.sizes = NULL;
+
+    if (uname(&uts) != 0)
+        memset(&uts, 0, sizeof(uts));
+    char *manifest = NULL;
+    size_t manifest_len = 0;
+    FILE *m = open_memstream(&manifest, &manifest_len);
+    if (!m) {
+        err = E_DEVICE;
+        goto out;
+    }
+    fprintf(m, "bootcount-capture 1\n"
+               "package " PACKAGE_STRING "\n"
+               "kernel %s %s %s\n"
+               "result %s\n"
+               "calls %lu\n"
+               "other %lu\n"
+               "access_us %lu\n"
+               "detect_us %ld\n",
+            uts.sysname, uts.release, uts.machine, result_name(idx), t.calls, t.other,
+            t.access_us, detect_us);
+    fwrite(sizes, 1, sizes_len, m);
+    fwrite(log, 1, log_len, m);
+    fclose(m);
+    err = tar_file(&tar, CAPTURE_MANIFEST, manifest, manifest_len);
+    free(manifest);
+    if (!err)
+        err = tar_end(&tar);
+    if (fclose(tar.f) != 0 && !err)
+        err = E_DEVICE;
+    tar.f = NULL;
+    if (err) {
+        fprintf(stderr, "Cannot write %s\n", tar_path);
+        goto out;
+    }
+
+    fprintf(out, "Detected %s\n", result_name(idx));
+    fprintf(out, "Captured %zu files, %lu file syscalls (%lu us; %lu other syscalls) to %s\n",
+            tar.files, t.calls, t.access_us, t.other, tar_path);
+    if (detect_us >= 0)
+        fprintf(out, "Detection took %ld us untraced\n", detect_us);
+out:
+    if (tar.sizes)
+        fclose(tar.sizes);
+    if (tar.f)
+        fclose(tar.f);
+    pathset_free(&ps);
+    pathset_free(&tar.done);
+    free(log);
+    free(sizes);
+    return err;
+}
+
+/* Advance *p past the next access log line and return its "<call> <path>", or false at the end */
+static bool next_access(const char **p, char *out, size_t len)
+{
+    while (**p) {
+        const char *line = *p;
+        size_t n = strcspn(line, "\n");
+        *p += n + (line[n] == '\n');
+        if (*line < '0' || *line > '9')
+            continue;
+        /* skip the sequence number, keep the call, skip result and time */
+        const char *call = line + strcspn(line, " ") + 1;
+        const char *ret = call + strcspn(call, " ");
+        const char *path = ret + 1;
+        for (int i = 0; i < 2; i++)
+            path += strcspn(path, " ") + (path[strcspn(path, " ")] == ' ');
+        if (path > line + n)
+            path = line + n;
+        snprintf(out, len, "%.*s %.*s", (int)(ret - call), call, (int)(line + n - path), path);
+        return true;
+    }
+    return false;
+}
+
+int capture_replay(const char *tar_path, FILE *out)
+{
+    static struct tracer t;
+    char root[] = "/tmp/bootcount-replay.XXXXXX";
+    struct replay r = { .tar_path = tar_path, .root = root };
+    char *manifest = NULL, *log = NULL;
+    size_t log_len = 0;
+    char result[64], calls[32], access_us[32];
+    int err;
+
+    if (!mkdtemp(root)) {
+        perror(root);
+        return E_DEVICE;
+    }
+    err = extract(tar_path, NULL, &manifest);
+    if (!err && (!manifest_value(manifest, "result", result, sizeof(result)) ||
+                 !manifest_value(manifest, "calls", calls, sizeof(calls)))) {
+        fprintf(stderr, "%s is not a bootcount capture\n", tar_path);
+        err = E_INVALID;
+    }
+    if (!err) {
+        r.manifest = manifest;
+        memset(&t, 0, sizeof(t));
+        if (!(t.log = open_memstream(&log, &log_len))) {
+            err = E_DEVICE;
+        } else {
+            int idx = traced_detect(&r, &t);
+            fclose(t.log);
+            if (idx < 0) {
+                fprintf(stderr, "Cannot replay %s (are namespaces and ptrace allowed?)\n", tar_path);
+                err = idx;
+            } else {
+                const char *replayed = result_name(idx);
+                unsigned long captured_calls = strtoul(calls, NULL, 10);
+                bool same_result = strcmp(result, replayed) == 0;
+                bool same_calls = captured_calls == t.calls;
+
+                fprintf(out, "Result:   captured %s, replayed %s%s\n", result, replayed,
+                        same_result ? "" : "  MISMATCH");
+                fprintf(out, "Syscalls: captured %lu, replayed %lu%s\n", captured_calls, t.calls,
+                        same_calls ? "" : "  MISMATCH");
+                if (manifest_value(manifest, "access_us", access_us, sizeof(access_us)))
+                    fprintf(out, "Access:   captured %s us, replayed %lu us\n", access_us, t.access_us);
+
+                /* name the first access that went differently */
+                const char *pa = manifest, *pb = log;
+                for (unsigned long n = 1; ; n++) {
+                    char a[PATH_MAX + 32] = "(none)", b[PATH_MAX + 32] = "(none)";
+                    bool in_a = next_access(&pa, a, sizeof(a));
+                    bool in_b = next_access(&pb, b, sizeof(b));
+                    if (!in_a && !in_b)
+                        break;
+                    if (strcmp(a, b) != 0) {
+                        fprintf(out, "First difference at access %lu:\n  captured %s\n  replayed %s\n", n, a, b);
+                        break;
+                    }
+                }
+                if (!same_result || !same_calls)
+                    err = E_MISMATCH;
+            }
+        }
+    }
+    /* the tmpfs went away with the child's mount namespace */
+    rmdir(root);
+    free(manifest);
+    free(log);
+    return err;
+}
+
+#else /* CAPTURE_UNSUPPORTED */
+
+int capture_write(const char *tar_path, FILE *out)
+{
+    fprintf(stderr, "--capture is not supported on this architecture\n");
+    return E_INVALID;
+}
+
+int capture_replay(const char *tar_path, FILE *out)
+{
+    fprintf(stderr, "--replay is not supported on this architecture\n");
+    return E_INVALID;
+}
+
+#endif
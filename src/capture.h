@@ -0,0 +1,42 @@
+/**
+ * Board fixture capture and offline replay of platform detection
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+/* Archive member with the detection result and the access log */
+#define CAPTURE_MANIFEST "bootcount-capture.txt"
+
+/* Larger files are truncated in the archive */
+#define CAPTURE_MAX_FILE 65536
+
+/*
+ * Run detection under ptrace and write everything it looked at under
+ * /proc, /sys and /dev, with the access log, to the tar archive tar_path.
+ * Prints a summary to out.  Returns 0, E_INVALID or E_DEVICE.
+ */
+int capture_write(const char *tar_path, FILE *out);
+
+/*
+ * Re-run detection chrooted into an extracted capture and compare the
+ * result and the number of file syscalls with the recorded ones.
+ * Returns 0 if both match, E_MISMATCH if not, or E_INVALID / E_DEVICE.
+ */
+int capture_replay(const char *tar_path, FILE *out);
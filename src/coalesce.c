@@ -0,0 +1,142 @@
+/**
+ * Write coalescing for the resident service
+ *
+ * An EEPROM write is an I2C transfer plus a ~5 ms internal cycle, and each
+ * one wears the part.  With `--serve --coalesce=<ms>`, set/inc/reset/force/cas
+ * only update a pending value; the first of them starts the window, and
+ * when it closes the latest value is written once.  "flush", SIGTERM/SIGINT
+ * and EOF write it immediately, so U-Boot sees the last value across a
+ * clean reboot.  A failed write keeps the value pending for the next window.
+ *
+ * Other processes see the stored value until the flush, and the flush
+ * overwrites whatever they wrote meanwhile (e.g. a health check's -r).  That
+ * is detected by comparing with the value stored when the window opened,
+ * and reported, but the service's value still wins.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "constants.h"
+#include "coalesce.h"
+
+static const struct platform *g_inner = NULL;
+static struct platform g_coalesce;
+static int g_window_ms;
+static uint16_t g_pending;
+static uint16_t g_base;         /* stored when the window opened */
+static bool g_base_valid;
+static struct timespec g_due;
+static struct coalesce_stats g_stats;
+
+static int coalesce_read(uint16_t *val)
+{
+    if (g_stats.pending) {
+        *val = g_pending;
+        return 0;
+    }
+    return g_inner->read_bootcount(val);
+}
+
+static void start_window(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &g_due);
+    g_due.tv_sec += g_window_ms / 1000;
+    g_due.tv_nsec += (g_window_ms % 1000) * 1000000L;
+    if (g_due.tv_nsec >= 1000000000L) {
+        g_due.tv_sec++;
+        g_due.tv_nsec -= 1000000000L;
+    }
+}
+
+static int coalesce_write(uint16_t val)
+{
+    g_stats.requests++;
+    if (!g_stats.pending) {
+        start_window();
+        g_base_valid = g_inner->read_bootcount(&g_base) == 0;
+    }
+    g_stats.pending++;
+    DEBUG_PRINTF("Coalescing write of %u\n", val);
+    g_pending = val;
+    return 0;
+}
+
+const struct platform *coalesce_wrap(const struct platform *inner, int window_ms)
+{
+    g_inner = inner;
+    g_window_ms = window_ms;
+    g_coalesce = *inner;
+    g_coalesce.read_bootcount = coalesce_read;
+    g_coalesce.write_bootcount = coalesce_write;
+    return &g_coalesce;
+}
+
+const struct platform *coalesce_inner(const struct platform *plat)
+{
+    return g_inner && plat == &g_coalesce ? g_inner : NULL;
+}
+
+int coalesce_due_ms(void)
+{
+    struct timespec now;
+
+    if (!g_stats.pending)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (g_due.tv_sec - now.tv_sec) * 1000L + (g_due.tv_nsec - now.tv_nsec) / 1000000L;
+    return ms > 0 ? (int)ms : 0;
+}
+
+int coalesce_flush(void)
+{
+    uint16_t cur;
+
+    if (!g_stats.pending)
+        return 0;
+
+    if (g_base_valid && g_inner->read_bootcount(&cur) == 0 && cur != g_base) {
+        g_stats.overwritten++;
+        fprintf(stderr, "Warning: %s changed from %u to %u during the coalescing window, "
+                "writing %u over it\n", g_inner->name, g_base, cur, g_pending);
+        g_base = cur;
+    }
+    int err = g_inner->write_bootcount(g_pending);
+    if (err != 0) {
+        /* a NAK or EBUSY may pass; keep the value U-Boot should see for the next window */
+        g_stats.failed++;
+        fprintf(stderr, "Coalesced write of %u to %s failed (Error %d), retrying in %d ms\n",
+                g_pending, g_inner->name, err, g_window_ms);
+        start_window();
+        return err;
+    }
+    g_stats.avoided += g_stats.pending - 1;
+    g_stats.pending = 0;
+    g_stats.writes++;
+    DEBUG_PRINTF("Flushed %u, %lu of %lu writes avoided\n", g_pending,
+                 g_stats.avoided, g_stats.requests);
+    return 0;
+}
+
+const struct coalesce_stats *coalesce_stats(void)
+{
+    return &g_stats;
+}
@@ -0,0 +1,54 @@
+/**
+ * Write coalescing for the resident service
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "platform.h"
+
+struct coalesce_stats {
+    unsigned long requests;     /* writes asked for: set/inc/reset/force/cas */
+    unsigned long writes;       /* flushes that reached the backend */
+    unsigned long failed;       /* flushes the backend rejected, to be retried */
+    unsigned long overwritten;  /* flushes over a value another process wrote */
+    unsigned long avoided;      /* flushed requests merged into another one's write */
+    unsigned long pending;      /* requests waiting for the next flush */
+};
+
+/*
+ * Return a platform that keeps writes to `inner` in memory and only writes
+ * the latest value once `window_ms` has passed since the first pending one,
+ * or on coalesce_flush().  Reads return the pending value, if any.
+ */
+const struct platform *coalesce_wrap(const struct platform *inner, int window_ms);
+
+/* The backend behind the coalescing platform, or NULL without one */
+const struct platform *coalesce_inner(const struct platform *plat);
+
+/* Milliseconds until the pending value is due, 0 if overdue, -1 if none */
+int coalesce_due_ms(void);
+
+/*
+ * Write the pending value now.  The caller holds the bootcount lock.  If the
+ * write fails, the value stays pending and is due again a window later.
+ */
+int coalesce_flush(void);
+
+const struct coalesce_stats *coalesce_stats(void);
@@ -15,7 +15,10 @@
 #define E_DEVICE -2
 #define E_PLATFORM_UNKNOWN -3
 #define E_WRITE_FAILED -4
+#define E_MISMATCH -5         // value differs from the expected one
+#define E_INVALID -6          // malformed command or argument
+#define E_CHECK_FAILED -7     // a --commit-after health check failed
 
-#define DEBUG_PRINTF(...) if (debug) { fprintf( stderr, "DEBUG: " __VA_ARGS__ ); }
+#define DEBUG_PRINTF(...) if (bootcount_debug) { fprintf( stderr, "DEBUG: " __VA_ARGS__ ); }
 
-extern bool debug;
+extern bool bootcount_debug;
@@ -0,0 +1,216 @@
+/**
+ * Named counters next to the U-Boot cell: layout discovery and CLI
+ *
+ * The layout is described on the DT bootcount node, e.g.
+ *
+ *    bootcount {
+ *        compatible = "u-boot,bootcount-i2c-eeprom";
+ *        i2c-eeprom = <&eeprom0>;
+ *        offset = <0x30>;
+ *        linux,counter-names = "slot_a", "slot_b", "app_crashes";
+ *        linux,counter-widths = <1 1 2>;
+ *    };
+ *
+ * or, overriding it, with BOOTCOUNT_COUNTERS="slot_a:1,slot_b:1,app_crashes:2".
+ * The counters then occupy bytes 0x32-0x35 of the EEPROM.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "counter_layout.h"
+#include "dm_eeprom.h"
+#include "dt.h"
+#include "trace.h"
+
+/* Build "name:width,..." from the DT string list and u32 array */
+static int layout_from_dt(const char *node, char *out, size_t outlen)
+{
+    char names[BOOTCOUNT_COUNTERS_MAX * BOOTCOUNT_COUNTER_NAME_LEN];
+    uint8_t widths[BOOTCOUNT_COUNTERS_MAX * 4];
+    char path[PATH_MAX];
+    size_t pos = 0, nw;
+
+    int len = dt_node_read_str(node, "linux,counter-names", names, sizeof(names));
+    if (len <= 0)
+        return E_INVALID;
+    snprintf(path, sizeof(path), "%s/linux,counter-widths", node);
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return E_INVALID;
+    nw = fread(widths, 4, BOOTCOUNT_COUNTERS_MAX, f);
+    fclose(f);
+
+    out[0] = '\0';
+    const char *name = names;
+    for (size_t i = 0; name < names + len; i++, name += strlen(name) + 1) {
+        if (i >= nw)
+            return E_INVALID;
+        /* big-endian cells */
+        unsigned width = widths[i * 4 + 3];
+        int n = snprintf(out + pos, outlen - pos, "%s%s:%u", pos ? "," : "", name, width);
+        if (n < 0 || (size_t)n >= outlen - pos)
+            return E_INVALID;
+        pos += (size_t)n;
+    }
+    return 0;
+}
+
+int counters_open_platform(const struct platform *plat, struct bootcount_counters *h)
+{
+    const char *path, *node;
+    off_t offset;
+    char dt_layout[BOOTCOUNT_COUNTERS_MAX * (BOOTCOUNT_COUNTER_NAME_LEN + 3)];
+    const char *layout = getenv(COUNTERS_ENV);
+
+    if (!plat->nvmem_cell || !plat->nvmem_cell(&path, &offset, &node)) {
+        fprintf(stderr, "Named counters need an nvmem/EEPROM backend, not %s\n", plat->name);
+        return E_INVALID;
+    }
+    if (!layout || !*layout) {
+        if (!node || layout_from_dt(node, dt_layout, sizeof(dt_layout)) != 0) {
+            fprintf(stderr, "No counter layout: set " COUNTERS_ENV " or linux,counter-names\n");
+            return E_INVALID;
+        }
+        layout = dt_layout;
+    }
+    DEBUG_PRINTF("Counters at %s@0x%lx: %s\n", path, (unsigned long)offset, layout);
+
+    int err = bootcount_counters_open(h, path, offset, layout);
+    if (err == E_INVALID)
+        fprintf(stderr, "Invalid counter layout '%s'\n", layout);
+    else if (err == E_DEVICE)
+        trace_event(TRACE_OPEN, path, (uint32_t)offset, 0, E_DEVICE);
+    return err;
+}
+
+/* Apply "name=val,name+,..." to h and set *mask to the counters touched */
+static int apply_updates(struct bootcount_counters *h, const char *updates, uint32_t *mask)
+{
+    char buf[256], *save;
+
+    *mask = 0;
+    if (!updates)
+        return 0;
+    if (strlen(updates) >= sizeof(buf))
+        return E_INVALID;
+    strcpy(buf, updates);
+
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        size_t len = strlen(tok);
+        bool inc = !eq && len > 1 && tok[len - 1] == '+';
+
+        if (eq)
+            *eq = '\0';
+        else if (inc)
+            tok[len - 1] = '\0';
+        else {
+            fprintf(stderr, "Invalid counter update '%s', expected name=<val> or name+\n", tok);
+            return E_INVALID;
+        }
+
+        int i = bootcount_counters_find(h, tok);
+        if (i < 0) {
+            fprintf(stderr, "Unknown counter '%s'\n", tok);
+            return E_INVALID;
+        }
+        struct bootcount_counter *c = &h->c[i];
+        uint32_t max = bootcount_counter_max(c);
+        if (inc) {
+            if (c->value < max)
+                c->value++;
+        } else {
+            char *end;
+            unsigned long long v = strtoull(eq + 1, &end, 10);
+            if (eq[1] == '\0' || *end != '\0' || v > max) {
+                fprintf(stderr, "Value for '%s' must be 0 to %lu\n", tok, (unsigned long)max);
+                return E_INVALID;
+            }
+            c->value = (uint32_t)v;
+        }
+        *mask |= UINT32_C(1) << i;
+    }
+    return 0;
+}
+
+int counters_run(const struct platform *plat, const char *updates, bool json, FILE *out)
+{
+    struct bootcount_counters h;
+    uint32_t mask = 0, before[BOOTCOUNT_COUNTERS_MAX];
+    const char *path, *node;
+    off_t offset;
+    int err;
+
+    err = counters_open_platform(plat, &h);
+    if (err != 0)
+        return err;
+    plat->nvmem_cell(&path, &offset, &node);
+
+    err = bootcount_counters_read(&h);
+    trace_event(TRACE_READ, path, (uint32_t)offset, h.raw[1] << 8 | h.raw[0], err);
+    if (err == 0) {
+        for (unsigned i = 0; i < h.n; i++)
+            before[i] = h.c[i].value;
+        err = apply_updates(&h, updates, &mask);
+    }
+    /* counters set to the value they already hold cost no write cycle */
+    for (unsigned i = 0; err == 0 && i < h.n; i++) {
+        if ((mask & (UINT32_C(1) << i)) && h.c[i].value == before[i])
+            mask &= ~(UINT32_C(1) << i);
+    }
+    if (err == 0 && mask) {
+        err = bootcount_counters_write(&h, mask);
+        trace_event(TRACE_WRITE, path, (uint32_t)h.wr_offset, (uint32_t)h.wr_len, err);
+        /* the span can reach the whole counter region, longer than one verify */
+        for (size_t done = 0; err == 0 && done < h.wr_len; done += DM_EEPROM_VERIFY_MAX) {
+            size_t len = h.wr_len - done < DM_EEPROM_VERIFY_MAX ? h.wr_len - done : DM_EEPROM_VERIFY_MAX;
+            err = dm_eeprom_verify(h.fd, path, h.wr_offset + (off_t)done,
+                                   h.raw + (h.wr_offset - h.offset) + done, len);
+        }
+        DEBUG_PRINTF("Counters: wrote %zu bytes at 0x%lx\n", h.wr_len, (unsigned long)h.wr_offset);
+    }
+    if (err != 0) {
+        bootcount_counters_close(&h);
+        return err;
+    }
+
+    if (json) {
+        if (h.bootcount < 0)
+            fprintf(out, "{\"bootcount\":null");
+        else
+            fprintf(out, "{\"bootcount\":%d", h.bootcount);
+        for (unsigned i = 0; i < h.n; i++)
+            fprintf(out, ",\"%s\":%lu", h.c[i].name, (unsigned long)h.c[i].value);
+        fprintf(out, "}\n");
+    } else {
+        if (h.bootcount < 0)
+            fprintf(out, "bootcount -\n");
+        else
+            fprintf(out, "bootcount %d\n", h.bootcount);
+        for (unsigned i = 0; i < h.n; i++)
+            fprintf(out, "%s %lu\n", h.c[i].name, (unsigned long)h.c[i].value);
+    }
+    bootcount_counters_close(&h);
+    return 0;
+}
@@ -0,0 +1,44 @@
+/**
+ * Named counters next to the U-Boot cell: layout discovery and CLI
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bootcount_counters.h"
+#include "platform.h"
+
+/* "name:width,..." overriding the device tree layout */
+#define COUNTERS_ENV "BOOTCOUNT_COUNTERS"
+
+/*
+ * Open the counters of plat's nvmem/EEPROM cell.  The layout comes from
+ * $BOOTCOUNT_COUNTERS, else from the linux,counter-names and
+ * linux,counter-widths properties of the DT bootcount node.  Returns
+ * E_INVALID if the backend has no such cell or no layout is described.
+ */
+int counters_open_platform(const struct platform *plat, struct bootcount_counters *h);
+
+/*
+ * Read all counters, apply updates ("name=val" sets, "name+" adds one,
+ * saturating; comma separated, may be NULL), write the changed ones back
+ * and print every counter, one "name value" per line or as one JSON object.
+ */
+int counters_run(const struct platform *plat, const char *updates, bool json, FILE *out);
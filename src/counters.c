@@ -0,0 +1,160 @@
+/**
+ * Named counters packed next to the U-Boot bootcount
+ *
+ * See bootcount_counters.h.  Kept free of the CLI's globals so it can be
+ * linked into applications through libbootcount.a.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "bootcount_counters.h"
+
+#define COUNTERS_CELL_MAGIC 0xbc
+
+static int parse_layout(struct bootcount_counters *h, const char *layout)
+{
+    size_t off = 0;
+    const char *p = layout;
+
+    while (*p) {
+        const char *colon = strchr(p, ':');
+        const char *comma = strchr(p, ',');
+        char *end;
+
+        if (!comma)
+            comma = p + strlen(p);
+        if (!colon || colon > comma || colon == p || h->n == BOOTCOUNT_COUNTERS_MAX)
+            return E_INVALID;
+        if ((size_t)(colon - p) >= BOOTCOUNT_COUNTER_NAME_LEN)
+            return E_INVALID;
+
+        struct bootcount_counter *c = &h->c[h->n];
+        memcpy(c->name, p, (size_t)(colon - p));
+        c->name[colon - p] = '\0';
+        unsigned long width = strtoul(colon + 1, &end, 10);
+        if (end != comma || (width != 1 && width != 2 && width != 4))
+            return E_INVALID;
+        if (bootcount_counters_find(h, c->name) >= 0 || off + width > BOOTCOUNT_COUNTERS_REGION)
+            return E_INVALID;
+        c->width = (uint8_t)width;
+        c->offset = (uint8_t)off;
+        c->value = 0;
+        off += width;
+        h->n++;
+        p = *comma ? comma + 1 : comma;
+    }
+    if (h->n == 0)
+        return E_INVALID;
+    h->len = 2 + off;
+    return 0;
+}
+
+int bootcount_counters_open(struct bootcount_counters *h, const char *path, off_t offset,
+                            const char *layout)
+{
+    memset(h, 0, sizeof(*h));
+    h->fd = -1;
+    h->bootcount = -1;
+    if (path == NULL || layout == NULL || offset < 0)
+        return E_INVALID;
+    int err = parse_layout(h, layout);
+    if (err != 0)
+        return err;
+
+    h->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (h->fd < 0)
+        return E_DEVICE;
+    h->offset = offset;
+    return 0;
+}
+
+int bootcount_counters_find(const struct bootcount_counters *h, const char *name)
+{
+    for (unsigned i = 0; i < h->n; i++) {
+        if (strcmp(h->c[i].name, name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+uint32_t bootcount_counter_max(const struct bootcount_counter *c)
+{
+    return c->width == 4 ? UINT32_MAX : (UINT32_C(1) << (8 * c->width)) - 1;
+}
+
+int bootcount_counters_read(struct bootcount_counters *h)
+{
+    if (h->fd < 0)
+        return E_INVALID;
+    if (pread(h->fd, h->raw, h->len, h->offset) != (ssize_t)h->len)
+        return E_DEVICE;
+
+    h->bootcount = h->raw[1] == COUNTERS_CELL_MAGIC ? h->raw[0] : -1;
+    for (unsigned i = 0; i < h->n; i++) {
+        struct bootcount_counter *c = &h->c[i];
+        const uint8_t *b = h->raw + 2 + c->offset;
+        c->value = 0;
+        for (unsigned k = 0; k < c->width; k++)
+            c->value |= (uint32_t)b[k] << (8 * k);
+    }
+    return 0;
+}
+
+int bootcount_counters_write(struct bootcount_counters *h, uint32_t mask)
+{
+    size_t first = SIZE_MAX, last = 0;
+
+    if (h->fd < 0)
+        return E_INVALID;
+    for (unsigned i = 0; i < h->n; i++) {
+        struct bootcount_counter *c = &h->c[i];
+        if (!(mask & (UINT32_C(1) << i)))
+            continue;
+        uint8_t *b = h->raw + 2 + c->offset;
+        for (unsigned k = 0; k < c->width; k++)
+            b[k] = (uint8_t)(c->value >> (8 * k));
+        if (2u + c->offset < first)
+            first = 2u + c->offset;
+        if (2u + c->offset + c->width > last)
+            last = 2u + c->offset + c->width;
+    }
+    h->wr_len = 0;
+    if (first == SIZE_MAX)
+        return 0;
+
+    h->wr_offset = h->offset + (off_t)first;
+    h->wr_len = last - first;
+    if (pwrite(h->fd, h->raw + first, h->wr_len, h->wr_offset) != (ssize_t)h->wr_len)
+        return E_WRITE_FAILED;
+    return 0;
+}
+
+void bootcount_counters_close(struct bootcount_counters *h)
+{
+    if (h->fd >= 0)
+        close(h->fd);
+    h->fd = -1;
+}
@@ -0,0 +1,161 @@
+/**
+ * Crash counter that can be bumped from a fatal-signal handler
+ *
+ * See bootcount_crash.h.  The increment path is a read, a compare and a
+ * single write of at most 4 bytes: pread()/pwrite() are plain system calls
+ * with no libc state, and memory_read()/memory_write() are volatile loads
+ * and stores.  Concurrent callers are excluded with an atomic exchange on
+ * the handle rather than a lock, so a thread that faults while another is
+ * mid-increment cannot deadlock.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "bootcount_crash.h"
+#include "am33xx.h"
+#include "memory.h"
+
+#define CRASH_FILE_MAGIC 0xbc
+#define CRASH_REG_MAX UINT16_MAX
+#define CRASH_FILE_MAX UINT8_MAX
+
+static void crash_init(struct bootcount_crash *h)
+{
+    h->reg = NULL;
+    h->kick = NULL;
+    h->fd = -1;
+    h->offset = 0;
+    h->busy = 0;
+}
+
+int bootcount_crash_open_reg(struct bootcount_crash *h, off_t phys_addr)
+{
+    crash_init(h);
+    if (phys_addr % sizeof(uint32_t) != 0)
+        return E_INVALID;
+
+    void *mem = memory_open(phys_addr, sizeof(uint32_t));
+    if (mem == (void *)E_DEVICE)
+        return E_DEVICE;
+    /* the AM33xx RTC registers ignore writes until unlocked */
+    volatile uint32_t *kick = am33_rtc_kick_regs(phys_addr);
+    if (kick == (void *)E_DEVICE)
+        return E_DEVICE;
+    h->reg = mem;
+    h->kick = kick;
+
+    /* touch the page now so the handler never takes the first fault */
+    uint16_t val;
+    int err = bootcount_crash_read(h, &val);
+    return err == E_BADMAGIC ? 0 : err;
+}
+
+int bootcount_crash_open_file(struct bootcount_crash *h, const char *path, off_t offset)
+{
+    crash_init(h);
+    if (path == NULL || offset < 0)
+        return E_INVALID;
+
+    h->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (h->fd < 0)
+        return E_DEVICE;
+    h->offset = offset;
+
+    uint16_t val;
+    int err = bootcount_crash_read(h, &val);
+    if (err == E_DEVICE) {
+        bootcount_crash_close(h);
+        return err;
+    }
+    return 0;
+}
+
+int bootcount_crash_read(struct bootcount_crash *h, uint16_t *val)
+{
+    if (h->reg) {
+        uint32_t word = memory_read(h->reg);
+        if ((word & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000))
+            return E_BADMAGIC;
+        *val = (uint16_t)(word & 0xffff);
+        return 0;
+    }
+
+    if (h->fd >= 0) {
+        unsigned char bytes[2];
+        if (pread(h->fd, bytes, sizeof(bytes), h->offset) != (ssize_t)sizeof(bytes))
+            return E_DEVICE;
+        if (bytes[1] != CRASH_FILE_MAGIC)
+            return E_BADMAGIC;
+        *val = bytes[0];
+        return 0;
+    }
+
+    return E_INVALID;
+}
+
+static int crash_write(struct bootcount_crash *h, uint16_t val)
+{
+    if (h->reg) {
+        uint32_t word = (BOOTCOUNT_MAGIC & 0xffff0000) | val;
+        if (h->kick)
+            am33_rtc_unlock(h->kick);
+        memory_write(h->reg, word);
+        return memory_read(h->reg) == word ? 0 : E_WRITE_FAILED;
+    }
+
+    unsigned char bytes[2] = { (unsigned char)val, CRASH_FILE_MAGIC };
+    return pwrite(h->fd, bytes, sizeof(bytes), h->offset) == (ssize_t)sizeof(bytes) ?
+           0 : E_WRITE_FAILED;
+}
+
+int bootcount_crash_increment(struct bootcount_crash *h)
+{
+    int saved_errno = errno;
+    uint16_t val = 0;
+    int err;
+
+    if (__atomic_exchange_n(&h->busy, 1, __ATOMIC_ACQUIRE))
+        return 0;
+
+    err = bootcount_crash_read(h, &val);
+    if (err == E_BADMAGIC) {
+        val = 0;
+        err = 0;
+    }
+    if (err == 0 && val < (h->reg ? CRASH_REG_MAX : CRASH_FILE_MAX))
+        err = crash_write(h, val + 1);
+
+    __atomic_store_n(&h->busy, 0, __ATOMIC_RELEASE);
+    errno = saved_errno;
+    return err;
+}
+
+void bootcount_crash_close(struct bootcount_crash *h)
+{
+    /* the /dev/mem mapping is shared with memory_open() and kept for the process */
+    if (h->fd >= 0)
+        close(h->fd);
+    crash_init(h);
+}
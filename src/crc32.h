@@ -0,0 +1,29 @@
+/**
+ * CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320)
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Same convention as zlib and U-Boot: crc32(0, buf, len) starts a new CRC */
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+
+/* Name of the implementation picked for this CPU, for debug output */
+const char *crc32_impl(void);
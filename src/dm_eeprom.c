@@ -19,21 +19,28 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <dirent.h>
 #include <sys/types.h>
 
 #include "dt.h"
 #include "constants.h"
+#include "dm_eeprom.h"
+#include "trace.h"
 
 #define DM_I2C_MAGIC 0xbc
 #define I2C_SYSFS_DEVICES "/sys/bus/i2c/devices"
@@ -66,6 +73,7 @@
 static bool g_inited = false;
 static char g_eeprom_sysfs_path[PATH_MAX];
 static off_t g_offset = 0;
+static char g_bc_node[PATH_MAX];
 
 static bool discover_dm_eeprom(void)
 {
@@ -143,38 +151,210 @@ static bool discover_dm_eeprom(void)
     if (stat(g_eeprom_sysfs_path, &sb) != 0)
         return false;
 
+    snprintf(g_bc_node, sizeof(g_bc_node), "%s", bc_node);
     g_inited = true;
     return true;
 }
 
-int dm_eeprom_open_path(const char *path, off_t offset)
+/*
+ * Open fds are cached per path, so repeated reads and writes reuse one handle.
+ * The EEPROM, RTC and emulated backends share the cache and may run in
+ * parallel threads (--all), hence the lock.  Once it is full, *uncached is
+ * set and the caller closes the fd after use.
+ */
+#define DM_EEPROM_MAX_FDS 4
+static struct {
+    char path[PATH_MAX];
+    int fd;
+} g_fds[DM_EEPROM_MAX_FDS];
+static int g_nfds = 0;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int dm_eeprom_open_path(const char *path, off_t offset, bool *uncached)
 {
+    *uncached = false;
     if (path == NULL)
         return E_DEVICE;
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < g_nfds; i++) {
+        if (strcmp(g_fds[i].path, path) == 0) {
+            pthread_mutex_unlock(&g_lock);
+            return g_fds[i].fd;
+        }
+    }
     int fd = open(path, O_RDWR);
-    if (fd < 0)
-        return E_DEVICE;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        close(fd);
+    if (fd < 0) {
+        pthread_mutex_unlock(&g_lock);
+        trace_event(TRACE_OPEN, path, offset, 0, E_DEVICE);
         return E_DEVICE;
     }
+    trace_event(TRACE_OPEN, path, offset, 0, 0);
+    if (g_nfds < DM_EEPROM_MAX_FDS && strlen(path) < sizeof(g_fds[0].path)) {
+        strcpy(g_fds[g_nfds].path, path);
+        g_fds[g_nfds].fd = fd;
+        g_nfds++;
+    } else {
+        *uncached = true;
+    }
+    pthread_mutex_unlock(&g_lock);
     return fd;
 }
 
+/*
+ * Write verification
+ *
+ * A write through the at24 or nvmem sysfs file only returns once the driver
+ * has waited out the EEPROM's write cycle, so a single read-back verifies it.
+ *
+ * On the raw i2c-dev path nothing waits: the EEPROM runs its internal write
+ * cycle (typically 1-5 ms) and NAKs its address until the cycle completes;
+ * the kernel reports that as one of the errno values below.  Rather than
+ * sleeping for the worst case we poll the read-back with an adaptive delay:
+ * the first poll waits for the running estimate of this part's write-cycle
+ * time, then backs off exponentially, bounded by VERIFY_TIMEOUT_US overall.
+ */
+#define VERIFY_POLL_MIN_US 100
+#define VERIFY_POLL_MAX_US 2000
+#define VERIFY_TIMEOUT_US 25000       /* same bound as the at24 driver's write timeout */
+#define VERIFY_STATS_ENV "BOOTCOUNT_EEPROM_STATS"
+
+static struct eeprom_write_stats g_stats = { .min_us = ULONG_MAX };
+static unsigned long g_cycle_est_us = 0;
+
+static unsigned long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - start->tv_sec) * 1000000L +
+                           (now.tv_nsec - start->tv_nsec) / 1000L);
+}
+
+static void sleep_us(unsigned long us)
+{
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+static bool is_nak(int err)
+{
+    return err == EIO || err == ENXIO || err == EREMOTEIO || err == ETIMEDOUT ||
+           err == EAGAIN || err == EBUSY;
+}
+
+static void record_cycle(const char *path, off_t offset, unsigned long cycle_us, unsigned polls)
+{
+    pthread_mutex_lock(&g_lock);
+    g_stats.writes++;
+    g_stats.polls += polls;
+    g_stats.total_us += cycle_us;
+    if (cycle_us < g_stats.min_us)
+        g_stats.min_us = cycle_us;
+    if (cycle_us > g_stats.max_us)
+        g_stats.max_us = cycle_us;
+    g_cycle_est_us = g_cycle_est_us ? (3 * g_cycle_est_us + cycle_us) / 4 : cycle_us;
+    pthread_mutex_unlock(&g_lock);
+
+    DEBUG_PRINTF("Write cycle %s@0x%lx: %lu us, %u polls\n",
+                 path, (unsigned long)offset, cycle_us, polls);
+
+    const char *stats_path = getenv(VERIFY_STATS_ENV);
+    if (stats_path && *stats_path) {
+        FILE *f = fopen(stats_path, "a");
+        if (f) {
+            fprintf(f, "%s offset=0x%lx cycle_us=%lu polls=%u\n",
+                    path, (unsigned long)offset, cycle_us, polls);
+            fclose(f);
+        }
+    }
+}
+
+int dm_eeprom_verify(int fd, const char *path, off_t offset, const void *expect, size_t len)
+{
+    unsigned char buf[DM_EEPROM_VERIFY_MAX];
+
+    if (len > sizeof(buf))
+        return E_DEVICE;
+
+    if (pread(fd, buf, len, offset) != (ssize_t)len) {
+        trace_event(TRACE_VERIFY, path, offset, 0, E_WRITE_FAILED);
+        DEBUG_PRINTF("Verify %s@0x%lx: read-back failed\n", path, (unsigned long)offset);
+        return E_WRITE_FAILED;
+    }
+    uint32_t raw = len > 1 ? (uint32_t)(buf[1] << 8 | buf[0]) : buf[0];
+    if (memcmp(buf, expect, len) != 0) {
+        trace_event(TRACE_VERIFY, path, offset, raw, E_WRITE_FAILED);
+        return E_WRITE_FAILED;
+    }
+    trace_event(TRACE_VERIFY, path, offset, raw, 0);
+    return 0;
+}
+
+int eeprom_verify_poll(eeprom_read_fn read_fn, void *ctx, const char *path, off_t offset,
+                       const void *expect, size_t len)
+{
+    unsigned char buf[16];
+    unsigned long delay_us = g_cycle_est_us;
+    unsigned polls = 0;
+    struct timespec start;
+
+    if (len > sizeof(buf))
+        return E_DEVICE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        if (delay_us)
+            sleep_us(delay_us);
+        polls++;
+
+        ssize_t r = read_fn(ctx, buf, len);
+        if (r == (ssize_t)len) {
+            unsigned long cycle_us = elapsed_us(&start);
+            uint32_t raw = len > 1 ? (uint32_t)(buf[1] << 8 | buf[0]) : buf[0];
+            if (memcmp(buf, expect, len) != 0) {
+                trace_event(TRACE_VERIFY, path, offset, raw, E_WRITE_FAILED);
+                return E_WRITE_FAILED;
+            }
+            trace_event(TRACE_VERIFY, path, offset, raw, 0);
+            record_cycle(path, offset, cycle_us, polls);
+            return 0;
+        }
+        if (r >= 0 || !is_nak(errno) || elapsed_us(&start) >= VERIFY_TIMEOUT_US) {
+            trace_event(TRACE_VERIFY, path, offset, polls, E_WRITE_FAILED);
+            DEBUG_PRINTF("Verify %s@0x%lx failed after %u polls\n", path, (unsigned long)offset, polls);
+            return E_WRITE_FAILED;
+        }
+
+        delay_us = delay_us < VERIFY_POLL_MIN_US ? VERIFY_POLL_MIN_US : delay_us * 2;
+        if (delay_us > VERIFY_POLL_MAX_US)
+            delay_us = VERIFY_POLL_MAX_US;
+    }
+}
+
+const struct eeprom_write_stats *dm_eeprom_write_stats(void)
+{
+    return &g_stats;
+}
+
 int dm_eeprom_read_path(const char *path, off_t offset, uint8_t magic, uint16_t *val)
 {
-    int fd = dm_eeprom_open_path(path, offset);
+    bool uncached;
+    int fd = dm_eeprom_open_path(path, offset, &uncached);
     if (fd < 0)
         return fd;
 
     unsigned char bytes[2];
-    if (read(fd, bytes, sizeof(bytes)) != (ssize_t)sizeof(bytes)) {
+    ssize_t r = pread(fd, bytes, sizeof(bytes), offset);
+    if (uncached)
         close(fd);
+    if (r != (ssize_t)sizeof(bytes)) {
+        trace_event(TRACE_READ, path, offset, 0, E_DEVICE);
         return E_DEVICE;
     }
-    close(fd);
+    trace_event(TRACE_READ, path, offset, bytes[1] << 8 | bytes[0], 0);
 
     if (bytes[1] != magic) {
+        trace_event(TRACE_BADMAGIC, path, offset, bytes[1] << 8 | bytes[0], E_BADMAGIC);
         /* Upstream DM driver resets counter to 0 on invalid magic.
            We have a reset command, so do not write on a read operation
          */
@@ -186,19 +366,32 @@ int dm_eeprom_read_path(const char *path, off_t offset, uint8_t magic, uint16_t
 
 int dm_eeprom_write_path(const char *path, off_t offset, uint8_t magic, uint16_t val)
 {
-    int fd = dm_eeprom_open_path(path, offset);
+    /* Only the low byte is stored; skip the write cycle if it is already there */
+    uint16_t cur_val;
+    if (dm_eeprom_read_path(path, offset, magic, &cur_val) == 0 && cur_val == (val & 0xff)) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", cur_val);
+        trace_event(TRACE_SKIP, path, offset, cur_val, 0);
+        return 0;
+    }
+
+    bool uncached;
+    int fd = dm_eeprom_open_path(path, offset, &uncached);
     if (fd < 0)
         return fd;
     unsigned char bytes[2];
     bytes[0] = (unsigned char)(val & 0xff);
     bytes[1] = magic;
-    ssize_t written = write(fd, bytes, sizeof(bytes));
+    int err = E_DEVICE;
+    ssize_t written = pwrite(fd, bytes, sizeof(bytes), offset);
     if (written != (ssize_t)sizeof(bytes)) {
-        close(fd);
-        return E_DEVICE;
+        trace_event(TRACE_WRITE, path, offset, bytes[1] << 8 | bytes[0], E_DEVICE);
+    } else {
+        trace_event(TRACE_WRITE, path, offset, bytes[1] << 8 | bytes[0], 0);
+        err = dm_eeprom_verify(fd, path, offset, bytes, sizeof(bytes));
     }
-    close(fd);
-    return 0;
+    if (uncached)
+        close(fd);
+    return err;
 }
 
 bool dm_eeprom_exists(void)
@@ -206,6 +399,12 @@ bool dm_eeprom_exists(void)
     return discover_dm_eeprom();
 }
 
+bool dm_eeprom_expected(void)
+{
+    char bc_node[PATH_MAX];
+    return dt_get_chosen_bootcount_node("u-boot,bootcount-i2c-eeprom", bc_node, sizeof(bc_node));
+}
+
 int dm_eeprom_read_bootcount(uint16_t *val)
 {
     return dm_eeprom_read_path(g_eeprom_sysfs_path, g_offset, DM_I2C_MAGIC, val);
@@ -216,3 +415,13 @@ int dm_eeprom_write_bootcount(uint16_t val)
     return dm_eeprom_write_path(g_eeprom_sysfs_path, g_offset, DM_I2C_MAGIC, val);
 }
 
+bool dm_eeprom_nvmem_cell(const char **path, off_t *offset, const char **node)
+{
+    if (!dm_eeprom_exists())
+        return false;
+    *path = g_eeprom_sysfs_path;
+    *offset = g_offset;
+    *node = g_bc_node;
+    return true;
+}
+
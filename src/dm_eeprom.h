@@ -1,10 +1,39 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #define DM_EEPROM_NAME "DM I2C EEPROM"
 
 bool dm_eeprom_exists(void);
+bool dm_eeprom_expected(void);
 int dm_eeprom_read_bootcount(uint16_t *val);
 int dm_eeprom_write_bootcount(uint16_t val);
+bool dm_eeprom_nvmem_cell(const char **path, off_t *offset, const char **node);
 
 int dm_eeprom_read_path(const char *path, off_t offset, uint8_t magic, uint16_t *val);
 int dm_eeprom_write_path(const char *path, off_t offset, uint8_t magic, uint16_t val);
+
+/* Observed EEPROM write-cycle times on the raw i2c-dev path, see eeprom_verify_poll() */
+struct eeprom_write_stats {
+    unsigned writes;
+    unsigned polls;
+    unsigned long min_us;
+    unsigned long max_us;
+    unsigned long total_us;
+};
+
+/* Read back `len` (at most DM_EEPROM_VERIFY_MAX) bytes written through a sysfs
+ * file, whose driver has already waited for the write cycle, and compare with
+ * `expect`.  Returns 0 or E_WRITE_FAILED. */
+#define DM_EEPROM_VERIFY_MAX 16
+int dm_eeprom_verify(int fd, const char *path, off_t offset, const void *expect, size_t len);
+
+/* Poll-read `len` bytes until the device ACKs, then compare with `expect`, for
+ * writes that do not wait for the write cycle (raw i2c-dev).
+ * read_fn returns the number of bytes read, or -1 with errno set. */
+typedef ssize_t (*eeprom_read_fn)(void *ctx, void *buf, size_t len);
+int eeprom_verify_poll(eeprom_read_fn read_fn, void *ctx, const char *path, off_t offset,
+                       const void *expect, size_t len);
+const struct eeprom_write_stats *dm_eeprom_write_stats(void);
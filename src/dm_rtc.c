@@ -54,6 +54,7 @@
 static bool g_inited = false;
 static char g_rtc_nvmem_path[128];
 static off_t g_offset = 0;
+static char g_bc_node[PATH_MAX];
 
 static bool discover_dm_rtc(void)
 {
@@ -168,6 +169,7 @@ static bool discover_dm_rtc(void)
     if (!matched)
         return false;
 
+    snprintf(g_bc_node, sizeof(g_bc_node), "%s", bc_node);
     g_inited = true;
     return true;
 }
@@ -177,6 +179,12 @@ bool dm_rtc_exists(void)
     return discover_dm_rtc();
 }
 
+bool dm_rtc_expected(void)
+{
+    char bc_node[PATH_MAX];
+    return dt_get_chosen_bootcount_node("u-boot,bootcount-rtc", bc_node, sizeof(bc_node));
+}
+
 int dm_rtc_read_bootcount(uint16_t *val)
 {
     if (!dm_rtc_exists())
@@ -191,3 +199,12 @@ int dm_rtc_write_bootcount(uint16_t val)
     return dm_eeprom_write_path(g_rtc_nvmem_path, g_offset, RTC_MAGIC, val);
 }
 
+bool dm_rtc_nvmem_cell(const char **path, off_t *offset, const char **node)
+{
+    if (!dm_rtc_exists())
+        return false;
+    *path = g_rtc_nvmem_path;
+    *offset = g_offset;
+    *node = g_bc_node;
+    return true;
+}
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #define DM_RTC_NAME "DM RTC NVMEM"
 
 bool dm_rtc_exists(void);
+bool dm_rtc_expected(void);
 int dm_rtc_read_bootcount(uint16_t *val);
 int dm_rtc_write_bootcount(uint16_t val);
+bool dm_rtc_nvmem_cell(const char **path, off_t *offset, const char **node);
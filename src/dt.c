@@ -25,12 +25,31 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "constants.h"
 #include "dt.h"
 
 #define DT_COMPATIBLE_NODE "/proc/device-tree/compatible"
 
+/* Read up to len bytes of a small sysfs/procfs file, without stdio.  Returns the length, or -1. */
+static ssize_t read_file(const char *path, void *buf, size_t len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    size_t total = 0;
+    while (total < len) {
+        ssize_t r = read(fd, (char *)buf + total, len - total);
+        if (r <= 0)
+            break;
+        total += (size_t)r;
+    }
+    close(fd);
+    return (ssize_t)total;
+}
+
 /**
  * Read /proc/device-tree/compatible to detect hardware platform, which
  * can be used to determine which bootcount strategy to use
@@ -43,13 +62,10 @@ static void read_compatible_node(void)
 {
     if (compat_len != 0)
         return; /* already loaded */
-    FILE *fd = fopen(DT_COMPATIBLE_NODE, "rb");
-    if (!fd)
-        return;
-    compat_len = fread(compat_buf, 1, sizeof(compat_buf) - 1, fd);
-    fclose(fd);
-    if (compat_len == 0)
+    ssize_t r = read_file(DT_COMPATIBLE_NODE, compat_buf, sizeof(compat_buf) - 1);
+    if (r <= 0)
         return; /* leave compat_len == 0 so we may retry later */
+    compat_len = (size_t)r;
     if (compat_len == sizeof(compat_buf) - 1) {
         fprintf(stderr, "Warning: compat string " DT_COMPATIBLE_NODE " truncated to %zu\n", sizeof(compat_buf));
     }
@@ -83,14 +99,8 @@ bool dt_root_available(void)
 
 bool dt_read_u32(const char *path, uint32_t *val)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f)
-        return false;
-
     unsigned char b[4];
-    size_t r = fread(b, 1, 4, f);
-    fclose(f);
-    if (r != 4)
+    if (read_file(path, b, sizeof(b)) != (ssize_t)sizeof(b))
         return false;
 
     *val = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
@@ -189,13 +199,8 @@ int dt_node_read_str(const char *node_dir, const char *prop, char *out, size_t o
     if (n < 0 || n >= (int)sizeof(path))
         return E_DEVICE;
 
-    FILE *f = fopen(path, "rb");
-    if (!f)
-        return E_DEVICE;
-
-    size_t r = fread(out, 1, outlen - 1, f);
-    fclose(f);
-    if (r == 0) {
+    ssize_t r = read_file(path, out, outlen - 1);
+    if (r <= 0) {
         out[0] = 0;
         return E_DEVICE;
     }
@@ -203,6 +208,38 @@ int dt_node_read_str(const char *node_dir, const char *prop, char *out, size_t o
     return (int)r;
 }
 
+static uint64_t read_cells(const unsigned char *b, uint32_t cells)
+{
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < cells * 4; i++)
+        v = v << 8 | b[i];
+    return v;
+}
+
+bool dt_node_read_reg(const char *node_dir, uint64_t *addr, uint64_t *size)
+{
+    char parent[PATH_MAX];
+    char path[PATH_MAX];
+    unsigned char b[16];
+    uint32_t addr_cells = 2, size_cells = 1;   /* devicetree spec defaults */
+
+    if (snprintf(parent, sizeof(parent), "%s", node_dir) >= (int)sizeof(parent) || !strrchr(parent, '/'))
+        return false;
+    *strrchr(parent, '/') = '\0';
+    dt_node_read_u32(parent, "#address-cells", &addr_cells);
+    dt_node_read_u32(parent, "#size-cells", &size_cells);
+    if (addr_cells < 1 || addr_cells > 2 || size_cells < 1 || size_cells > 2)
+        return false;
+
+    size_t len = (addr_cells + size_cells) * 4;
+    if (snprintf(path, sizeof(path), "%s/reg", node_dir) >= (int)sizeof(path) ||
+        read_file(path, b, len) != (ssize_t)len)
+        return false;
+    *addr = read_cells(b, addr_cells);
+    *size = read_cells(b + addr_cells * 4, size_cells);
+    return true;
+}
+
 /* Compare two filesystem objects for identity (same underlying node). */
 bool same_fs_node(const char *a, const char *b)
 {
@@ -220,7 +257,7 @@ bool dt_get_chosen_bootcount_node(const char *compat_str, char* bc_node, size_t
         return false;
 
     char bc_path[128];
-    if (dt_node_read_str(DT_ROOT "/chosen", "u-boot,bootcount-device", bc_path, sizeof(bc_path))) {
+    if (dt_node_read_str(DT_ROOT "/chosen", "u-boot,bootcount-device", bc_path, sizeof(bc_path)) > 0) {
         DEBUG_PRINTF(" Found chosen/u-boot,bootcount-device %s\n", bc_path);
         if (snprintf(bc_node, bc_node_len, DT_ROOT "%s", bc_path) >= (int)bc_node_len) {
             DEBUG_PRINTF(" ERROR Path truncated building device node path for %s\n", bc_path);
@@ -230,7 +267,7 @@ bool dt_get_chosen_bootcount_node(const char *compat_str, char* bc_node, size_t
     }
     else {
       // find the first device with compatible = 'u-boot,bootcount*' and see if it matches our compat_str
-      if (!dt_find_compatible_node("u-boot,bootcount", bc_node, sizeof(bc_node))) {
+      if (!dt_find_compatible_node("u-boot,bootcount", bc_node, bc_node_len)) {
           DEBUG_PRINTF(" No compatible node found for bootcount driver '%s'\n", compat_str);
           return false;
       }
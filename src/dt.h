@@ -44,6 +44,10 @@ bool dt_node_read_u32(const char *node_dir, const char *prop, uint32_t *val);
 
 int dt_node_read_str(const char *node_dir, const char *prop, char *out, size_t outlen);
 
+/* Read the first address/size pair of a node's 'reg', using its parent's #address-cells
+   and #size-cells (1 or 2 each).  Returns true on success. */
+bool dt_node_read_reg(const char *node_dir, uint64_t *addr, uint64_t *size);
+
 /* Compare two filesystem objects for identity (same underlying node). */
 bool same_fs_node(const char *a, const char *b);
 
@@ -0,0 +1,170 @@
+/**
+ * Emulated bootcount backends backed by a regular file
+ *
+ * For development and benchmarks on machines without the hardware, set
+ *
+ *   BOOTCOUNT_EMULATE=reg:<file>      32-bit SoC register: magic in the high
+ *                                     half, 16-bit value in the low half
+ *   BOOTCOUNT_EMULATE=eeprom:<file>   2-byte EEPROM/RTC cell [value, 0xbc],
+ *                                     through the DM EEPROM read/write path
+ *
+ * Both can be given, comma separated ("reg:<file>,eeprom:<file>"), to emulate
+ * a board with two backends for --all.
+ * The file must exist; an empty file reads as a blank (bad magic) device.
+ * Emulation takes precedence over every real platform.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "constants.h"
+#include "dm_eeprom.h"
+#include "emulate.h"
+#include "trace.h"
+
+#define EMULATE_EEPROM_MAGIC 0xbc
+
+/* Parsed once, before any backend runs in a thread of its own */
+static bool g_parsed = false;
+static char g_reg_path[PATH_MAX];
+static char g_eeprom_path[PATH_MAX];
+
+static const char *emulate_path(const char *kind)
+{
+    if (!g_parsed) {
+        const char *env = getenv(EMULATE_ENV);
+
+        g_parsed = true;
+        while (env && *env) {
+            const char *end = strchr(env, ',');
+            size_t len = end ? (size_t)(end - env) : strlen(env);
+            const char *colon = memchr(env, ':', len);
+            size_t plen = colon ? len - (size_t)(colon + 1 - env) : 0;
+            char *dst = NULL;
+
+            if (colon && (size_t)(colon - env) == 3 && strncmp(env, "reg", 3) == 0)
+                dst = g_reg_path;
+            else if (colon && (size_t)(colon - env) == 6 && strncmp(env, "eeprom", 6) == 0)
+                dst = g_eeprom_path;
+            if (dst && plen > 0 && plen < PATH_MAX) {
+                memcpy(dst, colon + 1, plen);
+                dst[plen] = '\0';
+            }
+            env = end ? end + 1 : NULL;
+        }
+    }
+    if (strcmp(kind, "reg") == 0)
+        return g_reg_path[0] ? g_reg_path : NULL;
+    return g_eeprom_path[0] ? g_eeprom_path : NULL;
+}
+
+static int g_reg_fd = -1;
+
+static int reg_open(const char *path)
+{
+    if (g_reg_fd >= 0)
+        return g_reg_fd;
+    g_reg_fd = open(path, O_RDWR);
+    trace_event(TRACE_OPEN, path, 0, 0, g_reg_fd < 0 ? E_DEVICE : 0);
+    return g_reg_fd < 0 ? E_DEVICE : g_reg_fd;
+}
+
+bool emulate_reg_exists(void)
+{
+    return emulate_path("reg") != NULL;
+}
+
+int emulate_reg_read_bootcount(uint16_t *val)
+{
+    const char *path = emulate_path("reg");
+    uint32_t word = 0;
+
+    int fd = reg_open(path);
+    if (fd < 0)
+        return fd;
+    if (pread(fd, &word, sizeof(word), 0) < 0) {
+        trace_event(TRACE_READ, path, 0, 0, E_DEVICE);
+        return E_DEVICE;
+    }
+    trace_event(TRACE_READ, path, 0, word, 0);
+    if ((word & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000)) {
+        trace_event(TRACE_BADMAGIC, path, 0, word, E_BADMAGIC);
+        return E_BADMAGIC;
+    }
+    *val = (uint16_t)(word & 0xffff);
+    return 0;
+}
+
+int emulate_reg_write_bootcount(uint16_t val)
+{
+    const char *path = emulate_path("reg");
+    uint16_t cur_val;
+
+    if (emulate_reg_read_bootcount(&cur_val) == 0 && cur_val == val) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", val);
+        trace_event(TRACE_SKIP, path, 0, cur_val, 0);
+        return 0;
+    }
+
+    int fd = reg_open(path);
+    if (fd < 0)
+        return fd;
+    uint32_t word = (BOOTCOUNT_MAGIC & 0xffff0000) | val;
+    if (pwrite(fd, &word, sizeof(word), 0) != (ssize_t)sizeof(word)) {
+        trace_event(TRACE_WRITE, path, 0, word, E_DEVICE);
+        return E_DEVICE;
+    }
+    trace_event(TRACE_WRITE, path, 0, word, 0);
+
+    if (emulate_reg_read_bootcount(&cur_val) != 0 || cur_val != val) {
+        trace_event(TRACE_VERIFY, path, 0, cur_val, E_WRITE_FAILED);
+        return E_WRITE_FAILED;
+    }
+    return 0;
+}
+
+bool emulate_eeprom_exists(void)
+{
+    return emulate_path("eeprom") != NULL;
+}
+
+int emulate_eeprom_read_bootcount(uint16_t *val)
+{
+    return dm_eeprom_read_path(emulate_path("eeprom"), 0, EMULATE_EEPROM_MAGIC, val);
+}
+
+int emulate_eeprom_write_bootcount(uint16_t val)
+{
+    return dm_eeprom_write_path(emulate_path("eeprom"), 0, EMULATE_EEPROM_MAGIC, val);
+}
+
+bool emulate_eeprom_nvmem_cell(const char **path, off_t *offset, const char **node)
+{
+    *path = emulate_path("eeprom");
+    *offset = 0;
+    *node = NULL;
+    return *path != NULL;
+}
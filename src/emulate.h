@@ -0,0 +1,37 @@
+/**
+ * Emulated bootcount backends backed by a regular file
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define EMULATE_ENV "BOOTCOUNT_EMULATE"
+#define EMULATE_REG_NAME "EMULATED REGISTER"
+#define EMULATE_EEPROM_NAME "EMULATED EEPROM"
+
+bool emulate_reg_exists(void);
+int emulate_reg_read_bootcount(uint16_t *val);
+int emulate_reg_write_bootcount(uint16_t val);
+
+bool emulate_eeprom_exists(void);
+int emulate_eeprom_read_bootcount(uint16_t *val);
+int emulate_eeprom_write_bootcount(uint16_t val);
+bool emulate_eeprom_nvmem_cell(const char **path, off_t *offset, const char **node);
@@ -0,0 +1,601 @@
+/**
+ * Native U-Boot environment reader
+ *
+ * Reads bootlimit and friends without fw_printenv.  The environment is found
+ * through the device tree first: Linux exposes partitions with compatible
+ * "u-boot,env" (or "u-boot,env-redundant-bool"/"-count") as nvmem devices.
+ * That nvmem provider is read-only, so the MTD partition behind it is used
+ * instead when there is one; if not, fw_env.config is preferred, so that the
+ * environment can be saved.  fw_env.config is the one used by fw_printenv:
+ *
+ *   # device      offset    env size  [sector size  [sectors]]
+ *   /dev/mtd1     0x0000    0x10000   0x10000
+ *   /dev/mtd2     0x0000    0x10000   0x10000
+ *
+ * A second line means a redundant environment: each copy then has a flags
+ * byte after the CRC and the valid copy with the newer flags wins, as in
+ * U-Boot.  Each copy is read with one pread() (on NAND, one per erase block,
+ * skipping bad blocks within its sectors as fw_env does) and checked with
+ * crc32().
+ *
+ * env_save() writes the other copy, so the one U-Boot uses stays intact
+ * until the new one is complete, and only the erase blocks whose contents
+ * change are erased and rewritten, whole: bytes of the block past the end of
+ * the environment are read first and written back.  Flags follow the
+ * CONFIG_ENV_REDUNDANT scheme of fw_setenv: a counter bumped on each save,
+ * except on NOR flash and "u-boot,env-redundant-bool" partitions, where the
+ * new copy is marked active (1) and the old one then obsolete (0), which NOR
+ * can do without an erase.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <mtd/mtd-user.h>
+
+#include "constants.h"
+#include "crc32.h"
+#include "dt.h"
+#include "env.h"
+#include "trace.h"
+
+#define ENV_MAX_SIZE (4 * 1024 * 1024)
+/* Write granularity when the device has no erase block (files, nvmem) */
+#define ENV_CHUNK_SIZE 4096
+
+#define ENV_REDUND_OBSOLETE 0
+#define ENV_REDUND_ACTIVE 1
+
+static struct {
+    bool loaded;
+    bool redundant;
+    int ncopies;
+    int active;
+    struct env_location loc[2];
+    uint8_t *raw[2];        /* each copy as it is on the device */
+    bool valid[2];
+    char *data;             /* variables of the active copy, edited by env_set() */
+    size_t size;            /* size of a copy, header included */
+    size_t hdr;             /* 4, or 5 with the redundant flags byte */
+    bool bool_flags;        /* redundant flags are active/obsolete, not a counter */
+    struct {
+        size_t erasesize;   /* flash erase block, 0 if the device needs no erase */
+        bool nor;           /* can clear bits without an erase */
+        bool nand;          /* bad blocks are skipped */
+    } mtd[2];
+} g_env;
+
+/* The MTD character device whose DT node is node, or false */
+static bool env_find_mtd(const char *node, char *dev, size_t len)
+{
+    DIR *dir = opendir(ENV_MTD_CLASS);
+    struct dirent *de;
+    bool found = false;
+
+    if (!dir)
+        return false;
+    while (!found && (de = readdir(dir))) {
+        char link[PATH_MAX];
+        unsigned n;
+        char end;
+
+        /* mtdN, not its mtdNro twin */
+        if (sscanf(de->d_name, "mtd%u%c", &n, &end) != 1)
+            continue;
+        snprintf(link, sizeof(link), ENV_MTD_CLASS "/%s/of_node", de->d_name);
+        if (same_fs_node(link, node))
+            found = snprintf(dev, len, "/dev/%s", de->d_name) < (int)len;
+    }
+    closedir(dir);
+    return found;
+}
+
+static int env_find_nvmem(void)
+{
+    DIR *dir = opendir(ENV_NVMEM_DEVICES);
+    struct dirent *de;
+
+    if (!dir)
+        return 0;
+    while ((de = readdir(dir)) && g_env.ncopies < 2) {
+        char node[PATH_MAX], compat[64];
+        struct stat st;
+
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(node, sizeof(node), ENV_NVMEM_DEVICES "/%s/of_node", de->d_name);
+        if (dt_node_read_str(node, "compatible", compat, sizeof(compat)) <= 0 ||
+            strncmp(compat, "u-boot,env", strlen("u-boot,env")) != 0)
+            continue;
+
+        struct env_location *loc = &g_env.loc[g_env.ncopies];
+        snprintf(loc->path, sizeof(loc->path), ENV_NVMEM_DEVICES "/%s/nvmem", de->d_name);
+        if (stat(loc->path, &st) != 0 || st.st_size <= 5)
+            continue;
+        loc->offset = 0;
+        loc->size = (size_t)st.st_size;
+        loc->sector_size = 0;
+        loc->sectors = 0;
+        loc->read_only = !env_find_mtd(node, loc->path, sizeof(loc->path));
+        if (strstr(compat, "redundant"))
+            g_env.redundant = true;
+        if (strstr(compat, "redundant-bool"))
+            g_env.bool_flags = true;
+        DEBUG_PRINTF("U-Boot env %s (%s), %zu bytes%s\n", loc->path, compat, loc->size,
+                     loc->read_only ? ", read-only" : "");
+        g_env.ncopies++;
+    }
+    closedir(dir);
+    return g_env.ncopies;
+}
+
+static int env_find_config(void)
+{
+    const char *path = getenv(ENV_CONFIG_ENV);
+    char line[PATH_MAX + 64];
+
+    if (!path || !*path)
+        path = ENV_CONFIG_PATH;
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    while (g_env.ncopies < 2 && fgets(line, sizeof(line), f)) {
+        char *save, *dev = strtok_r(line, " \t\r\n", &save);
+        char *off = strtok_r(NULL, " \t\r\n", &save);
+        char *size = strtok_r(NULL, " \t\r\n", &save);
+        char *sector = strtok_r(NULL, " \t\r\n", &save);
+        char *sectors = strtok_r(NULL, " \t\r\n", &save);
+
+        if (!dev || *dev == '#' || !off || !size)
+            continue;
+        struct env_location *loc = &g_env.loc[g_env.ncopies];
+        if (strlen(dev) >= sizeof(loc->path))
+            continue;
+        strcpy(loc->path, dev);
+        loc->offset = (off_t)strtoull(off, NULL, 0);
+        loc->size = (size_t)strtoull(size, NULL, 0);
+        loc->sector_size = sector ? (size_t)strtoull(sector, NULL, 0) : 0;
+        loc->sectors = sector && sectors ? (size_t)strtoull(sectors, NULL, 0) : 0;
+        loc->read_only = false;
+        if (loc->size <= 5 || loc->size > ENV_MAX_SIZE)
+            continue;
+        DEBUG_PRINTF("U-Boot env %s@0x%lx, %zu bytes (from %s)\n", loc->path,
+                     (unsigned long)loc->offset, loc->size, path);
+        g_env.ncopies++;
+    }
+    fclose(f);
+    if (g_env.ncopies == 2)
+        g_env.redundant = true;
+    return g_env.ncopies;
+}
+
+/* Note the erase geometry of copy i's device, if it is flash that needs erasing */
+static void env_mtd_probe(int i, int fd)
+{
+    struct mtd_info_user info;
+
+    memset(&g_env.mtd[i], 0, sizeof(g_env.mtd[i]));
+    if (ioctl(fd, MEMGETINFO, &info) != 0)
+        return;
+    if (info.type != MTD_NORFLASH && info.type != MTD_NANDFLASH && info.type != MTD_MLCNANDFLASH)
+        return;
+    g_env.mtd[i].erasesize = info.erasesize;
+    g_env.mtd[i].nor = info.type == MTD_NORFLASH;
+    g_env.mtd[i].nand = !g_env.mtd[i].nor;
+}
+
+/*
+ * Device offset of the erase block holding byte off of copy i.  On NAND the
+ * copy continues past bad blocks, within the sectors set aside for it (by
+ * default just enough for the copy), as in fw_env.  Returns -1 past them.
+ */
+static off_t env_block(int i, int fd, size_t off)
+{
+    const struct env_location *loc = &g_env.loc[i];
+    size_t es = g_env.mtd[i].erasesize;
+    size_t want = off / es;
+    size_t limit = loc->sectors ? loc->sectors : (g_env.size + es - 1) / es;
+    off_t blk = loc->offset;
+
+    for (size_t n = 0; n < limit; n++, blk += (off_t)es) {
+        if (g_env.mtd[i].nand) {
+            loff_t at = blk;
+            int bad = ioctl(fd, MEMGETBADBLOCK, &at);
+            if (bad < 0)
+                return -1;
+            if (bad > 0) {
+                DEBUG_PRINTF("U-Boot env %s: skipping bad block at 0x%lx\n", loc->path,
+                             (unsigned long)blk);
+                continue;
+            }
+        }
+        if (want == 0)
+            return blk + (off_t)(off % es);
+        want--;
+    }
+    DEBUG_PRINTF("U-Boot env %s: no good block left for 0x%zx\n", loc->path, off);
+    return -1;
+}
+
+/* Read the whole of copy i; on NAND one erase block at a time */
+static bool env_pread_copy(int i, int fd, uint8_t *buf)
+{
+    size_t es = g_env.mtd[i].erasesize;
+
+    if (!g_env.mtd[i].nand || g_env.loc[i].offset % (off_t)es != 0)
+        return pread(fd, buf, g_env.size, g_env.loc[i].offset) == (ssize_t)g_env.size;
+    for (size_t off = 0; off < g_env.size; off += es) {
+        size_t len = g_env.size - off < es ? g_env.size - off : es;
+        off_t at = env_block(i, fd, off);
+        if (at < 0 || pread(fd, buf + off, len, at) != (ssize_t)len)
+            return false;
+    }
+    return true;
+}
+
+/* Read one copy into g_env.raw[i] and check its CRC */
+static void env_read_copy(int i)
+{
+    const struct env_location *loc = &g_env.loc[i];
+    int fd = open(loc->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        trace_event(TRACE_OPEN, loc->path, (uint32_t)loc->offset, 0, E_DEVICE);
+        return;
+    }
+    env_mtd_probe(i, fd);
+    uint8_t *buf = malloc(g_env.size);
+    bool ok = buf && env_pread_copy(i, fd, buf);
+    close(fd);
+    if (!ok) {
+        trace_event(TRACE_READ, loc->path, (uint32_t)loc->offset, 0, E_DEVICE);
+        free(buf);
+        return;
+    }
+    g_env.raw[i] = buf;
+
+    uint32_t stored;
+    memcpy(&stored, buf, sizeof(stored));
+    uint32_t crc = crc32(0, buf + g_env.hdr, g_env.size - g_env.hdr);
+    trace_event(TRACE_READ, loc->path, (uint32_t)loc->offset, stored, 0);
+    if (stored != crc) {
+        trace_event(TRACE_BADMAGIC, loc->path, (uint32_t)loc->offset, crc, E_BADMAGIC);
+        DEBUG_PRINTF("U-Boot env %s: bad CRC 0x%08lx, expected 0x%08lx\n", loc->path,
+                     (unsigned long)stored, (unsigned long)crc);
+        return;
+    }
+    g_env.valid[i] = true;
+}
+
+/* U-Boot's rule: the flags counter increments on each save and wraps */
+static int env_newer(uint8_t a, uint8_t b)
+{
+    if (g_env.bool_flags) {
+        /* active wins over obsolete; an unwritten (erased) flag too */
+        if ((a == ENV_REDUND_OBSOLETE && b == ENV_REDUND_ACTIVE) ||
+            (a == ENV_REDUND_OBSOLETE && b == 0xff))
+            return 1;
+        return 0;
+    }
+    if (a == 0xff && b == 0)
+        return 1;
+    if (b == 0xff && a == 0)
+        return 0;
+    return a >= b ? 0 : 1;
+}
+
+/* True if some copy was found only as a read-only nvmem device */
+static bool env_read_only(void)
+{
+    for (int i = 0; i < g_env.ncopies; i++) {
+        if (g_env.loc[i].read_only)
+            return true;
+    }
+    return false;
+}
+
+int env_load(void)
+{
+    struct timespec t0, t1;
+
+    if (g_env.loaded)
+        return 0;
+    if (env_find_nvmem() > 0 && env_read_only()) {
+        /* the nvmem alone cannot be saved; fw_env.config names a writable device */
+        struct env_location nvmem[2];
+        int n = g_env.ncopies;
+        bool redundant = g_env.redundant, bool_flags = g_env.bool_flags;
+
+        memcpy(nvmem, g_env.loc, sizeof(nvmem));
+        g_env.ncopies = 0;
+        g_env.redundant = g_env.bool_flags = false;
+        if (env_find_config() == 0) {
+            memcpy(g_env.loc, nvmem, sizeof(nvmem));
+            g_env.ncopies = n;
+            g_env.redundant = redundant;
+            g_env.bool_flags = bool_flags;
+        }
+    }
+    if (g_env.ncopies == 0 && env_find_config() == 0) {
+        DEBUG_PRINTF("No U-Boot environment in DT or " ENV_CONFIG_PATH "\n");
+        return E_DEVICE;
+    }
+    if (g_env.redundant && (g_env.ncopies != 2 || g_env.loc[0].size != g_env.loc[1].size)) {
+        DEBUG_PRINTF("Redundant U-Boot env needs two copies of the same size\n");
+        return E_DEVICE;
+    }
+
+    g_env.size = g_env.loc[0].size;
+    g_env.hdr = g_env.redundant ? 5 : 4;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < g_env.ncopies; i++)
+        env_read_copy(i);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    /* fw_env: NOR flash uses the active/obsolete flags */
+    if (g_env.mtd[0].nor)
+        g_env.bool_flags = true;
+    DEBUG_PRINTF("U-Boot env read and checked in %ld us (crc32: %s)\n",
+                 (long)((t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_nsec - t0.tv_nsec) / 1000),
+                 crc32_impl());
+
+    if (g_env.valid[0] && g_env.valid[1])
+        g_env.active = env_newer(g_env.raw[0][4], g_env.raw[1][4]);
+    else
+        g_env.active = g_env.valid[0] ? 0 : 1;
+    if (!g_env.valid[g_env.active])
+        return E_BADMAGIC;
+
+    g_env.data = malloc(g_env.size - g_env.hdr);
+    if (!g_env.data)
+        return E_DEVICE;
+    memcpy(g_env.data, g_env.raw[g_env.active] + g_env.hdr, g_env.size - g_env.hdr);
+    /* the variables must be NUL terminated even if the copy is full */
+    g_env.data[g_env.size - g_env.hdr - 1] = '\0';
+    g_env.loaded = true;
+    DEBUG_PRINTF("Using U-Boot env copy %d (flags %u)\n", g_env.active,
+                 g_env.redundant ? g_env.raw[g_env.active][4] : 0);
+    return 0;
+}
+
+/* Start of "name=value" in the data area, or NULL */
+static char *env_find(const char *name)
+{
+    size_t len = strlen(name);
+    /* "name=value\0name=value\0...\0\0" */
+    char *p = g_env.data;
+    char *end = g_env.data + g_env.size - g_env.hdr;
+
+    while (p < end && *p) {
+        if (strncmp(p, name, len) == 0 && p[len] == '=')
+            return p;
+        p += strlen(p) + 1;
+    }
+    return NULL;
+}
+
+const char *env_get(const char *name)
+{
+    if (!g_env.loaded)
+        return NULL;
+    char *p = env_find(name);
+    return p ? p + strlen(name) + 1 : NULL;
+}
+
+int env_set(const char *name, const char *value)
+{
+    size_t avail = g_env.size - g_env.hdr;
+
+    if (!g_env.loaded)
+        return E_DEVICE;
+    if (!*name || strchr(name, '='))
+        return E_INVALID;
+
+    char *end = g_env.data;
+    while (*end)
+        end += strlen(end) + 1;
+    char *p = env_find(name);
+    size_t old_len = p ? strlen(p) + 1 : 0;
+    size_t need = strlen(name) + 1 + strlen(value) + 1;
+    /* check the fit first, so a value that is too long leaves the old one in place */
+    if ((size_t)(end - g_env.data) - old_len + need + 1 > avail)
+        return E_INVALID;
+
+    /* drop the old definition, shifting the rest down */
+    if (p) {
+        memmove(p, p + old_len, (size_t)(g_env.data + avail - (p + old_len)));
+        memset(g_env.data + avail - old_len, 0, old_len);
+        end -= old_len;
+    }
+
+    /* and append the new one before the terminating empty string */
+    sprintf(end, "%s=%s", name, value);
+    end[need] = '\0';
+    return 0;
+}
+
+/*
+ * Rewrite the sectors of copy i that differ from img.  An erased block is
+ * written whole, with what follows the end of the environment read back
+ * from the device first.
+ */
+static int env_write_copy(int i, int fd, const uint8_t *img, size_t sector, bool erase,
+                          struct env_write_stats *st)
+{
+    const struct env_location *loc = &g_env.loc[i];
+    const uint8_t *old = g_env.raw[i];
+    uint8_t *block = NULL;
+    int err = 0;
+
+    for (size_t off = 0; off < g_env.size && err == 0; off += sector) {
+        size_t len = g_env.size - off < sector ? g_env.size - off : sector;
+        const uint8_t *src = img + off;
+        off_t at = loc->offset + (off_t)off;
+
+        st->sectors_total++;
+        if (old && memcmp(old + off, img + off, len) == 0)
+            continue;
+        if (erase) {
+            at = env_block(i, fd, off);
+            if (at < 0) {
+                err = E_WRITE_FAILED;
+                break;
+            }
+            if (len < sector) {
+                if (!block && !(block = malloc(sector))) {
+                    err = E_DEVICE;
+                    break;
+                }
+                if (pread(fd, block, sector, at) != (ssize_t)sector) {
+                    trace_event(TRACE_READ, loc->path, (uint32_t)at, 0, E_DEVICE);
+                    err = E_DEVICE;
+                    break;
+                }
+                memcpy(block, src, len);
+                src = block;
+                len = sector;
+            }
+            struct erase_info_user ei = { .start = (uint32_t)at, .length = (uint32_t)sector };
+            if (ioctl(fd, MEMERASE, &ei) != 0) {
+                trace_event(TRACE_WRITE, loc->path, ei.start, 0, E_WRITE_FAILED);
+                err = E_WRITE_FAILED;
+                break;
+            }
+        }
+        if (pwrite(fd, src, len, at) != (ssize_t)len) {
+            trace_event(TRACE_WRITE, loc->path, (uint32_t)at, 0, E_WRITE_FAILED);
+            err = E_WRITE_FAILED;
+            break;
+        }
+        trace_event(TRACE_WRITE, loc->path, (uint32_t)at, (uint32_t)len, 0);
+        st->bytes += len;
+        st->sectors++;
+    }
+    free(block);
+    if (err == 0 && fsync(fd) != 0)
+        err = E_WRITE_FAILED;
+    return err;
+}
+
+/* Mark the old copy i obsolete: in place, except on NAND, which needs an erase */
+static int env_retire_copy(int i, struct env_write_stats *st)
+{
+    const struct env_location *loc = &g_env.loc[i];
+    uint8_t obsolete = ENV_REDUND_OBSOLETE;
+    int err = 0;
+    int fd = open(loc->path, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0)
+        return E_WRITE_FAILED;
+    env_mtd_probe(i, fd);
+    if (g_env.mtd[i].nand) {
+        struct env_write_stats retire = { 0 };
+        uint8_t *img = malloc(g_env.size);
+
+        if (!img) {
+            close(fd);
+            return E_DEVICE;
+        }
+        memcpy(img, g_env.raw[i], g_env.size);
+        img[4] = obsolete;
+        err = env_write_copy(i, fd, img, g_env.mtd[i].erasesize, true, &retire);
+        free(img);
+        st->bytes += retire.bytes;
+    } else if (pwrite(fd, &obsolete, 1, loc->offset + 4) != 1 || fsync(fd) != 0) {
+        err = E_WRITE_FAILED;
+    } else {
+        st->bytes += 1;
+    }
+    close(fd);
+    if (err == 0)
+        g_env.raw[i][4] = obsolete;
+    return err;
+}
+
+int env_save(struct env_write_stats *st)
+{
+    int target = g_env.redundant ? !g_env.active : g_env.active;
+    const struct env_location *loc = &g_env.loc[target];
+    int err;
+
+    memset(st, 0, sizeof(*st));
+    if (!g_env.loaded)
+        return E_DEVICE;
+    if (loc->read_only) {
+        DEBUG_PRINTF("U-Boot env %s is read-only and has no MTD device; list it in "
+                     ENV_CONFIG_PATH "\n", loc->path);
+        return E_DEVICE;
+    }
+
+    int fd = open(loc->path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        trace_event(TRACE_OPEN, loc->path, (uint32_t)loc->offset, 0, E_DEVICE);
+        return E_DEVICE;
+    }
+    env_mtd_probe(target, fd);
+    size_t sector = g_env.mtd[target].erasesize;
+    bool erase = sector != 0;
+    if (!erase)
+        sector = loc->sector_size ? loc->sector_size : ENV_CHUNK_SIZE;
+    if (erase && (loc->offset % (off_t)sector != 0)) {
+        DEBUG_PRINTF("U-Boot env %s@0x%lx is not erase block aligned\n", loc->path,
+                     (unsigned long)loc->offset);
+        close(fd);
+        return E_INVALID;
+    }
+
+    uint8_t *img = malloc(g_env.size);
+    if (!img) {
+        close(fd);
+        return E_DEVICE;
+    }
+    memcpy(img + g_env.hdr, g_env.data, g_env.size - g_env.hdr);
+    if (g_env.redundant)
+        img[4] = g_env.bool_flags ? ENV_REDUND_ACTIVE : (uint8_t)(g_env.raw[g_env.active][4] + 1);
+    uint32_t crc = crc32(0, img + g_env.hdr, g_env.size - g_env.hdr);
+    memcpy(img, &crc, sizeof(crc));
+
+    if (!g_env.redundant)
+        DEBUG_PRINTF("Single U-Boot env copy, rewriting it in place\n");
+    err = env_write_copy(target, fd, img, sector, erase, st);
+    close(fd);
+
+    /* the new copy is complete, retire the old one (on NOR by clearing bits only) */
+    if (err == 0 && g_env.redundant && g_env.bool_flags)
+        err = env_retire_copy(g_env.active, st);
+
+    if (err == 0) {
+        free(g_env.raw[target]);
+        g_env.raw[target] = img;
+        g_env.valid[target] = true;
+        g_env.active = target;
+    } else {
+        free(img);
+    }
+    DEBUG_PRINTF("U-Boot env copy %d: %zu bytes in %u of %u sectors written\n", target,
+                 st->bytes, st->sectors, st->sectors_total);
+    return err;
+}
@@ -0,0 +1,71 @@
+/**
+ * Native U-Boot environment reader
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "constants.h"
+
+#define ENV_CONFIG_PATH "/etc/fw_env.config"
+/* Alternative fw_env.config, e.g. for testing against an image file */
+#define ENV_CONFIG_ENV "BOOTCOUNT_FW_ENV_CONFIG"
+#define ENV_NVMEM_DEVICES "/sys/bus/nvmem/devices"
+#define ENV_MTD_CLASS "/sys/class/mtd"
+
+/* Where one copy of the environment lives */
+struct env_location {
+    char path[PATH_MAX];
+    off_t offset;
+    size_t size;            /* whole copy, CRC and flags included */
+    size_t sector_size;     /* flash erase block, 0 if unknown */
+    size_t sectors;         /* erase blocks set aside for the copy on NAND, 0 for just enough */
+    bool read_only;         /* an nvmem device without the MTD partition behind it */
+};
+
+/*
+ * Locate the environment (DT "u-boot,env" nvmem first, through its MTD
+ * partition, or else fw_env.config),
+ * read each copy once and keep the valid, newest one.  Cached; returns 0,
+ * E_DEVICE if no environment was found or E_BADMAGIC if no copy passed its CRC.
+ */
+int env_load(void);
+
+/* Value of a variable, or NULL.  Call env_load() first. */
+const char *env_get(const char *name);
+
+/* Set a variable in memory.  Returns E_INVALID if it does not fit. */
+int env_set(const char *name, const char *value);
+
+/* What env_save() wrote */
+struct env_write_stats {
+    size_t bytes;
+    unsigned sectors;       /* erase blocks (or chunks) rewritten */
+    unsigned sectors_total; /* in one copy */
+};
+
+/*
+ * Write the variables back: to the inactive copy of a redundant environment
+ * (which then becomes the active one), or in place.  Only sectors whose
+ * contents change are erased and written.
+ */
+int env_save(struct env_write_stats *st);
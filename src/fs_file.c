@@ -0,0 +1,806 @@
+/**
+ * Bootcount file on a FAT or ext2/3/4 partition, accessed without mounting
+ * Ref: https://github.com/u-boot/u-boot/blob/master/drivers/bootcount/bootcount_ext.c
+ *
+ * Boards without backup registers or EEPROM keep the counter in a small file
+ * on the boot partition.  Mounting that partition to change two bytes is
+ * slow and leaves a dirty filesystem if power fails, so this backend reads
+ * the partition's own metadata to find where the file's data starts, once,
+ * and from then on reads and rewrites that one sector in place:
+ *
+ *   FAT12/16/32   boot sector, directory entries (8.3 and long names) and the
+ *                 cluster chains of the directories on the path
+ *   ext2/3/4      superblock, group descriptor, inodes, and directory blocks
+ *                 through extent trees or direct block maps; small files
+ *                 and directories stored inline in the inode are handled too
+ *
+ * The file is never allocated or resized; it must already exist with the
+ * U-Boot layout, either
+ *
+ *   [0xbc, count]                          (2 bytes)
+ *   [0xbc, 0x01, count, upgrade_available] (4 bytes or more, bootcount_ext_t)
+ *
+ * As in U-Boot, the count of the second layout only counts while
+ * upgrade_available is set: it reads as 0 otherwise, and is not stored.
+ *
+ * Memory use is one filesystem block at most, whatever the partition size.
+ * Writes are refused while the partition is mounted read-write, since the
+ * mounted filesystem would not see them (and could write back stale data).
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include "constants.h"
+#include "dt.h"
+#include "fs_file.h"
+#include "trace.h"
+
+#define FS_FILE_MAGIC 0xbc
+#define FS_FILE_VERSION 1
+
+/* Unit of the in-place read and write; the counter always starts a sector */
+#define SECTOR_SIZE 512
+/* Largest FAT sector or ext4 block read during the lookup */
+#define MAX_BLOCK_SIZE 65536
+
+#define FAT_ATTR_LFN 0x0f
+#define FAT_ATTR_VOLUME 0x08
+#define FAT_ATTR_DIR 0x10
+
+#define EXT_SUPER_MAGIC 0xef53
+#define EXT_EXTENT_MAGIC 0xf30a
+#define EXT_ROOT_INO 2
+#define EXT_INCOMPAT_META_BG 0x0010
+#define EXT_INCOMPAT_64BIT 0x0080
+#define EXT_RO_COMPAT_METADATA_CSUM 0x0400
+#define EXT_INLINE_DATA_FL 0x10000000
+#define EXT_EXTENTS_FL 0x00080000
+#define EXT_S_IFMT 0xf000
+#define EXT_S_IFDIR 0x4000
+#define EXT_S_IFREG 0x8000
+
+/* Resolved once by discover(): where the file's data starts on the device */
+static bool g_inited = false;
+static char g_dev[PATH_MAX];
+static char g_file[PATH_MAX];
+static int g_fd = -1;
+static off_t g_data_off;        /* byte offset of the file's first byte */
+static uint64_t g_size;         /* file size in bytes */
+static bool g_rw_checked = false;
+static bool g_mounted_rw = false;
+
+static uint8_t g_buf[MAX_BLOCK_SIZE];
+static uint8_t g_sector[SECTOR_SIZE];
+
+static uint16_t le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool read_at(uint64_t off, void *buf, size_t len)
+{
+    if (pread(g_fd, buf, len, (off_t)off) == (ssize_t)len)
+        return true;
+    DEBUG_PRINTF(" Short read of %zu bytes at 0x%llx\n", len, (unsigned long long)off);
+    return false;
+}
+
+/*
+ * Configuration: $BOOTCOUNT_FILE, else /chosen/u-boot,bootcount-file.
+ * The device and path are split at the first ":/", so device names with
+ * colons (/dev/disk/by-path/...) work.
+ */
+static bool parse_config(void)
+{
+    char spec[PATH_MAX];
+    const char *env = getenv(FS_FILE_ENV);
+
+    if (env && *env) {
+        if (strlen(env) >= sizeof(spec))
+            return false;
+        strcpy(spec, env);
+    } else if (dt_node_read_str(DT_ROOT "/chosen", FS_FILE_DT_PROP, spec, sizeof(spec)) <= 0) {
+        return false;
+    }
+
+    char *sep = strstr(spec, ":/");
+    const char *file = FS_FILE_DEFAULT_PATH;
+    if (sep) {
+        *sep = '\0';
+        file = sep + 1;
+    }
+    if (!spec[0] || strlen(spec) >= sizeof(g_dev) || strlen(file) >= sizeof(g_file))
+        return false;
+    strcpy(g_dev, spec);
+    strcpy(g_file, file);
+    return true;
+}
+
+/* Next path component after *pos, copied to out.  Returns false at the end. */
+static bool next_component(const char **pos, char *out, size_t outlen, bool *last)
+{
+    const char *p = *pos;
+    while (*p == '/')
+        p++;
+    if (!*p)
+        return false;
+    size_t len = strcspn(p, "/");
+    if (len >= outlen)
+        return false;
+    memcpy(out, p, len);
+    out[len] = '\0';
+    p += len;
+    *pos = p;
+    while (*p == '/')
+        p++;
+    *last = *p == '\0';
+    return true;
+}
+
+/*
+ * FAT
+ */
+struct fat {
+    uint32_t sector_size;
+    uint32_t cluster_size;      /* bytes */
+    uint64_t fat_off;           /* first FAT */
+    uint64_t root_off;          /* FAT12/16: fixed root directory region */
+    uint32_t root_sectors;
+    uint32_t root_cluster;      /* FAT32 */
+    uint64_t data_off;          /* cluster 2 */
+    uint32_t clusters;
+    int bits;
+};
+
+struct fat_entry {
+    uint32_t cluster;
+    uint32_t size;
+    uint8_t attr;
+};
+
+static bool fat_probe(struct fat *f)
+{
+    const uint8_t *bs = g_buf;
+
+    if (!read_at(0, g_buf, SECTOR_SIZE) || bs[510] != 0x55 || bs[511] != 0xaa)
+        return false;
+
+    uint32_t bps = le16(bs + 11);
+    uint32_t spc = bs[13];
+    uint32_t reserved = le16(bs + 14);
+    uint32_t nfats = bs[16];
+    uint32_t root_entries = le16(bs + 17);
+    uint32_t total = le16(bs + 19) ? le16(bs + 19) : le32(bs + 32);
+    uint32_t fat_sectors = le16(bs + 22) ? le16(bs + 22) : le32(bs + 36);
+
+    if ((bps != 512 && bps != 1024 && bps != 2048 && bps != 4096) ||
+        spc == 0 || (spc & (spc - 1)) || reserved == 0 || nfats == 0 || fat_sectors == 0)
+        return false;
+
+    f->sector_size = bps;
+    f->cluster_size = bps * spc;
+    f->fat_off = (uint64_t)reserved * bps;
+    f->root_off = f->fat_off + (uint64_t)nfats * fat_sectors * bps;
+    f->root_sectors = (root_entries * 32 + bps - 1) / bps;
+    uint64_t first_data = reserved + (uint64_t)nfats * fat_sectors + f->root_sectors;
+    if (first_data >= total)
+        return false;
+    f->data_off = first_data * bps;
+    f->clusters = (uint32_t)((total - first_data) / spc);
+    f->bits = f->clusters < 4085 ? 12 : f->clusters < 65525 ? 16 : 32;
+    f->root_cluster = f->bits == 32 ? le32(bs + 44) : 0;
+
+    DEBUG_PRINTF(" FAT%d: %u clusters of %u bytes\n", f->bits, f->clusters, f->cluster_size);
+    return true;
+}
+
+/* Follow the FAT.  *next is 0 at the end of the chain. */
+static bool fat_next(const struct fat *f, uint32_t cluster, uint32_t *next)
+{
+    uint8_t b[4];
+    uint32_t v, end;
+
+    if (f->bits == 32) {
+        if (!read_at(f->fat_off + (uint64_t)cluster * 4, b, 4))
+            return false;
+        v = le32(b) & 0x0fffffff;
+        end = 0x0ffffff8;
+    } else if (f->bits == 16) {
+        if (!read_at(f->fat_off + (uint64_t)cluster * 2, b, 2))
+            return false;
+        v = le16(b);
+        end = 0xfff8;
+    } else {
+        if (!read_at(f->fat_off + cluster + cluster / 2, b, 2))
+            return false;
+        v = le16(b);
+        v = cluster & 1 ? v >> 4 : v & 0xfff;
+        end = 0xff8;
+    }
+
+    if (v >= end) {
+        *next = 0;
+        return true;
+    }
+    if (v < 2 || v >= f->clusters + 2) {
+        DEBUG_PRINTF(" Bad FAT entry 0x%x for cluster %u\n", v, cluster);
+        return false;
+    }
+    *next = v;
+    return true;
+}
+
+/* Checksum of an 8.3 name, stored in each of its long-name entries */
+static uint8_t fat_lfn_checksum(const uint8_t *name)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++)
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    return sum;
+}
+
+/* "NAME    EXT" -> "NAME.EXT" */
+static void fat_short_name(const uint8_t *e, char *out)
+{
+    int n = 0;
+    for (int i = 0; i < 8 && e[i] != ' '; i++)
+        out[n++] = (char)(i == 0 && e[i] == 0x05 ? 0xe5 : e[i]);
+    if (e[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && e[i] != ' '; i++)
+            out[n++] = (char)e[i];
+    }
+    out[n] = '\0';
+}
+
+/* Long name state carried across the entries (and sectors) of one directory */
+struct fat_lfn {
+    char name[256];
+    uint8_t checksum;
+    bool valid;
+};
+
+static void fat_lfn_add(struct fat_lfn *lfn, const uint8_t *e)
+{
+    static const uint8_t pos[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    int seq = e[0] & 0x1f;
+
+    if (e[0] & 0x40) {
+        memset(lfn->name, 0, sizeof(lfn->name));
+        lfn->checksum = e[13];
+        lfn->valid = true;
+    }
+    if (!lfn->valid || seq < 1 || seq > 20 || e[13] != lfn->checksum) {
+        lfn->valid = false;
+        return;
+    }
+    for (int i = 0; i < 13; i++) {
+        int idx = (seq - 1) * 13 + i;
+        uint16_t c = le16(e + pos[i]);
+        if (idx >= (int)sizeof(lfn->name) - 1)
+            break;
+        /* names are compared as ASCII; anything else cannot match */
+        lfn->name[idx] = (char)(c == 0xffff ? 0 : c < 0x80 ? c : '?');
+    }
+}
+
+/*
+ * Scan one 32-byte entry.  Returns 1 if it is `name`, -1 at the end of the
+ * directory, 0 otherwise.
+ */
+static int fat_match(const uint8_t *e, const char *name, struct fat_lfn *lfn, struct fat_entry *out)
+{
+    char short_name[13];
+
+    if (e[0] == 0x00)
+        return -1;
+    if (e[0] == 0xe5) {
+        lfn->valid = false;
+        return 0;
+    }
+    if (e[11] == FAT_ATTR_LFN) {
+        fat_lfn_add(lfn, e);
+        return 0;
+    }
+
+    bool long_match = lfn->valid && lfn->checksum == fat_lfn_checksum(e) &&
+                      strcasecmp(lfn->name, name) == 0;
+    lfn->valid = false;
+    if (e[11] & FAT_ATTR_VOLUME)
+        return 0;
+    fat_short_name(e, short_name);
+    if (!long_match && strcasecmp(short_name, name) != 0)
+        return 0;
+
+    out->cluster = (uint32_t)le16(e + 20) << 16 | le16(e + 26);
+    out->size = le32(e + 28);
+    out->attr = e[11];
+    return 1;
+}
+
+/* Look up name in the directory starting at cluster (0: the FAT12/16 root) */
+static bool fat_lookup(const struct fat *f, uint32_t cluster, const char *name, struct fat_entry *out)
+{
+    struct fat_lfn lfn = { .valid = false };
+    uint32_t sectors_per_cluster = f->cluster_size / f->sector_size;
+    uint32_t hops = 0;
+
+    for (;;) {
+        uint64_t off;
+        uint32_t nsectors;
+
+        if (cluster == 0) {
+            off = f->root_off;
+            nsectors = f->root_sectors;
+        } else {
+            off = f->data_off + (uint64_t)(cluster - 2) * f->cluster_size;
+            nsectors = sectors_per_cluster;
+        }
+
+        for (uint32_t s = 0; s < nsectors; s++) {
+            if (!read_at(off + (uint64_t)s * f->sector_size, g_buf, f->sector_size))
+                return false;
+            for (uint32_t i = 0; i < f->sector_size; i += 32) {
+                int r = fat_match(g_buf + i, name, &lfn, out);
+                if (r != 0)
+                    return r > 0;
+            }
+        }
+
+        /* the chain of a corrupted filesystem may loop */
+        if (cluster == 0 || ++hops > f->clusters || !fat_next(f, cluster, &cluster) || cluster == 0)
+            return false;
+    }
+}
+
+static bool fat_resolve(void)
+{
+    struct fat f;
+    struct fat_entry entry = { .cluster = 0, .size = 0, .attr = FAT_ATTR_DIR };
+    char name[256];
+    const char *pos = g_file;
+    bool last = false;
+
+    if (!fat_probe(&f))
+        return false;
+
+    uint32_t dir = f.root_cluster;
+    while (next_component(&pos, name, sizeof(name), &last)) {
+        if (!(entry.attr & FAT_ATTR_DIR) || !fat_lookup(&f, dir, name, &entry)) {
+            DEBUG_PRINTF(" %s not found\n", name);
+            return false;
+        }
+        DEBUG_PRINTF(" Found %s: cluster %u, %u bytes\n", name, entry.cluster, entry.size);
+        /* ".." of a top-level directory points at cluster 0, the root */
+        dir = entry.cluster ? entry.cluster : f.root_cluster;
+        if (last)
+            break;
+    }
+    if (!last || (entry.attr & FAT_ATTR_DIR) || entry.cluster < 2 || entry.cluster >= f.clusters + 2)
+        return false;
+
+    g_data_off = (off_t)(f.data_off + (uint64_t)(entry.cluster - 2) * f.cluster_size);
+    g_size = entry.size;
+    return true;
+}
+
+/*
+ * ext2/3/4
+ */
+struct ext {
+    uint32_t block_size;
+    uint32_t inodes_per_group;
+    uint32_t first_data_block;
+    uint32_t inode_size;
+    uint32_t desc_size;
+    bool is_64bit;
+    bool metadata_csum;
+};
+
+struct ext_inode {
+    uint64_t off;               /* of the inode on the device */
+    uint16_t mode;
+    uint32_t flags;
+    uint64_t size;
+    uint8_t block[60];          /* i_block: block map, extent root or inline data */
+};
+
+static bool ext_probe(struct ext *e)
+{
+    const uint8_t *sb = g_buf;
+
+    if (!read_at(1024, g_buf, 1024) || le16(sb + 56) != EXT_SUPER_MAGIC)
+        return false;
+
+    uint32_t log_block = le32(sb + 24);
+    uint32_t incompat = le32(sb + 96);
+    if (log_block > 6 || (incompat & EXT_INCOMPAT_META_BG)) {
+        DEBUG_PRINTF(" Unsupported ext layout (log block size %u, incompat 0x%x)\n", log_block, incompat);
+        return false;
+    }
+
+    e->block_size = 1024u << log_block;
+    e->inodes_per_group = le32(sb + 40);
+    e->first_data_block = le32(sb + 20);
+    e->inode_size = le32(sb + 76) ? le16(sb + 88) : 128;
+    e->is_64bit = incompat & EXT_INCOMPAT_64BIT;
+    e->desc_size = e->is_64bit && le16(sb + 254) ? le16(sb + 254) : 32;
+    e->metadata_csum = le32(sb + 100) & EXT_RO_COMPAT_METADATA_CSUM;
+    if (e->inodes_per_group == 0 || e->inode_size < 128)
+        return false;
+
+    DEBUG_PRINTF(" ext: %u byte blocks, %u byte inodes\n", e->block_size, e->inode_size);
+    return true;
+}
+
+static bool ext_read_inode(const struct ext *e, uint32_t ino, struct ext_inode *inode)
+{
+    uint8_t b[128];
+    uint32_t group = (ino - 1) / e->inodes_per_group;
+    uint32_t index = (ino - 1) % e->inodes_per_group;
+
+    uint64_t desc = (uint64_t)(e->first_data_block + 1) * e->block_size + (uint64_t)group * e->desc_size;
+    if (!read_at(desc, b, e->desc_size >= 64 ? 64 : 32))
+        return false;
+    uint64_t table = le32(b + 8);
+    if (e->is_64bit && e->desc_size >= 64)
+        table |= (uint64_t)le32(b + 0x28) << 32;
+
+    inode->off = table * e->block_size + (uint64_t)index * e->inode_size;
+    if (!read_at(inode->off, b, sizeof(b)))
+        return false;
+    inode->mode = le16(b);
+    inode->size = le32(b + 4) | (uint64_t)le32(b + 108) << 32;
+    inode->flags = le32(b + 32);
+    memcpy(inode->block, b + 40, sizeof(inode->block));
+    return true;
+}
+
+/* Physical block of logical block lblk of an inode.  Uses g_buf for extent tree nodes. */
+static bool ext_bmap(const struct ext *e, const struct ext_inode *inode, uint32_t lblk, uint64_t *pblk)
+{
+    if (!(inode->flags & EXT_EXTENTS_FL)) {
+        /* the direct blocks cover every directory and file this backend needs */
+        if (lblk >= 12)
+            return false;
+        *pblk = le32(inode->block + 4 * lblk);
+        return *pblk != 0;
+    }
+
+    const uint8_t *node = inode->block;
+    for (int level = 0; level < 8; level++) {
+        uint16_t entries = le16(node + 2);
+        uint16_t depth = le16(node + 6);
+        if (le16(node) != EXT_EXTENT_MAGIC)
+            return false;
+
+        if (depth == 0) {
+            for (uint16_t i = 0; i < entries; i++) {
+                const uint8_t *x = node + 12 + 12 * i;
+                uint32_t start = le32(x);
+                uint16_t len = le16(x + 4);
+                /* uninitialized extents read as zeros; there is nothing to update */
+                if (len > 32768 || lblk < start || lblk - start >= len)
+                    continue;
+                *pblk = ((uint64_t)le16(x + 6) << 32 | le32(x + 8)) + (lblk - start);
+                return true;
+            }
+            return false;
+        }
+
+        /* index node: descend into the last child starting at or before lblk */
+        const uint8_t *child = NULL;
+        for (uint16_t i = 0; i < entries; i++) {
+            const uint8_t *x = node + 12 + 12 * i;
+            if (le32(x) > lblk)
+                break;
+            child = x;
+        }
+        if (!child)
+            return false;
+        uint64_t leaf = le32(child + 4) | (uint64_t)le16(child + 8) << 32;
+        if (!read_at(leaf * e->block_size, g_buf, e->block_size))
+            return false;
+        node = g_buf;
+    }
+    return false;
+}
+
+/* Scan directory entries in buf.  Returns 1 if found, 0 if not, -1 if corrupted. */
+static int ext_scan(const uint8_t *buf, uint32_t len, const char *name, uint32_t *ino)
+{
+    size_t name_len = strlen(name);
+
+    for (uint32_t off = 0; off + 8 <= len;) {
+        const uint8_t *d = buf + off;
+        uint16_t rec_len = le16(d + 4);
+        if (rec_len < 8 || off + rec_len > len)
+            return -1;
+        if (le32(d) != 0 && d[6] == name_len && 8 + name_len <= rec_len &&
+            memcmp(d + 8, name, name_len) == 0) {
+            *ino = le32(d);
+            return 1;
+        }
+        off += rec_len;
+    }
+    return 0;
+}
+
+/*
+ * Linear scan of a directory.  Hashed (htree) directories are found too:
+ * their index blocks look like a single empty entry to this scan.
+ */
+static bool ext_lookup(const struct ext *e, const struct ext_inode *dir, const char *name, uint32_t *ino)
+{
+    /* inline directory: the parent's inode number, then the entries; entries
+       that overflow into the system.data attribute are not searched */
+    if (dir->flags & EXT_INLINE_DATA_FL)
+        return ext_scan(dir->block + 4, sizeof(dir->block) - 4, name, ino) > 0;
+
+    uint32_t nblocks = (uint32_t)((dir->size + e->block_size - 1) / e->block_size);
+    for (uint32_t lblk = 0; lblk < nblocks; lblk++) {
+        uint64_t pblk;
+        if (!ext_bmap(e, dir, lblk, &pblk) || !read_at(pblk * e->block_size, g_buf, e->block_size))
+            return false;
+
+        int r = ext_scan(g_buf, e->block_size, name, ino);
+        if (r < 0)
+            DEBUG_PRINTF(" Bad directory entry in block %llu\n", (unsigned long long)pblk);
+        if (r != 0)
+            return r > 0;
+    }
+    return false;
+}
+
+static bool ext_resolve(void)
+{
+    struct ext e;
+    struct ext_inode inode;
+    char name[256];
+    const char *pos = g_file;
+    bool last = false;
+    uint32_t ino = EXT_ROOT_INO;
+
+    if (!ext_probe(&e) || !ext_read_inode(&e, ino, &inode))
+        return false;
+
+    while (next_component(&pos, name, sizeof(name), &last)) {
+        if ((inode.mode & EXT_S_IFMT) != EXT_S_IFDIR || !ext_lookup(&e, &inode, name, &ino) ||
+            !ext_read_inode(&e, ino, &inode)) {
+            DEBUG_PRINTF(" %s not found\n", name);
+            return false;
+        }
+        DEBUG_PRINTF(" Found %s: inode %u, %llu bytes\n", name, ino, (unsigned long long)inode.size);
+        if (last)
+            break;
+    }
+    if (!last || (inode.mode & EXT_S_IFMT) != EXT_S_IFREG)
+        return false;
+
+    g_size = inode.size;
+    if (inode.flags & EXT_INLINE_DATA_FL) {
+        /* rewriting the inode would invalidate its checksum */
+        if (e.metadata_csum) {
+            DEBUG_PRINTF(" Inline data in a metadata_csum filesystem is not supported\n");
+            return false;
+        }
+        g_data_off = (off_t)(inode.off + 40);
+        return true;
+    }
+
+    uint64_t pblk;
+    if (!ext_bmap(&e, &inode, 0, &pblk))
+        return false;
+    g_data_off = (off_t)(pblk * e.block_size);
+    return true;
+}
+
+static bool discover_fs_file(void)
+{
+    if (g_inited)
+        return true;
+    if (!parse_config())
+        return false;
+    DEBUG_PRINTF("Looking for %s on %s\n", g_file, g_dev);
+
+    if (g_fd < 0) {
+        g_fd = open(g_dev, O_RDWR);
+        if (g_fd < 0)
+            g_fd = open(g_dev, O_RDONLY);
+        trace_event(TRACE_OPEN, g_dev, 0, 0, g_fd < 0 ? E_DEVICE : 0);
+        if (g_fd < 0)
+            return false;
+    }
+
+    if (!fat_resolve() && !ext_resolve()) {
+        DEBUG_PRINTF(" No FAT or ext filesystem with %s on %s\n", g_file, g_dev);
+        return false;
+    }
+    if (g_size < 2) {
+        DEBUG_PRINTF(" %s is only %llu bytes\n", g_file, (unsigned long long)g_size);
+        return false;
+    }
+    DEBUG_PRINTF(" Data at 0x%llx, %llu bytes\n", (unsigned long long)g_data_off, (unsigned long long)g_size);
+    g_inited = true;
+    return true;
+}
+
+bool fs_file_exists(void)
+{
+    return discover_fs_file();
+}
+
+/* Configured, but the partition has not appeared yet (e.g. the MMC is still probing) */
+bool fs_file_expected(void)
+{
+    struct stat st;
+    return parse_config() && stat(g_dev, &st) != 0;
+}
+
+/* True if the block device is mounted read-write, per /proc/self/mountinfo */
+static bool mounted_rw(void)
+{
+    struct stat st;
+    char line[512];
+    bool line_start = true;
+
+    if (g_rw_checked)
+        return g_mounted_rw;
+    g_rw_checked = true;
+    if (fstat(g_fd, &st) != 0 || !S_ISBLK(st.st_mode))
+        return false;
+
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f)
+        return false;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned int maj, min;
+        char opts[64];
+        /* only parse the start of each line; options are the 6th field */
+        if (line_start && sscanf(line, "%*s %*s %u:%u %*s %*s %63s", &maj, &min, opts) == 3 &&
+            makedev(maj, min) == st.st_rdev && strncmp(opts, "rw", 2) == 0 &&
+            (opts[2] == ',' || opts[2] == '\0')) {
+            g_mounted_rw = true;
+            break;
+        }
+        line_start = strchr(line, '\n') != NULL;
+    }
+    fclose(f);
+    return g_mounted_rw;
+}
+
+/* Read the sector holding the counter.  Returns the offset of the counter in it. */
+static int read_sector(size_t *rec)
+{
+    off_t sector = g_data_off - g_data_off % SECTOR_SIZE;
+
+    *rec = (size_t)(g_data_off - sector);
+    if (pread(g_fd, g_sector, SECTOR_SIZE, sector) != SECTOR_SIZE) {
+        trace_event(TRACE_READ, g_dev, (uint32_t)g_data_off, 0, E_DEVICE);
+        return E_DEVICE;
+    }
+    return 0;
+}
+
+/* The 4-byte layout is recognized by its version byte; a 2-byte file is always the old one */
+static bool versioned(const uint8_t *rec)
+{
+    return g_size >= 4 && rec[1] == FS_FILE_VERSION;
+}
+
+static int decode(const uint8_t *rec, uint16_t *val)
+{
+    uint32_t raw = le32(rec);
+
+    trace_event(TRACE_READ, g_dev, (uint32_t)g_data_off, raw, 0);
+    if (rec[0] != FS_FILE_MAGIC) {
+        trace_event(TRACE_BADMAGIC, g_dev, (uint32_t)g_data_off, raw, E_BADMAGIC);
+        return E_BADMAGIC;
+    }
+    if (!versioned(rec))
+        *val = rec[1];
+    else
+        *val = rec[3] ? rec[2] : 0;
+    return 0;
+}
+
+int fs_file_read_bootcount(uint16_t *val)
+{
+    size_t rec;
+
+    if (!discover_fs_file())
+        return E_DEVICE;
+    int err = read_sector(&rec);
+    if (err != 0)
+        return err;
+    return decode(g_sector + rec, val);
+}
+
+int fs_file_write_bootcount(uint16_t val)
+{
+    size_t rec;
+    uint16_t cur_val;
+
+    if (!discover_fs_file())
+        return E_DEVICE;
+    int err = read_sector(&rec);
+    if (err != 0)
+        return err;
+
+    uint8_t *r = g_sector + rec;
+    if (decode(r, &cur_val) == 0 && cur_val == (val & 0xff)) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", cur_val);
+        trace_event(TRACE_SKIP, g_dev, (uint32_t)g_data_off, cur_val, 0);
+        return 0;
+    }
+
+    if (mounted_rw()) {
+        fprintf(stderr, "%s is mounted read-write; not writing to it behind the filesystem\n", g_dev);
+        return E_DEVICE;
+    }
+
+    /* keep the layout (and upgrade_available) the file already has; a blank
+       file gets the one its size implies */
+    bool has_version = r[0] == FS_FILE_MAGIC ? versioned(r) : g_size >= 4;
+    if (has_version && r[0] == FS_FILE_MAGIC && r[3] == 0) {
+        fprintf(stderr, "upgrade_available is 0 in %s, so U-Boot ignores the count; not storing %u\n",
+                g_dev, val & 0xff);
+        trace_event(TRACE_SKIP, g_dev, (uint32_t)g_data_off, le32(r), 0);
+        return 0;
+    }
+    r[0] = FS_FILE_MAGIC;
+    if (has_version) {
+        if (r[1] != FS_FILE_VERSION)
+            r[3] = 1;
+        r[1] = FS_FILE_VERSION;
+        r[2] = (uint8_t)(val & 0xff);
+    } else {
+        r[1] = (uint8_t)(val & 0xff);
+    }
+
+    off_t sector = g_data_off - (off_t)rec;
+    if (pwrite(g_fd, g_sector, SECTOR_SIZE, sector) != SECTOR_SIZE || fsync(g_fd) != 0) {
+        trace_event(TRACE_WRITE, g_dev, (uint32_t)g_data_off, le32(r), E_DEVICE);
+        return E_DEVICE;
+    }
+    trace_event(TRACE_WRITE, g_dev, (uint32_t)g_data_off, le32(r), 0);
+
+    if (fs_file_read_bootcount(&cur_val) != 0 || cur_val != (val & 0xff)) {
+        trace_event(TRACE_VERIFY, g_dev, (uint32_t)g_data_off, cur_val, E_WRITE_FAILED);
+        return E_WRITE_FAILED;
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+/**
+ * Bootcount file on a FAT or ext2/3/4 partition, accessed without mounting
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FS_FILE_NAME "BOOTCOUNT FILE"
+
+/* <device>[:<path>], e.g. /dev/mmcblk0p1:/boot/failures */
+#define FS_FILE_ENV "BOOTCOUNT_FILE"
+/* Same syntax as a string property in /chosen, used when the variable is unset */
+#define FS_FILE_DT_PROP "u-boot,bootcount-file"
+/* U-Boot's default CONFIG_SYS_BOOTCOUNT_EXT_NAME */
+#define FS_FILE_DEFAULT_PATH "/boot/failures"
+
+bool fs_file_exists(void);
+bool fs_file_expected(void);
+int fs_file_read_bootcount(uint16_t *val);
+int fs_file_write_bootcount(uint16_t val);
@@ -0,0 +1,307 @@
+/**
+ * Parallel health checks gating the bootcount reset
+ *
+ * bootcount --commit-after <dir> runs every executable file in <dir> at the
+ * same time, like run-parts but concurrently, and only resets the counter if
+ * all of them exit 0.  Each check gets HEALTH_TIMEOUT_SEC, or the number of
+ * seconds in a "<check>.timeout" file next to it.
+ *
+ *   exit 0                    pass
+ *   exit 1                    fail; the other checks keep running so the
+ *                             report is complete
+ *   other exit, signal or     hard failure: the remaining checks are killed
+ *   timeout                   and the result is known at once
+ *
+ * Each check runs in its own process group so that killing it also stops
+ * anything it started.  Its stdout goes to our stderr, keeping stdout for
+ * the result lines.  Children are reaped with sigtimedwait() on SIGCHLD,
+ * waking only for an exit or the next deadline.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "constants.h"
+#include "health.h"
+
+enum check_state {
+    CHECK_RUNNING,
+    CHECK_PASS,
+    CHECK_FAIL,         /* exit 1 */
+    CHECK_HARD,         /* other exit status or signal */
+    CHECK_TIMEOUT,
+    CHECK_ABORTED,      /* killed after another check's hard failure */
+    CHECK_SPAWN_FAILED,
+};
+
+struct check {
+    char path[PATH_MAX];
+    char name[NAME_MAX + 1];
+    pid_t pid;
+    int status;
+    enum check_state state;
+    long timeout_ms;
+    long start_ms, end_ms;
+};
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int by_name(const void *a, const void *b)
+{
+    return strcmp(((const struct check *)a)->name, ((const struct check *)b)->name);
+}
+
+static long check_timeout_ms(const char *check_path)
+{
+    char path[PATH_MAX + 8];
+    long sec = HEALTH_TIMEOUT_SEC;
+
+    snprintf(path, sizeof(path), "%s.timeout", check_path);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        long v;
+        if (fscanf(f, "%ld", &v) == 1 && v > 0)
+            sec = v;
+        fclose(f);
+    }
+    return sec * 1000L;
+}
+
+/* True for a <check>.timeout file, which is never run even if executable */
+static bool is_timeout_file(const char *name)
+{
+    size_t len = strlen(name), suffix = strlen(".timeout");
+    return len > suffix && strcmp(name + len - suffix, ".timeout") == 0;
+}
+
+/*
+ * Executable regular files, sorted by name.  Returns HEALTH_MAX_CHECKS + 1
+ * if there are more than fit, since skipping some would not check them.
+ */
+static int list_checks(const char *dir, struct check *checks)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    int n = 0;
+
+    if (!d)
+        return E_INVALID;
+    while ((de = readdir(d))) {
+        char path[PATH_MAX];
+        struct stat st;
+
+        if (de->d_name[0] == '.' || strlen(de->d_name) > NAME_MAX || is_timeout_file(de->d_name))
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path))
+            continue;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || access(path, X_OK) != 0)
+            continue;
+        if (n == HEALTH_MAX_CHECKS) {
+            closedir(d);
+            return HEALTH_MAX_CHECKS + 1;
+        }
+        memset(&checks[n], 0, sizeof(checks[n]));
+        strcpy(checks[n].path, path);
+        strcpy(checks[n].name, de->d_name);
+        checks[n].timeout_ms = check_timeout_ms(path);
+        n++;
+    }
+    closedir(d);
+    qsort(checks, (size_t)n, sizeof(checks[0]), by_name);
+    return n;
+}
+
+static void spawn(struct check *c, const sigset_t *oldmask)
+{
+    c->start_ms = now_ms();
+    c->pid = fork();
+    if (c->pid == 0) {
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, oldmask, NULL);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        execl(c->path, c->path, (char *)NULL);
+        _exit(127);
+    }
+    if (c->pid < 0) {
+        c->state = CHECK_SPAWN_FAILED;
+        c->end_ms = c->start_ms;
+        return;
+    }
+    /* also from the parent, so a kill before the child runs still hits the group */
+    setpgid(c->pid, c->pid);
+    c->state = CHECK_RUNNING;
+}
+
+static void kill_check(struct check *c, enum check_state state)
+{
+    kill(-c->pid, SIGKILL);
+    kill(c->pid, SIGKILL);
+    waitpid(c->pid, &c->status, 0);
+    c->state = state;
+    c->end_ms = now_ms();
+}
+
+static void print_check(FILE *out, const struct check *c)
+{
+    static const char *labels[] = {
+        [CHECK_RUNNING] = "RUNNING",
+        [CHECK_PASS] = "PASS",
+        [CHECK_FAIL] = "FAIL",
+        [CHECK_HARD] = "FAIL",
+        [CHECK_TIMEOUT] = "TIMEOUT",
+        [CHECK_ABORTED] = "ABORTED",
+        [CHECK_SPAWN_FAILED] = "FAIL",
+    };
+    long ms = c->end_ms - c->start_ms;
+
+    fprintf(out, "%-7s %-24s %4ld.%03lds", labels[c->state], c->name, ms / 1000, ms % 1000);
+    if (c->state == CHECK_FAIL || (c->state == CHECK_HARD && WIFEXITED(c->status)))
+        fprintf(out, " (exit %d)", WEXITSTATUS(c->status));
+    else if (c->state == CHECK_HARD)
+        fprintf(out, " (signal %d)", WTERMSIG(c->status));
+    else if (c->state == CHECK_SPAWN_FAILED)
+        fprintf(out, " (fork failed)");
+    fprintf(out, "\n");
+    fflush(out);
+}
+
+int health_run(const char *dir, FILE *out)
+{
+    static struct check checks[HEALTH_MAX_CHECKS];
+    sigset_t chld, oldmask;
+    int n, running = 0, failed = 0;
+    bool abort_rest = false;
+    long start = now_ms();
+
+    n = list_checks(dir, checks);
+    if (n < 0) {
+        fprintf(stderr, "Cannot read health check directory %s\n", dir);
+        return n;
+    }
+    /* a misconfigured directory must not mark the boot good */
+    if (n > HEALTH_MAX_CHECKS) {
+        fprintf(stderr, "More than %d health checks in %s\n", HEALTH_MAX_CHECKS, dir);
+        return E_INVALID;
+    }
+    if (n == 0) {
+        fprintf(stderr, "No executable health checks in %s\n", dir);
+        return E_INVALID;
+    }
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &oldmask);
+
+    for (int i = 0; i < n; i++) {
+        spawn(&checks[i], &oldmask);
+        if (checks[i].state == CHECK_RUNNING)
+            running++;
+        else {
+            print_check(out, &checks[i]);
+            failed++;
+            abort_rest = true;
+            break;
+        }
+    }
+
+    while (running > 0) {
+        /* reap whatever has exited */
+        for (int i = 0; i < n; i++) {
+            struct check *c = &checks[i];
+            if (c->state != CHECK_RUNNING || c->pid <= 0 || waitpid(c->pid, &c->status, WNOHANG) != c->pid)
+                continue;
+            c->end_ms = now_ms();
+            running--;
+            if (WIFEXITED(c->status) && WEXITSTATUS(c->status) == 0) {
+                c->state = CHECK_PASS;
+            } else if (WIFEXITED(c->status) && WEXITSTATUS(c->status) == 1) {
+                c->state = CHECK_FAIL;
+                failed++;
+            } else {
+                c->state = CHECK_HARD;
+                failed++;
+                abort_rest = true;
+            }
+            print_check(out, c);
+        }
+
+        /* and kill whatever is past its deadline */
+        long now = now_ms(), next = -1;
+        for (int i = 0; i < n; i++) {
+            struct check *c = &checks[i];
+            if (c->state != CHECK_RUNNING || c->pid <= 0)
+                continue;
+            long left = c->start_ms + c->timeout_ms - now;
+            if (abort_rest || left <= 0) {
+                kill_check(c, abort_rest ? CHECK_ABORTED : CHECK_TIMEOUT);
+                running--;
+                failed++;
+                if (c->state == CHECK_TIMEOUT)
+                    abort_rest = true;
+                print_check(out, c);
+                continue;
+            }
+            if (next < 0 || left < next)
+                next = left;
+        }
+        /* a timeout found late in the scan still aborts the checks before it */
+        if (abort_rest && running > 0)
+            continue;
+        if (running == 0)
+            break;
+
+        struct timespec ts = { .tv_sec = next / 1000, .tv_nsec = (next % 1000) * 1000000L };
+        while (sigtimedwait(&chld, NULL, &ts) < 0 && errno == EINTR)
+            ;
+    }
+
+    /* checks never started because spawning failed */
+    for (int i = 0; i < n; i++) {
+        if (checks[i].pid == 0 && checks[i].state == CHECK_RUNNING) {
+            checks[i].state = CHECK_ABORTED;
+            failed++;
+            print_check(out, &checks[i]);
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+
+    long ms = now_ms() - start;
+    if (failed == 0)
+        fprintf(out, "All %d checks passed in %ld.%03lds\n", n, ms / 1000, ms % 1000);
+    else
+        fprintf(out, "%d of %d checks failed in %ld.%03lds%s\n", failed, n, ms / 1000, ms % 1000,
+                abort_rest ? ", aborted" : "");
+    return failed ? E_CHECK_FAILED : 0;
+}
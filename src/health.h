@@ -0,0 +1,34 @@
+/**
+ * Parallel health checks gating the bootcount reset
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+/* Timeout of a check without a <check>.timeout file next to it */
+#define HEALTH_TIMEOUT_SEC 30
+#define HEALTH_MAX_CHECKS 64
+
+/*
+ * Run every executable in dir concurrently and print one result line per
+ * check to out.  Returns 0 if all exited 0, E_CHECK_FAILED otherwise, or
+ * E_INVALID if dir cannot be read, holds no executable checks or more than
+ * HEALTH_MAX_CHECKS.
+ */
+int health_run(const char *dir, FILE *out);
@@ -0,0 +1,337 @@
+/**
+ * Append-only boot history ring file
+ *
+ * With BOOTCOUNT_HISTORY=<file>, every read, write, increment and CAS appends
+ * one record to a ring of fixed-size slots in an mmap'd file, so reboot loops
+ * can be spotted in the field after the fact with `bootcount --history`.
+ *
+ * Each 64-byte slot holds a fixed-layout record (struct history_record, in
+ * host byte order like the header) followed by a CRC-32 of the slot.
+ * Records are self-contained so the ring can overwrite its oldest slot
+ * without breaking decoding: timestamps are absolute.  Every record carries
+ * its own sequence number and lives in slot (seq % slots); the header's
+ * next_seq is only a hint, checked against the slot it points at, so a crash
+ * between writing the record and the header costs nothing.  Torn or blank
+ * slots fail the CRC and are skipped.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "bootid.h"
+#include "crc32.h"
+#include "history.h"
+
+#define HISTORY_PAYLOAD (HISTORY_SLOT_SIZE - 4)
+
+/* The payload of a slot, 56 bytes without padding */
+struct history_record {
+    uint32_t seq;
+    uint8_t op;
+    uint8_t backend;            /* index into platforms[] */
+    uint16_t reserved;
+    int32_t result;
+    int32_t old_val;            /* or HISTORY_NO_VALUE */
+    int32_t new_val;
+    uint32_t reserved2;
+    uint64_t boottime_ms;       /* CLOCK_BOOTTIME */
+    uint64_t real_ms;           /* CLOCK_REALTIME */
+    uint8_t boot_id[16];
+};
+
+/* fails to compile if the record outgrows the slot */
+typedef char history_record_fits[sizeof(struct history_record) <= HISTORY_PAYLOAD ? 1 : -1];
+
+static const char *op_names[] = {
+    [HISTORY_READ] = "read",
+    [HISTORY_SET] = "set",
+    [HISTORY_RESET] = "reset",
+    [HISTORY_FORCE] = "force",
+    [HISTORY_INCREMENT] = "increment",
+    [HISTORY_CAS] = "cas",
+    [HISTORY_DETECT] = "detect",
+};
+
+const char *history_op_name(uint8_t op)
+{
+    if (op < sizeof(op_names) / sizeof(op_names[0]) && op_names[op])
+        return op_names[op];
+    return "?";
+}
+
+static void encode(const struct history_record *r, uint8_t *slot)
+{
+    memset(slot, 0, HISTORY_SLOT_SIZE);
+    memcpy(slot, r, sizeof(*r));
+
+    uint32_t crc = crc32(0, slot, HISTORY_PAYLOAD);
+    for (int i = 0; i < 4; i++)
+        slot[HISTORY_PAYLOAD + i] = (uint8_t)(crc >> (8 * i));
+}
+
+static bool decode(const uint8_t *slot, struct history_record *r)
+{
+    uint32_t crc = 0;
+
+    for (int i = 0; i < 4; i++)
+        crc |= (uint32_t)slot[HISTORY_PAYLOAD + i] << (8 * i);
+    if (crc != crc32(0, slot, HISTORY_PAYLOAD))
+        return false;
+    memcpy(r, slot, sizeof(*r));
+    return true;
+}
+
+/* The mapping is kept open for the life of the process, e.g. for --batch */
+static struct history_header *g_hdr = NULL;
+static size_t g_map_len = 0;
+
+static size_t history_file_len(uint32_t slots)
+{
+    return HISTORY_DATA_OFFSET + (size_t)slots * HISTORY_SLOT_SIZE;
+}
+
+static bool header_valid(const struct history_header *hdr, size_t file_len)
+{
+    return memcmp(hdr->magic, HISTORY_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->version == HISTORY_VERSION && hdr->slot_size == HISTORY_SLOT_SIZE &&
+           hdr->slots > 0 && history_file_len(hdr->slots) <= file_len;
+}
+
+static uint64_t clock_ms(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void sync_range(void *addr, size_t len)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGE_SIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page - 1);
+    msync((void *)start, (uintptr_t)addr + len - start, MS_SYNC);
+}
+
+static int history_map(const char *path)
+{
+    struct stat st;
+
+    if (g_hdr)
+        return 0;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        DEBUG_PRINTF("history: cannot open %s (%s)\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return E_DEVICE;
+    }
+
+    bool create = st.st_size == 0;
+    size_t len = create ? history_file_len(HISTORY_DEFAULT_SLOTS) : (size_t)st.st_size;
+    if (create && ftruncate(fd, (off_t)len) != 0) {
+        close(fd);
+        return E_DEVICE;
+    }
+
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return E_DEVICE;
+
+    struct history_header *hdr = mem;
+    if (create) {
+        memcpy(hdr->magic, HISTORY_MAGIC, sizeof(hdr->magic));
+        hdr->version = HISTORY_VERSION;
+        hdr->slot_size = HISTORY_SLOT_SIZE;
+        hdr->slots = HISTORY_DEFAULT_SLOTS;
+        hdr->next_seq = 0;
+        hdr->epoch_ms = clock_ms(CLOCK_REALTIME);
+        sync_range(hdr, sizeof(*hdr));
+    } else if (len < sizeof(*hdr) || !header_valid(hdr, len)) {
+        DEBUG_PRINTF("history: %s is not a history file, not touching it\n", path);
+        munmap(mem, len);
+        return E_BADMAGIC;
+    }
+
+    g_hdr = hdr;
+    g_map_len = len;
+    return 0;
+}
+
+static uint8_t *slot_at(const struct history_header *hdr, uint32_t seq)
+{
+    return (uint8_t *)hdr + HISTORY_DATA_OFFSET + (size_t)(seq % hdr->slots) * HISTORY_SLOT_SIZE;
+}
+
+/* Sequence number after the newest valid record.  Returns false if the ring is empty. */
+static bool history_scan_next(const struct history_header *hdr, uint32_t *next)
+{
+    struct history_record r;
+    bool found = false;
+
+    for (uint32_t i = 0; i < hdr->slots; i++) {
+        if (decode(slot_at(hdr, i), &r) && (!found || r.seq >= *next)) {
+            *next = r.seq + 1;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool history_enabled(void)
+{
+    const char *path = getenv(HISTORY_ENV);
+    return path && *path;
+}
+
+void history_append(enum history_op op, const struct platform *plat,
+                    int32_t old_val, int32_t new_val, int result)
+{
+    struct history_record r;
+
+    if (!history_enabled() || history_map(getenv(HISTORY_ENV)) != 0)
+        return;
+
+    /* The hint is stale if its slot already holds that sequence number or a later one */
+    uint32_t seq = g_hdr->next_seq;
+    if (decode(slot_at(g_hdr, seq), &r) && r.seq >= seq) {
+        DEBUG_PRINTF("history: stale next_seq %u, rescanning\n", seq);
+        history_scan_next(g_hdr, &seq);
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.seq = seq;
+    r.op = (uint8_t)op;
+    r.backend = platform_index(plat);
+    r.result = result;
+    r.boottime_ms = clock_ms(CLOCK_BOOTTIME);
+    r.real_ms = clock_ms(CLOCK_REALTIME);
+    bootid_read_raw(r.boot_id);
+    r.old_val = old_val;
+    r.new_val = new_val;
+
+    uint8_t *slot = slot_at(g_hdr, seq);
+    encode(&r, slot);
+    sync_range(slot, HISTORY_SLOT_SIZE);
+    g_hdr->next_seq = seq + 1;
+    sync_range(g_hdr, sizeof(*g_hdr));
+}
+
+static void print_value(FILE *out, int32_t val)
+{
+    if (val >= 0)
+        fprintf(out, "%ld", (long)val);
+    else
+        fprintf(out, "-");
+}
+
+static void print_record(FILE *out, const struct history_record *r)
+{
+    time_t secs = (time_t)(r->real_ms / 1000);
+    struct tm tm;
+    char stamp[32];
+    gmtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    const char *op = history_op_name(r->op);
+    const char *backend = platform_index_name(r->backend);
+    if (!backend)
+        backend = "?";
+
+    fprintf(out, "%s.%03luZ boot=%02x%02x%02x%02x up=%lu.%03lus %-9s ", stamp,
+            (unsigned long)(r->real_ms % 1000), r->boot_id[0], r->boot_id[1], r->boot_id[2],
+            r->boot_id[3], (unsigned long)(r->boottime_ms / 1000),
+            (unsigned long)(r->boottime_ms % 1000), op);
+    print_value(out, r->old_val);
+    fprintf(out, " -> ");
+    print_value(out, r->new_val);
+    fprintf(out, " rc=%ld (%s)\n", (long)r->result, backend);
+}
+
+int history_print(const char *path, FILE *out)
+{
+    struct stat st;
+    struct history_record r;
+
+    if (path == NULL || *path == '\0') {
+        fprintf(stderr, "No history file, set " HISTORY_ENV " or pass --history=<file>\n");
+        return E_INVALID;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct history_header)) {
+        if (fd >= 0)
+            close(fd);
+        fprintf(stderr, "Cannot read history file %s\n", path);
+        return E_DEVICE;
+    }
+    size_t len = (size_t)st.st_size;
+    void *mem = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return E_DEVICE;
+    madvise(mem, len, MADV_SEQUENTIAL);
+
+    const struct history_header *hdr = mem;
+    if (!header_valid(hdr, len)) {
+        munmap(mem, len);
+        fprintf(stderr, "%s is not a bootcount history file\n", path);
+        return E_BADMAGIC;
+    }
+
+    uint32_t next = 0, records = 0, boots = 0, skipped = 0;
+    uint8_t last_boot[16] = { 0 };
+    if (history_scan_next(hdr, &next)) {
+        /* oldest surviving record first: the slot after the newest one */
+        for (uint32_t i = 0; i < hdr->slots; i++) {
+            uint32_t seq = next + i;
+            const uint8_t *slot = slot_at(hdr, seq);
+            if (!decode(slot, &r)) {
+                for (int k = 0; k < HISTORY_SLOT_SIZE; k++) {
+                    if (slot[k]) {
+                        skipped++;
+                        break;
+                    }
+                }
+                continue;
+            }
+            if (records == 0 || memcmp(last_boot, r.boot_id, sizeof(last_boot)) != 0)
+                boots++;
+            memcpy(last_boot, r.boot_id, sizeof(last_boot));
+            records++;
+            print_record(out, &r);
+        }
+    }
+    fprintf(out, "%lu records, %lu boots, %lu corrupt slots\n",
+            (unsigned long)records, (unsigned long)boots, (unsigned long)skipped);
+
+    munmap(mem, len);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * Append-only boot history ring file
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "platform.h"
+
+/* Set BOOTCOUNT_HISTORY to a file on persistent storage to record every operation */
+#define HISTORY_ENV "BOOTCOUNT_HISTORY"
+
+#define HISTORY_MAGIC "BCHI"
+#define HISTORY_VERSION 2
+#define HISTORY_SLOT_SIZE 64
+#define HISTORY_DEFAULT_SLOTS 8192      /* 512 KiB */
+#define HISTORY_DATA_OFFSET 64          /* slots start after the header */
+
+/* Value not known, e.g. the read before a write failed */
+#define HISTORY_NO_VALUE (-1)
+
+enum history_op {
+    HISTORY_READ = 1,
+    HISTORY_SET,
+    HISTORY_RESET,
+    HISTORY_FORCE,
+    HISTORY_INCREMENT,
+    HISTORY_CAS,
+    HISTORY_DETECT,
+};
+
+/* Backend index of records made before a platform was detected */
+#define HISTORY_NO_BACKEND PLATFORM_INDEX_NONE
+
+/* File header.  next_seq is only a hint; records carry their own sequence numbers. */
+struct history_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t slot_size;
+    uint32_t slots;
+    uint32_t next_seq;
+    uint64_t epoch_ms;      /* CLOCK_REALTIME at creation */
+};
+
+bool history_enabled(void);
+
+/* "read", "set", ... or "?" */
+const char *history_op_name(uint8_t op);
+
+/* Append one record, plat may be NULL.  Failures are reported in debug output only. */
+void history_append(enum history_op op, const struct platform *plat,
+                    int32_t old_val, int32_t new_val, int result);
+
+/* Print all valid records of the history file, oldest first.  Returns 0 or an E_* code. */
+int history_print(const char *path, FILE *out);
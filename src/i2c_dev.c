@@ -0,0 +1,381 @@
+/**
+ * Raw i2c-dev bootcount backend
+ *
+ * Talks to the bootcount EEPROM or RTC directly through /dev/i2c-N, for early
+ * boot paths where the at24/RTC driver is not bound yet and neither
+ * /sys/bus/i2c/devices/<bus>-<addr>/eeprom nor the nvmem node exist.
+ *
+ * The device is resolved from the same DT nodes as the DM backends:
+ *
+ *    bootcount_i2c_eeprom: bc_i2c_eeprom {
+ *        compatible = "u-boot,bootcount-i2c-eeprom";
+ *        i2c-eeprom = <&eeprom0>;     // chip address from eeprom0's "reg"
+ *        offset = <0x30>;             // EEPROM byte offset
+ *    };
+ *
+ *    bootcount_rv3028: bc_rv3028 {
+ *        compatible = "u-boot,bootcount-rtc";
+ *        rtc = <&i2c_som_rtc>;        // chip address from the RTC's "reg"
+ *        offset = <0x1F>;             // I2C register address of the user RAM
+ *    };
+ *
+ * The bus number comes from the I2C controller (the parent DT node): the
+ * /sys/bus/i2c/devices/i2c-N adapter whose of_node matches it, or else the
+ * i2cN entry in /aliases.
+ *
+ * A read is one I2C_RDWR ioctl with a combined write-address/read-data
+ * message pair; a write is a single message with the address and data.  The
+ * layout is the same as the DM backends: [value, magic] at offset.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "constants.h"
+#include "dm_eeprom.h"
+#include "dt.h"
+#include "i2c_dev.h"
+#include "trace.h"
+
+#define I2C_SYSFS_DEVICES "/sys/bus/i2c/devices"
+#define I2C_DEV_PATH "/dev/i2c-%d"
+#define BC_MAGIC 0xbc
+/* dt-bindings/i2c/i2c.h: flag in a child's reg for a 10-bit address */
+#define I2C_TEN_BIT_ADDRESS (1u << 31)
+
+/* Smallest page of any at24 part; a write must not cross a page boundary */
+#define EEPROM_MIN_PAGE 8
+
+/* Cached discovery state */
+static bool g_inited = false;
+static char g_dev_path[32];
+static uint16_t g_chip_addr;
+static bool g_ten_bit;        /* g_chip_addr is a 10-bit address (I2C_M_TEN) */
+static uint32_t g_offset;
+static int g_addr_bytes;      /* 1 or 2 address bytes */
+static bool g_is_eeprom;
+static int g_fd = -1;
+
+/* Bus number of the adapter whose DT node is `bus_node`, or -1 */
+static int find_adapter(const char *bus_node)
+{
+    int bus = -1;
+    struct dirent *de;
+
+    DIR *dev_dir = opendir(I2C_SYSFS_DEVICES);
+    if (dev_dir) {
+        while (bus < 0 && (de = readdir(dev_dir))) {
+            int n;
+            char link_path[PATH_MAX];
+            if (sscanf(de->d_name, "i2c-%d", &n) != 1)
+                continue;
+            if (snprintf(link_path, sizeof(link_path), I2C_SYSFS_DEVICES "/%s/of_node", de->d_name) >= (int)sizeof(link_path))
+                continue;
+            if (same_fs_node(link_path, bus_node))
+                bus = n;
+        }
+        closedir(dev_dir);
+    }
+    if (bus >= 0)
+        return bus;
+
+    /* Fall back to the i2cN aliases */
+    DIR *alias_dir = opendir(DT_ROOT "/aliases");
+    if (!alias_dir)
+        return -1;
+    while (bus < 0 && (de = readdir(alias_dir))) {
+        int n;
+        char alias[PATH_MAX], alias_node[PATH_MAX];
+        if (sscanf(de->d_name, "i2c%d", &n) != 1)
+            continue;
+        if (dt_node_read_str(DT_ROOT "/aliases", de->d_name, alias, sizeof(alias)) <= 0)
+            continue;
+        if (snprintf(alias_node, sizeof(alias_node), DT_ROOT "%s", alias) >= (int)sizeof(alias_node))
+            continue;
+        if (same_fs_node(alias_node, bus_node))
+            bus = n;
+    }
+    closedir(alias_dir);
+    return bus;
+}
+
+/*
+ * at24 parts up to 24c16 (2 KiB) take one address byte, with the upper
+ * offset bits folded into the chip address; larger parts take two.
+ */
+static int eeprom_address_bytes(const char *node)
+{
+    uint32_t width, size;
+    char compat[128];
+
+    if (dt_node_read_u32(node, "address-width", &width))
+        return width > 8 ? 2 : 1;
+    if (dt_node_read_u32(node, "size", &size))
+        return size > 2048 ? 2 : 1;
+    if (dt_node_read_str(node, "compatible", compat, sizeof(compat)) > 0) {
+        char *part = strstr(compat, "24c");
+        if (part)
+            return strtoul(part + 3, NULL, 10) >= 32 ? 2 : 1;
+    }
+    return 1;
+}
+
+/* True if a kernel driver is bound to the chip, i.e. <bus>-<addr>/driver exists */
+static bool driver_bound(int bus, uint16_t chip, bool ten_bit)
+{
+    char path[PATH_MAX];
+    struct stat sb;
+
+    /* the kernel names 10-bit clients with I2C_ADDR_OFFSET_TEN_BIT (0xa000) added */
+    snprintf(path, sizeof(path), I2C_SYSFS_DEVICES "/%d-%04x/driver", bus,
+             ten_bit ? 0xa000 | chip : chip);
+    if (stat(path, &sb) != 0)
+        return false;
+    DEBUG_PRINTF(" A driver is bound to %d-%04x, not using i2c-dev\n", bus, chip);
+    return true;
+}
+
+static bool discover_i2c_dev(void)
+{
+    if (g_inited)
+        return true;
+    DEBUG_PRINTF("Discovering raw i2c-dev bootcount device...\n");
+
+    char bc_node[PATH_MAX];
+    const char *phandle_prop;
+    if (dt_get_chosen_bootcount_node("u-boot,bootcount-i2c-eeprom", bc_node, sizeof(bc_node))) {
+        g_is_eeprom = true;
+        phandle_prop = "i2c-eeprom";
+    }
+    else if (dt_get_chosen_bootcount_node("u-boot,bootcount-rtc", bc_node, sizeof(bc_node))) {
+        g_is_eeprom = false;
+        phandle_prop = "rtc";
+    }
+    else {
+        return false;
+    }
+    DEBUG_PRINTF(" Found bootcount node %s\n", bc_node);
+
+    g_offset = 0;
+    dt_node_read_u32(bc_node, "offset", &g_offset); /* ignore failure => 0 */
+
+    uint32_t phandle;
+    if (!dt_node_read_u32(bc_node, phandle_prop, &phandle))
+        return false;
+    char dev_node[PATH_MAX];
+    if (!dt_find_phandle_node(phandle, dev_node, sizeof(dev_node)))
+        return false;
+    DEBUG_PRINTF(" Found %s node %s\n", phandle_prop, dev_node);
+
+    uint32_t reg;
+    if (!dt_node_read_u32(dev_node, "reg", &reg)) {
+        DEBUG_PRINTF(" No 'reg' in %s\n", dev_node);
+        return false;
+    }
+    g_ten_bit = reg & I2C_TEN_BIT_ADDRESS;
+    reg &= ~I2C_TEN_BIT_ADDRESS;
+    if (reg > (g_ten_bit ? 0x3ffu : 0x7fu)) {
+        DEBUG_PRINTF(" Bad address 0x%lx in 'reg' of %s\n", (unsigned long)reg, dev_node);
+        return false;
+    }
+    g_chip_addr = (uint16_t)reg;
+
+    /* the I2C controller is the parent node */
+    char bus_node[PATH_MAX];
+    strcpy(bus_node, dev_node);
+    char *slash = strrchr(bus_node, '/');
+    if (!slash)
+        return false;
+    *slash = '\0';
+
+    int bus = find_adapter(bus_node);
+    if (bus < 0) {
+        DEBUG_PRINTF(" No i2c adapter for %s\n", bus_node);
+        return false;
+    }
+    snprintf(g_dev_path, sizeof(g_dev_path), I2C_DEV_PATH, bus);
+
+    /* raw transfers must not go behind an at24/RTC driver that owns the chip */
+    if (driver_bound(bus, g_chip_addr, g_ten_bit))
+        return false;
+
+    struct stat sb;
+    if (stat(g_dev_path, &sb) != 0) {
+        DEBUG_PRINTF(" %s does not exist (is i2c-dev loaded?)\n", g_dev_path);
+        return false;
+    }
+
+    g_addr_bytes = g_is_eeprom ? eeprom_address_bytes(dev_node) : 1;
+    DEBUG_PRINTF(" Using %s chip 0x%02x offset 0x%lx (%d address bytes)\n",
+                 g_dev_path, g_chip_addr, (unsigned long)g_offset, g_addr_bytes);
+
+    g_inited = true;
+    return true;
+}
+
+static int open_dev(void)
+{
+    if (g_fd >= 0)
+        return g_fd;
+    g_fd = open(g_dev_path, O_RDWR);
+    if (g_fd < 0) {
+        trace_event(TRACE_OPEN, g_dev_path, g_chip_addr, 0, E_DEVICE);
+        perror("open failed");
+        return E_DEVICE;
+    }
+    trace_event(TRACE_OPEN, g_dev_path, g_chip_addr, 0, 0);
+    return g_fd;
+}
+
+/* Fill the address bytes for `offset`; returns their count and the chip address to use */
+static int build_address(uint32_t offset, uint8_t *addr, uint16_t *chip)
+{
+    if (g_addr_bytes == 2) {
+        addr[0] = (uint8_t)(offset >> 8);
+        addr[1] = (uint8_t)offset;
+        *chip = g_chip_addr;
+        return 2;
+    }
+    addr[0] = (uint8_t)offset;
+    *chip = g_chip_addr + (uint16_t)(offset >> 8);
+    return 1;
+}
+
+struct xfer_ctx {
+    int fd;
+    uint32_t offset;
+};
+
+/* One combined write-address/read-data transaction */
+static ssize_t i2c_dev_read_raw(void *ctx, void *buf, size_t len)
+{
+    struct xfer_ctx *c = ctx;
+    uint8_t addr[2];
+    uint16_t chip;
+    int n = build_address(c->offset, addr, &chip);
+
+    uint16_t ten = g_ten_bit ? I2C_M_TEN : 0;
+    struct i2c_msg msgs[2] = {
+        { .addr = chip, .flags = ten, .len = (uint16_t)n, .buf = addr },
+        { .addr = chip, .flags = ten | I2C_M_RD, .len = (uint16_t)len, .buf = buf },
+    };
+    struct i2c_rdwr_ioctl_data data = { .msgs = msgs, .nmsgs = 2 };
+
+    if (ioctl(c->fd, I2C_RDWR, &data) < 0)
+        return -1;
+    return (ssize_t)len;
+}
+
+/* One write message: address bytes followed by data */
+static int i2c_dev_write_raw(int fd, uint32_t offset, const uint8_t *bytes, size_t len)
+{
+    uint8_t buf[2 + 2];
+    uint16_t chip;
+    int n = build_address(offset, buf, &chip);
+
+    memcpy(buf + n, bytes, len);
+    struct i2c_msg msg = { .addr = chip, .flags = g_ten_bit ? I2C_M_TEN : 0, .len = (uint16_t)(n + len), .buf = buf };
+    struct i2c_rdwr_ioctl_data data = { .msgs = &msg, .nmsgs = 1 };
+
+    if (ioctl(fd, I2C_RDWR, &data) < 0)
+        return E_DEVICE;
+    return 0;
+}
+
+bool i2c_dev_exists(void)
+{
+    return discover_i2c_dev();
+}
+
+int i2c_dev_read_bootcount(uint16_t *val)
+{
+    if (!discover_i2c_dev())
+        return E_DEVICE;
+    int fd = open_dev();
+    if (fd < 0)
+        return fd;
+
+    uint8_t bytes[2];
+    struct xfer_ctx ctx = { .fd = fd, .offset = g_offset };
+    if (i2c_dev_read_raw(&ctx, bytes, sizeof(bytes)) < 0) {
+        trace_event(TRACE_READ, g_dev_path, g_offset, 0, E_DEVICE);
+        perror("I2C_RDWR read failed");
+        return E_DEVICE;
+    }
+    trace_event(TRACE_READ, g_dev_path, g_offset, bytes[1] << 8 | bytes[0], 0);
+
+    if (bytes[1] != BC_MAGIC) {
+        trace_event(TRACE_BADMAGIC, g_dev_path, g_offset, bytes[1] << 8 | bytes[0], E_BADMAGIC);
+        return E_BADMAGIC;
+    }
+    *val = bytes[0];
+    return 0;
+}
+
+int i2c_dev_write_bootcount(uint16_t val)
+{
+    /* Only the low byte is stored; skip the write if it is already there */
+    uint16_t cur_val;
+    if (i2c_dev_read_bootcount(&cur_val) == 0 && cur_val == (val & 0xff)) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", cur_val);
+        trace_event(TRACE_SKIP, g_dev_path, g_offset, cur_val, 0);
+        return 0;
+    }
+    if (!discover_i2c_dev())
+        return E_DEVICE;
+    int fd = open_dev();
+    if (fd < 0)
+        return fd;
+
+    const uint8_t bytes[2] = { (uint8_t)(val & 0xff), BC_MAGIC };
+
+    /* Split the write if it would cross an EEPROM page boundary */
+    size_t done = 0;
+    while (done < sizeof(bytes)) {
+        uint32_t offset = g_offset + done;
+        size_t len = sizeof(bytes) - done;
+        if (g_is_eeprom && EEPROM_MIN_PAGE - (offset % EEPROM_MIN_PAGE) < len)
+            len = EEPROM_MIN_PAGE - (offset % EEPROM_MIN_PAGE);
+
+        int err = i2c_dev_write_raw(fd, offset, bytes + done, len);
+        trace_event(TRACE_WRITE, g_dev_path, offset, bytes[1] << 8 | bytes[0], err);
+        if (err) {
+            perror("I2C_RDWR write failed");
+            return err;
+        }
+
+        /* ACK-poll with the read-back until the write cycle is over */
+        struct xfer_ctx ctx = { .fd = fd, .offset = offset };
+        err = eeprom_verify_poll(i2c_dev_read_raw, &ctx, g_dev_path, offset, bytes + done, len);
+        if (err)
+            return err;
+        done += len;
+    }
+    return 0;
+}
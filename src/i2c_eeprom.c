@@ -19,6 +19,8 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -32,6 +34,8 @@
 
 #include "constants.h"
 #include "i2c_eeprom.h"
+#include "dm_eeprom.h"
+#include "trace.h"
 
 #define DEFAULT_OFFSET 0x100
 
@@ -41,6 +45,11 @@
 
 int open_eeprom(uint8_t bus, uint8_t addr, off_t offset);
 
+// The fd is kept open so repeated accesses (e.g. `bootcount --batch`) reuse it
+static int g_fd = -1;
+static uint8_t g_fd_bus, g_fd_addr;
+static char g_fd_path[40];
+
 int eeprom_read_bootcount2(uint16_t *val, uint8_t bus, uint8_t addr, off_t offset);
 
 int eeprom_write_bootcount2(uint16_t val, uint8_t bus, uint8_t addr, off_t offset);
@@ -61,12 +70,15 @@ int eeprom_read_bootcount2(uint16_t *val, uint8_t bus, uint8_t addr, off_t offse
     if ( fd == E_DEVICE ) {
         return E_DEVICE;
     }
-    if ( read(fd, &data, sizeof(data)) == -1 ) {
+    if ( pread(fd, &data, sizeof(data), offset) == -1 ) {
+        trace_event(TRACE_READ, g_fd_path, offset, 0, E_DEVICE);
         perror("Read error");
         return E_DEVICE;
     }
+    trace_event(TRACE_READ, g_fd_path, offset, data, 0);
 
     if (data >> 8 != EEPROM_MAGIC) {
+        trace_event(TRACE_BADMAGIC, g_fd_path, offset, data, E_BADMAGIC);
         return E_BADMAGIC;
     }
 
@@ -77,6 +89,14 @@ int eeprom_read_bootcount2(uint16_t *val, uint8_t bus, uint8_t addr, off_t offse
 // https://github.com/u-boot/u-boot/blob/master/drivers/bootcount/i2c-eeprom.c#L20
 int eeprom_write_bootcount2(uint16_t val, uint8_t bus, uint8_t addr, off_t offset) {
 
+    // Only the low byte is stored; skip the write cycle if it is already there
+    uint16_t cur_val;
+    if ( eeprom_read_bootcount2(&cur_val, bus, addr, offset) == 0 && cur_val == (val & 0xff) ) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", cur_val);
+        trace_event(TRACE_SKIP, g_fd_path, offset, cur_val, 0);
+        return 0;
+    }
+
     int fd = open_eeprom(bus, addr, offset);
     if ( fd == E_DEVICE ) {
         return E_DEVICE;
@@ -85,45 +105,58 @@ int eeprom_write_bootcount2(uint16_t val, uint8_t bus, uint8_t addr, off_t offse
     uint16_t data = 0;
     data = EEPROM_MAGIC << 8 | (val & 0xff);
 
-    ssize_t written = write(fd, &data, sizeof(data));
+    ssize_t written = pwrite(fd, &data, sizeof(data), offset);
     if ( written == -1 ) {
+        trace_event(TRACE_WRITE, g_fd_path, offset, data, E_DEVICE);
         perror("Write error");
         return E_DEVICE;
     }
+    trace_event(TRACE_WRITE, g_fd_path, offset, data, (size_t)written < sizeof(data) ? E_WRITE_FAILED : 0);
     if ( (size_t)written < sizeof(data) ) {
         fprintf(stderr, "Incomplete write: %zd bytes!\n", written);
+        return E_WRITE_FAILED;
     }
-    close(fd);
 
-    return 0;
+    // read back once the EEPROM finishes its write cycle:
+    return dm_eeprom_verify(fd, g_fd_path, offset, &data, sizeof(data));
 }
 
 
+
 int open_eeprom(uint8_t bus, uint8_t addr, off_t offset) {
     char eeprom_path[40];
     int fd;
     struct stat sb;
 
+    if (g_fd >= 0 && g_fd_bus == bus && g_fd_addr == addr) {
+        return g_fd;
+    }
+
     snprintf(eeprom_path, sizeof(eeprom_path), EEPROM_PATH, bus, addr);
 
     fd = open(eeprom_path, O_RDWR);
 
     if (fd < 0) {
+        trace_event(TRACE_OPEN, eeprom_path, offset, 0, E_DEVICE);
         perror("open failed");
         return E_DEVICE;
     }
 
     if (fstat(fd, &sb) == -1) {
         perror("fstat failed");
+        close(fd);
         return E_DEVICE;
     }
     //printf("Opened path %s\n", eeprom_path);
+    trace_event(TRACE_OPEN, eeprom_path, offset, 0, 0);
 
-    if( lseek(fd, offset, SEEK_SET) == -1 ) {
-        perror("Seek failed");
-        return E_DEVICE;
+    if (g_fd >= 0) {
+        close(g_fd);
     }
-
+    g_fd = fd;
+    g_fd_bus = bus;
+    g_fd_addr = addr;
+    strcpy(g_fd_path, eeprom_path);
     return fd;
 }
 
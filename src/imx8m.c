@@ -36,6 +36,9 @@
 #include "constants.h"
 #include "dt.h"
 #include "memory.h"
+#include "imx8m.h"
+#include "reset_cause.h"
+#include "trace.h"
 
 #define SNVS_BASE_ADDR 0x30370000
 #define SNVS_LPGPR0_ALIAS_REG_OFFSET 0x90
@@ -44,6 +47,24 @@
 #define IMX8M_MEM_OFFSET (SNVS_BASE_ADDR + SNVS_LPGPR0_ALIAS_REG_OFFSET)
 #define IMX8M_MEM_LEN (SNVS_LPGPR0_ALIAS_REG_SIZE)
 
+/* SRC_SRSR, the System Reset Status Register */
+#define SRC_BASE_ADDR 0x30390000
+#define SRC_SRSR_OFFSET 0x5C
+
+static const struct reset_flag imx8m_reset_flags[] = {
+    {0x00001, "IPP_RESET_B", "power-on"},
+    {0x00004, "CSU_RESET_B", "security"},
+    {0x00008, "IPP_USER_RESET_B", "external"},
+    {0x00010, "WDOG1_RST_B", "watchdog"},
+    {0x00020, "JTAG_RST_B", "debugger"},
+    {0x00040, "JTAG_SW_RST", "debugger"},
+    {0x00080, "WDOG3_RST_B", "watchdog"},
+    {0x00100, "WDOG4_RST_B", "watchdog"},
+    {0x00200, "TEMPSENSE_RST_B", "thermal"},
+    {0x10000, "WARM_BOOT", "software"},
+    {0, NULL, NULL}
+};
+
 bool is_imx8m() {
     return is_compatible_soc("fsl,imx8mm") || is_compatible_soc("fsl,imx8mn") ||
            is_compatible_soc("fsl,imx8mp") || is_compatible_soc("fsl,imx8mq");
@@ -52,16 +73,22 @@ bool is_imx8m() {
 int imx8m_read_bootcount(uint16_t* val) {
 
     uint32_t *gprg0;
+    uint32_t raw;
 
     gprg0 = memory_open(IMX8M_MEM_OFFSET, IMX8M_MEM_LEN);
     if (gprg0 == (void *)E_DEVICE)
         return E_DEVICE;
 
+    raw = *gprg0;
+    trace_event(TRACE_READ, "/dev/mem", IMX8M_MEM_OFFSET, raw, 0);
+
     /* low two bytes are the value, high two bytes are magic */
-    if ((*gprg0 & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000))
+    if ((raw & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000)) {
+        trace_event(TRACE_BADMAGIC, "/dev/mem", IMX8M_MEM_OFFSET, raw, E_BADMAGIC);
         return E_BADMAGIC;
+    }
 
-    *val = (uint16_t)(*gprg0 & 0x0000ffff);
+    *val = (uint16_t)(raw & 0x0000ffff);
     return 0;
 }
 
@@ -71,16 +98,30 @@ int imx8m_write_bootcount(uint16_t val) {
     volatile uint32_t *gprg0;
     uint16_t read_val = 0;
 
+    /* skip the write if the register already holds this value */
+    if (imx8m_read_bootcount(&read_val) == 0 && read_val == val) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", val);
+        trace_event(TRACE_SKIP, "/dev/mem", IMX8M_MEM_OFFSET, read_val, 0);
+        return 0;
+    }
+
     gprg0 = (volatile uint32_t *)memory_open(IMX8M_MEM_OFFSET, IMX8M_MEM_LEN);
     if (gprg0 == (void *)E_DEVICE )
         return E_DEVICE;
 
     *gprg0 = (BOOTCOUNT_MAGIC & 0xffff0000) | (val & 0xffff);
+    trace_event(TRACE_WRITE, "/dev/mem", IMX8M_MEM_OFFSET, (BOOTCOUNT_MAGIC & 0xffff0000) | val, 0);
 
     /* read back to verify */
     imx8m_read_bootcount(&read_val);
-    if (read_val != val)
+    if (read_val != val) {
+        trace_event(TRACE_VERIFY, "/dev/mem", IMX8M_MEM_OFFSET, read_val, E_WRITE_FAILED);
         return E_WRITE_FAILED;
+    }
 
     return 0;
 }
+
+int imx8m_read_reset_cause(struct reset_cause *rc, bool clear) {
+    return reset_cause_read_reg(SRC_BASE_ADDR + SRC_SRSR_OFFSET, imx8m_reset_flags, clear, rc);
+}
@@ -26,3 +26,6 @@ bool is_imx8m();
 int imx8m_read_bootcount(uint16_t* val);
 int imx8m_write_bootcount(uint16_t val);
 
+struct reset_cause;
+int imx8m_read_reset_cause(struct reset_cause *rc, bool clear);
+
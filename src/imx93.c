@@ -34,6 +34,7 @@
 #include "constants.h"
 #include "dt.h"
 #include "memory.h"
+#include "trace.h"
 
 #define BBNSM_BASE_ADDR 0x44440000
 #define BBNSM_GPR0_ALIAS_REG_OFFSET 0x300
@@ -49,16 +50,22 @@ bool is_imx93() {
 int imx93_read_bootcount(uint16_t* val) {
 
     uint32_t *gpr0;
+    uint32_t raw;
 
     gpr0 = memory_open(IMX93_MEM_OFFSET, IMX93_MEM_LEN);
     if (gpr0 == (void *)E_DEVICE)
         return E_DEVICE;
 
+    raw = *gpr0;
+    trace_event(TRACE_READ, "/dev/mem", IMX93_MEM_OFFSET, raw, 0);
+
     /* low two bytes are the value, high two bytes are magic */
-    if ((*gpr0 & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000))
+    if ((raw & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000)) {
+        trace_event(TRACE_BADMAGIC, "/dev/mem", IMX93_MEM_OFFSET, raw, E_BADMAGIC);
         return E_BADMAGIC;
+    }
 
-    *val = (uint16_t)(*gpr0 & 0x0000ffff);
+    *val = (uint16_t)(raw & 0x0000ffff);
     return 0;
 }
 
@@ -68,16 +75,26 @@ int imx93_write_bootcount(uint16_t val) {
     volatile uint32_t *gpr0;
     uint16_t read_val = 0;
 
+    /* skip the write if the register already holds this value */
+    if (imx93_read_bootcount(&read_val) == 0 && read_val == val) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", val);
+        trace_event(TRACE_SKIP, "/dev/mem", IMX93_MEM_OFFSET, read_val, 0);
+        return 0;
+    }
+
     gpr0 = (volatile uint32_t *)memory_open(IMX93_MEM_OFFSET, IMX93_MEM_LEN);
     if (gpr0 == (void *)E_DEVICE )
         return E_DEVICE;
 
     *gpr0 = (BOOTCOUNT_MAGIC & 0xffff0000) | (val & 0xffff);
+    trace_event(TRACE_WRITE, "/dev/mem", IMX93_MEM_OFFSET, (BOOTCOUNT_MAGIC & 0xffff0000) | val, 0);
 
     /* read back to verify */
     imx93_read_bootcount(&read_val);
-    if (read_val != val)
+    if (read_val != val) {
+        trace_event(TRACE_VERIFY, "/dev/mem", IMX93_MEM_OFFSET, read_val, E_WRITE_FAILED);
         return E_WRITE_FAILED;
+    }
 
     return 0;
 }
@@ -0,0 +1,98 @@
+/**
+ * Cross-process advisory lock around bootcount read-modify-write sequences
+ *
+ * Every backend's write is itself a read / compare / write / verify sequence,
+ * and -i and --cas add a read in front of that.  Two processes interleaving
+ * those steps (e.g. a watchdog supervisor incrementing while an OTA client
+ * resets) lose updates, so each operation runs under an flock() on
+ * BOOTCOUNT_LOCK_PATH.  Contention is cheap to detect: try a non-blocking
+ * lock first and only report and time the wait when that fails.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "constants.h"
+#include "lock.h"
+#include "trace.h"
+
+static unsigned long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - start->tv_sec) * 1000000L +
+                           (now.tv_nsec - start->tv_nsec) / 1000L);
+}
+
+int bootcount_lock(void)
+{
+    const char *path = getenv(BOOTCOUNT_LOCK_ENV);
+    struct timespec start;
+
+    if (path == NULL || *path == '\0')
+        path = BOOTCOUNT_LOCK_PATH;
+    if (strcmp(path, "off") == 0)
+        return -1;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        DEBUG_PRINTF("Cannot open lock %s (%s), running unlocked\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        trace_event(TRACE_LOCK, path, 0, 0, 0);
+        return fd;
+    }
+    if (errno != EWOULDBLOCK) {
+        DEBUG_PRINTF("flock %s failed (%s), running unlocked\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    DEBUG_PRINTF("Lock %s contended, waiting\n", path);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            DEBUG_PRINTF("flock %s failed (%s), running unlocked\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    unsigned long waited = elapsed_us(&start);
+    DEBUG_PRINTF("Lock %s acquired after %lu us\n", path, waited);
+    trace_event(TRACE_LOCK, path, 0, (uint32_t)waited, 0);
+    return fd;
+}
+
+void bootcount_unlock(int fd)
+{
+    /* closing the fd releases the flock */
+    if (fd >= 0)
+        close(fd);
+}
@@ -0,0 +1,33 @@
+/**
+ * Cross-process advisory lock around bootcount read-modify-write sequences
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#define BOOTCOUNT_LOCK_PATH "/run/lock/bootcount.lock"
+/* Override the lock file, or "off" to run unlocked (benchmarks only) */
+#define BOOTCOUNT_LOCK_ENV "BOOTCOUNT_LOCK"
+
+/*
+ * Take the exclusive lock, blocking while another process holds it.
+ * Returns the lock fd, or -1 if the lock file cannot be opened (e.g. no
+ * /run/lock in an initramfs), in which case the caller proceeds unlocked.
+ */
+int bootcount_lock(void);
+
+void bootcount_unlock(int fd);
@@ -5,6 +5,9 @@
  * https://github.com/radii/devmem2
  * https://stackoverflow.com/a/12041352/213983
  *
+ * The /dev/mem fd and every mapping are kept for the life of the process, so
+ * repeated accesses (e.g. `bootcount --batch`) reuse a single handle.
+ *
  * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
  *
  * Copyright (c) 2023 Amarula Solutions, Dario Binacchi <dario.binacchi@amarulasolutions.com>
@@ -23,6 +26,8 @@
  */
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/mman.h>
@@ -30,6 +35,7 @@
 
 #include "constants.h"
 #include "memory.h"
+#include "trace.h"
 
 #define uswap_32(x) \
 	((((x) & 0xff000000) >> 24) | \
@@ -37,10 +43,23 @@
 	 (((x) & 0x0000ff00) <<  8) | \
 	 (((x) & 0x000000ff) << 24))
 
-void *memory_open(off_t offset, size_t len) {
+#define MEMORY_MAX_MAPS 4
+
+static int g_mem_fd = -1;           /* O_SYNC: uncached mappings */
+static int g_mem_cached_fd = -1;
+static struct {
+    off_t page_base;
+    size_t len;
+    uint8_t *mem;
+    bool cached;
+} g_maps[MEMORY_MAX_MAPS];
+static int g_nmaps = 0;
+/* two /dev/mem backends may map at once from the --all threads */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *memory_map_locked(off_t offset, size_t len, bool cached) {
     size_t pagesize;
     off_t page_base, page_offset;
-    int fd;
     uint8_t *mem;
 
     /*
@@ -51,24 +70,98 @@ void *memory_open(off_t offset, size_t len) {
     page_base = (offset / pagesize) * pagesize;
     page_offset = offset - page_base;
 
-    fd = open("/dev/mem", O_SYNC | O_RDWR);
-    if (fd < 0) {
-        perror("open_memory(): open(\"/dev/mem\") failed");
-        return (void *)E_DEVICE;
+    for (int i = 0; i < g_nmaps; i++) {
+        if (g_maps[i].page_base == page_base && g_maps[i].len >= page_offset + len &&
+            g_maps[i].cached == cached)
+            return (g_maps[i].mem + page_offset);
+    }
+
+    int *fd = cached ? &g_mem_cached_fd : &g_mem_fd;
+    if (*fd < 0) {
+        *fd = open("/dev/mem", cached ? O_RDWR : O_SYNC | O_RDWR);
+        if (*fd < 0) {
+            trace_event(TRACE_OPEN, "/dev/mem", 0, 0, E_DEVICE);
+            perror("open_memory(): open(\"/dev/mem\") failed");
+            return (void *)E_DEVICE;
+        }
     }
 
     mem = mmap(NULL, page_offset + len, PROT_READ | PROT_WRITE, MAP_SHARED,
-	       fd, page_base);
-    close(fd);
+	       *fd, page_base);
 
     if (mem == MAP_FAILED) {
+        trace_event(TRACE_MMAP, "/dev/mem", (uint32_t)offset, (uint32_t)len, E_DEVICE);
         perror("memory_open(): mmap() failed");
         return (void *)E_DEVICE;
     }
+    trace_event(TRACE_MMAP, "/dev/mem", (uint32_t)offset, (uint32_t)len, 0);
+
+    if (g_nmaps < MEMORY_MAX_MAPS) {
+        g_maps[g_nmaps].page_base = page_base;
+        g_maps[g_nmaps].len = page_offset + len;
+        g_maps[g_nmaps].mem = mem;
+        g_maps[g_nmaps].cached = cached;
+        g_nmaps++;
+    }
 
     return (mem + page_offset);
 }
 
+static void *memory_map(off_t offset, size_t len, bool cached) {
+    pthread_mutex_lock(&g_lock);
+    void *mem = memory_map_locked(offset, len, cached);
+    pthread_mutex_unlock(&g_lock);
+    return mem;
+}
+
+void *memory_open(off_t offset, size_t len) {
+    return memory_map(offset, len, false);
+}
+
+void *memory_open_cached(off_t offset, size_t len) {
+    return memory_map(offset, len, true);
+}
+
+/*
+ * Cache maintenance from userspace: Linux lets EL0 clean lines to the point
+ * of coherency on arm64 (SCTLR_EL1.UCI), and clflush is unprivileged on x86.
+ * 32-bit ARM has no such instruction, so callers map uncached there instead.
+ */
+#if defined(__aarch64__)
+bool memory_can_clean(void) {
+    return true;
+}
+
+void memory_clean(const volatile void *addr, size_t len) {
+    uint64_t ctr;
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    uintptr_t line = (uintptr_t)4 << ((ctr >> 16) & 0xf);   /* DminLine */
+
+    for (uintptr_t p = (uintptr_t)addr & ~(line - 1); p < (uintptr_t)addr + len; p += line)
+        __asm__ volatile("dc cvac, %0" : : "r"(p) : "memory");
+    __asm__ volatile("dsb sy" : : : "memory");
+}
+#elif defined(__x86_64__) || defined(__i386__)
+bool memory_can_clean(void) {
+    return true;
+}
+
+void memory_clean(const volatile void *addr, size_t len) {
+    const uintptr_t line = 64;
+
+    for (uintptr_t p = (uintptr_t)addr & ~(line - 1); p < (uintptr_t)addr + len; p += line)
+        __asm__ volatile("clflush (%0)" : : "r"(p) : "memory");
+    __asm__ volatile("mfence" : : : "memory");
+}
+#else
+bool memory_can_clean(void) {
+    return false;
+}
+
+void memory_clean(const volatile void *addr, size_t len) {
+}
+#endif
+
 #ifdef BIG_ENDIAN
 uint32_t memory_read(volatile uint32_t *addr)
 {
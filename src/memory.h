@@ -20,8 +20,23 @@
 
 # pragma once
 
+#include <stdbool.h>
 #include <sys/types.h>
 
+/* Map physical memory uncached (O_SYNC), for registers.  Returns (void *)E_DEVICE on failure. */
 void *memory_open(off_t offset, size_t len);
+
+/*
+ * Map physical RAM cacheable.  Writes only reach DRAM after memory_clean(),
+ * so use this only where memory_can_clean() is true.
+ */
+void *memory_open_cached(off_t offset, size_t len);
+
+/* True if memory_clean() can write back cache lines from userspace on this CPU */
+bool memory_can_clean(void);
+
+/* Write back (clean) the data cache lines covering [addr, addr + len) to DRAM */
+void memory_clean(const volatile void *addr, size_t len);
+
 uint32_t memory_read(volatile uint32_t *addr);
 void memory_write(volatile uint32_t *addr, uint32_t data);
@@ -0,0 +1,54 @@
+/**
+ * Operation records, fanned out to the optional history file and pmsg
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "constants.h"
+#include "bootid.h"
+#include "history.h"
+#include "oplog.h"
+#include "pmsg.h"
+
+int32_t oplog_prior_value(const struct platform *plat)
+{
+    uint16_t val;
+
+    if ((!history_enabled() && !pmsg_enabled()) || plat->read_bootcount(&val) != 0)
+        return HISTORY_NO_VALUE;
+    return val;
+}
+
+void oplog_append(enum history_op op, const struct platform *plat,
+                  int32_t old_val, int32_t new_val, int result)
+{
+    pmsg_emit(op, plat, old_val, new_val, result);
+    history_append(op, plat, old_val, new_val, result);
+}
+
+int oplog_write(const struct platform *plat, enum history_op op, uint16_t val)
+{
+    DEBUG_PRINTF("Write %d\n", val);
+    int32_t old_val = oplog_prior_value(plat);
+    int err = plat->write_bootcount(val);
+    oplog_append(op, plat, old_val, val, err);
+    if (err == 0)
+        bootid_marker_clear();
+    return err;
+}
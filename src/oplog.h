@@ -0,0 +1,42 @@
+/**
+ * Operation records, fanned out to the optional history file and pmsg
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "history.h"
+#include "platform.h"
+
+/*
+ * The value a write is about to replace, read only if some record sink is
+ * enabled.  Returns HISTORY_NO_VALUE otherwise or if unreadable.
+ */
+int32_t oplog_prior_value(const struct platform *plat);
+
+/* Record one operation in every enabled sink.  plat may be NULL (failed detection). */
+void oplog_append(enum history_op op, const struct platform *plat,
+                  int32_t old_val, int32_t new_val, int result);
+
+/*
+ * Write val with the bookkeeping every writer shares: record it with the
+ * value it replaces and, once written, forget the --once marker, which no
+ * longer describes the stored value.
+ */
+int oplog_write(const struct platform *plat, enum history_op op, uint16_t val);
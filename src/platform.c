@@ -0,0 +1,391 @@
+/**
+ * Platform (bootcount backend) table and detection
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "am33xx.h"
+#include "imx8m.h"
+#include "imx93.h"
+#include "stm32mp1.h"
+#include "i2c_eeprom.h"
+#include "dm_eeprom.h"
+#include "dm_rtc.h"
+#include "emulate.h"
+#include "i2c_dev.h"
+#include "fs_file.h"
+#include "ram.h"
+#include "platform.h"
+#include "coalesce.h"
+#include "quorum.h"
+#include "trace.h"
+#include "uevent.h"
+
+static long elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+/*
+ * A backend left out with ./configure --with-backends keeps its slot, so
+ * history and pmsg records name the same backend in every build.
+ */
+static bool backend_omitted(void) {
+    return false;
+}
+#define BACKEND_OMITTED(plat_name) {.name = plat_name, .detect = backend_omitted}
+
+const struct platform platforms[] = {
+#ifdef BACKEND_EMULATE
+    {.name = EMULATE_REG_NAME,
+     .max = UINT16_MAX,
+     .detect = emulate_reg_exists,
+     .read_bootcount = emulate_reg_read_bootcount,
+     .write_bootcount = emulate_reg_write_bootcount
+    },
+#else
+    BACKEND_OMITTED(EMULATE_REG_NAME),
+#endif
+#ifdef BACKEND_EMULATE
+    {.name = EMULATE_EEPROM_NAME,
+     .max = UINT8_MAX,
+     .detect = emulate_eeprom_exists,
+     .read_bootcount = emulate_eeprom_read_bootcount,
+     .write_bootcount = emulate_eeprom_write_bootcount,
+     .nvmem_cell = emulate_eeprom_nvmem_cell
+    },
+#else
+    BACKEND_OMITTED(EMULATE_EEPROM_NAME),
+#endif
+#ifdef BACKEND_AM33XX
+    {.name = AM33_PLAT_NAME,
+     .max = UINT16_MAX,
+     .detect = is_am33,
+     .read_bootcount = am33_read_bootcount,
+     .write_bootcount = am33_write_bootcount,
+     .read_reset_cause = am33_read_reset_cause
+    },
+#else
+    BACKEND_OMITTED(AM33_PLAT_NAME),
+#endif
+#ifdef BACKEND_IMX8M
+    {.name = IMX8M_PLAT_NAME,
+     .max = UINT16_MAX,
+     .detect = is_imx8m,
+     .read_bootcount = imx8m_read_bootcount,
+     .write_bootcount = imx8m_write_bootcount,
+     .read_reset_cause = imx8m_read_reset_cause
+    },
+#else
+    BACKEND_OMITTED(IMX8M_PLAT_NAME),
+#endif
+#ifdef BACKEND_IMX93
+    {.name = IMX93_PLAT_NAME,
+     .max = UINT16_MAX,
+     .detect = is_imx93,
+     .read_bootcount = imx93_read_bootcount,
+     .write_bootcount = imx93_write_bootcount
+    },
+#else
+    BACKEND_OMITTED(IMX93_PLAT_NAME),
+#endif
+#ifdef BACKEND_STM32MP1
+    {.name = STM32MP1_PLAT_NAME,
+     .max = UINT16_MAX,
+     .detect = is_stm32mp1,
+     .read_bootcount = stm32mp1_read_bootcount,
+     .write_bootcount = stm32mp1_write_bootcount,
+     .read_reset_cause = stm32mp1_read_reset_cause
+    },
+#else
+    BACKEND_OMITTED(STM32MP1_PLAT_NAME),
+#endif
+#ifdef BACKEND_DM_EEPROM
+    {.name = DM_EEPROM_NAME,
+     .max = UINT8_MAX,
+     .detect = dm_eeprom_exists,
+     .expected = dm_eeprom_expected,
+     .read_bootcount = dm_eeprom_read_bootcount,
+     .write_bootcount = dm_eeprom_write_bootcount,
+     .nvmem_cell = dm_eeprom_nvmem_cell
+    },
+#else
+    BACKEND_OMITTED(DM_EEPROM_NAME),
+#endif
+#ifdef BACKEND_DM_RTC
+    {.name = DM_RTC_NAME,
+     .max = UINT8_MAX,
+     .detect = dm_rtc_exists,
+     .expected = dm_rtc_expected,
+     .read_bootcount = dm_rtc_read_bootcount,
+     .write_bootcount = dm_rtc_write_bootcount,
+     .nvmem_cell = dm_rtc_nvmem_cell
+    },
+#else
+    BACKEND_OMITTED(DM_RTC_NAME),
+#endif
+#ifdef BACKEND_I2C_DEV
+    {.name = I2C_DEV_NAME,
+     .max = UINT8_MAX,
+     .detect = i2c_dev_exists,
+     .read_bootcount = i2c_dev_read_bootcount,
+     .write_bootcount = i2c_dev_write_bootcount
+    },
+#else
+    BACKEND_OMITTED(I2C_DEV_NAME),
+#endif
+#ifdef BACKEND_I2C_EEPROM
+    {.name = EEPROM_NAME,
+     .max = UINT8_MAX,
+     .detect = eeprom_exists,
+     .read_bootcount = eeprom_read_bootcount,
+     .write_bootcount = eeprom_write_bootcount
+    },
+#else
+    BACKEND_OMITTED(EEPROM_NAME),
+#endif
+#ifdef BACKEND_FS_FILE
+    {.name = FS_FILE_NAME,
+     .max = UINT8_MAX,
+     .detect = fs_file_exists,
+     .expected = fs_file_expected,
+     .read_bootcount = fs_file_read_bootcount,
+     .write_bootcount = fs_file_write_bootcount
+    },
+#else
+    BACKEND_OMITTED(FS_FILE_NAME),
+#endif
+#ifdef BACKEND_RAM
+    {.name = RAM_NAME,
+     .max = UINT16_MAX,
+     .detect = ram_exists,
+     .read_bootcount = ram_read_bootcount,
+     .write_bootcount = ram_write_bootcount
+    },
+#else
+    BACKEND_OMITTED(RAM_NAME),
+#endif
+    {.name = NULL} /* sentinel */
+};
+
+uint8_t platform_index(const struct platform *plat) {
+    if (!plat)
+        return PLATFORM_INDEX_NONE;
+    /* coalesced writes are recorded against the backend they end up on */
+    if (coalesce_inner(plat))
+        plat = coalesce_inner(plat);
+    for (uint8_t i = 0; platforms[i].name; i++) {
+        if (plat == &platforms[i])
+            return i;
+    }
+    /* the only other platform outside the table is the --all set */
+    return PLATFORM_INDEX_ALL;
+}
+
+const char *platform_index_name(uint8_t idx) {
+    if (idx == PLATFORM_INDEX_ALL)
+        return QUORUM_NAME;
+    for (uint8_t i = 0; platforms[i].name; i++) {
+        if (i == idx)
+            return platforms[i].name;
+    }
+    return NULL;
+}
+
+int platform_probe_step(int *next, const struct platform **plat) {
+    int i = (*next)++;
+
+    if (platforms[i].detect()) {
+        trace_event(TRACE_DETECT, NULL, 0, i, 0);
+        *plat = &platforms[i];
+        return 0;
+    }
+    trace_event(TRACE_DETECT, NULL, 0, i, E_PLATFORM_UNKNOWN);
+    return platforms[*next].name ? 1 : E_PLATFORM_UNKNOWN;
+}
+
+/* Try each platform in order, without printing anything */
+const struct platform *platform_probe(void) {
+    const struct platform *plat = NULL;
+    int next = 0;
+
+    while (platform_probe_step(&next, &plat) > 0)
+        ;
+    return plat;
+}
+
+static int detected(const struct platform *plat, const struct platform **platform, bool verbose) {
+    if (platform)
+        *platform = plat;
+
+    if (verbose)
+        printf("Detected %s\n", plat->name);
+
+    return 0;
+}
+
+static int unknown_platform(void) {
+    const struct platform *plat;
+    int i;
+
+    fprintf(stderr, "Warning: unknown platform\n");
+    fprintf(stderr, "Current support is for:\n");
+    for (i = 0; platforms[i].name; i++) {
+        plat = &platforms[i];
+        if (plat->detect == backend_omitted)
+            continue;
+        fprintf(stderr, " * %s", plat->name);
+        if (!strcmp(plat->name, EEPROM_NAME))
+            fprintf(stderr, " at " EEPROM_PATH,
+                    DEFAULT_I2C_BUS, DEFFAULT_I2C_ADDR);
+        else if (plat->detect == emulate_reg_exists || plat->detect == emulate_eeprom_exists)
+            fprintf(stderr, " (set " EMULATE_ENV ")");
+        else if (plat->detect == fs_file_exists)
+            fprintf(stderr, " (set " FS_FILE_ENV ")");
+
+        fprintf(stderr, "\n");
+    }
+
+    return E_PLATFORM_UNKNOWN;
+}
+
+int platform_detect(const struct platform **platform, bool verbose) {
+    const struct platform *plat = platform_probe();
+
+    if (plat)
+        return detected(plat, platform, verbose);
+
+    return unknown_platform();
+}
+
+int platform_detect_all(const struct platform **list, int max, bool verbose) {
+    int i, n = 0;
+
+    for (i = 0; platforms[i].name && n < max; i++) {
+        if (!platforms[i].detect()) {
+            trace_event(TRACE_DETECT, NULL, 0, i, E_PLATFORM_UNKNOWN);
+            continue;
+        }
+        trace_event(TRACE_DETECT, NULL, 0, i, 0);
+        if (verbose)
+            printf("Detected %s\n", platforms[i].name);
+        list[n++] = &platforms[i];
+    }
+    if (n == 0)
+        return unknown_platform();
+    return n;
+}
+
+/* True if the device tree names a bootcount device that has not appeared yet */
+static bool platform_expected(void) {
+    int i;
+
+    for (i = 0; platforms[i].name; i++) {
+        if (platforms[i].expected && platforms[i].expected()) {
+            DEBUG_PRINTF("Waiting for %s\n", platforms[i].name);
+            return true;
+        }
+    }
+    return false;
+}
+
+int platform_detect_wait(const struct platform **platform, bool verbose, int timeout_ms) {
+    struct timespec start;
+    const struct platform *plat = platform_probe();
+
+    if (plat)
+        return detected(plat, platform, verbose);
+    if (!platform_expected())
+        return unknown_platform();
+
+    /* Subscribe first, then probe again, so a device that appears in between is not missed */
+    int fd = uevent_open();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        plat = platform_probe();
+        if (plat) {
+            trace_event(TRACE_WAIT, NULL, 0, (uint32_t)elapsed_ms(&start), 0);
+            DEBUG_PRINTF("Device appeared after %ld ms\n", elapsed_ms(&start));
+            uevent_close(fd);
+            return detected(plat, platform, verbose);
+        }
+
+        long remaining = timeout_ms - elapsed_ms(&start);
+        if (remaining <= 0)
+            break;
+        uevent_wait(fd, remaining);
+    }
+
+    trace_event(TRACE_WAIT, NULL, 0, (uint32_t)elapsed_ms(&start), E_PLATFORM_UNKNOWN);
+    uevent_close(fd);
+    fprintf(stderr, "Timed out after %d ms waiting for the bootcount device\n", timeout_ms);
+    return unknown_platform();
+}
+
+int platform_increment(const struct platform *plat, uint16_t *val) {
+    uint16_t cur = 0;
+    int err = plat->read_bootcount(&cur);
+
+    if (err == E_BADMAGIC) {
+        DEBUG_PRINTF("Blank counter, incrementing from 0\n");
+        cur = 0;
+    } else if (err != 0) {
+        return err;
+    }
+
+    if (cur >= plat->max) {
+        DEBUG_PRINTF("Counter saturated at %u\n", cur);
+        *val = cur;
+        return 0;
+    }
+
+    err = plat->write_bootcount(cur + 1);
+    if (err == 0)
+        *val = cur + 1;
+    return err;
+}
+
+int platform_cas(const struct platform *plat, uint16_t old_val, uint16_t new_val, uint16_t *val) {
+    uint16_t cur = 0;
+    int err;
+
+    if (new_val > plat->max)
+        return E_INVALID;
+
+    err = plat->read_bootcount(&cur);
+    if (err != 0)
+        return err;
+    *val = cur;
+    if (cur != old_val) {
+        DEBUG_PRINTF("Compare failed: expected %u, read %u\n", old_val, cur);
+        return E_MISMATCH;
+    }
+
+    err = plat->write_bootcount(new_val);
+    if (err == 0)
+        *val = new_val;
+    return err;
+}
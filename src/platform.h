@@ -0,0 +1,91 @@
+/**
+ * Platform (bootcount backend) table and detection
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct reset_cause;
+
+struct platform {
+    const char *name;
+    bool (*detect)();
+    /* optional: true if the device tree says this device should exist, even
+       though detect() failed (e.g. its driver has not probed yet) */
+    bool (*expected)(void);
+    /* largest value the backend can store; -i saturates here */
+    uint16_t max;
+    int (*read_bootcount)(uint16_t *val);
+    int (*write_bootcount)(uint16_t val);
+    /* optional: SoC reset-status register, see reset_cause.h */
+    int (*read_reset_cause)(struct reset_cause *rc, bool clear);
+    /* optional: file and offset of the U-Boot cell in an nvmem/EEPROM sysfs
+       file, and the DT bootcount node (or NULL), for the named counters */
+    bool (*nvmem_cell)(const char **path, off_t *offset, const char **node);
+};
+
+extern const struct platform platforms[];
+
+/* Compact backend ids for the history and pmsg records */
+#define PLATFORM_INDEX_NONE 0xff
+#define PLATFORM_INDEX_ALL 0xfe     /* every backend together (--all) */
+
+/* Index of plat in platforms[], or one of the ids above */
+uint8_t platform_index(const struct platform *plat);
+
+/* Name for an id from platform_index(), or NULL if out of range */
+const char *platform_index_name(uint8_t idx);
+
+/* Find the first platform whose detect() succeeds.  Returns 0 or E_PLATFORM_UNKNOWN. */
+int platform_detect(const struct platform **platform, bool verbose);
+
+/* Try each platform in order without printing anything.  Returns NULL if none matched. */
+const struct platform *platform_probe(void);
+
+/*
+ * One step of platform_probe(): run the detect() of platforms[*next] and
+ * advance *next, which starts at 0.  Returns 0 with *plat set on a match,
+ * 1 if more platforms remain, or E_PLATFORM_UNKNOWN after the last one.
+ */
+int platform_probe_step(int *next, const struct platform **plat);
+
+/*
+ * Detect every available platform, not just the first, in platforms[] order.
+ * Returns how many were stored in list, or E_PLATFORM_UNKNOWN.
+ */
+int platform_detect_all(const struct platform **list, int max, bool verbose);
+
+/*
+ * Like platform_detect(), but if the device tree names a bootcount device
+ * that is not there yet, wait up to timeout_ms for it to appear.
+ */
+int platform_detect_wait(const struct platform **platform, bool verbose, int timeout_ms);
+
+/*
+ * Read-modify-write helpers.  Callers serialize them across processes with
+ * bootcount_lock().  Both store the resulting value in *val.
+ */
+
+/* Add one, saturating at plat->max.  A blank counter (bad magic) counts as 0, as in U-Boot. */
+int platform_increment(const struct platform *plat, uint16_t *val);
+
+/* Write new_val only if the counter holds old_val.  Returns E_MISMATCH otherwise. */
+int platform_cas(const struct platform *plat, uint16_t old_val, uint16_t new_val, uint16_t *val);
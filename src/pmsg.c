@@ -0,0 +1,207 @@
+/**
+ * Boot-event records in pstore pmsg
+ *
+ * pstore's /dev/pmsg0 lands in the ramoops region, which survives a warm
+ * reset just like the SoC scratch registers, and after the reboot the
+ * kernel shows it as /sys/fs/pstore/pmsg-ramoops-0.  With
+ * BOOTCOUNT_PMSG=/dev/pmsg0 each operation and detection emits one
+ * fixed-size, preformatted 44-byte record with a single write(), so the
+ * boot path cost is one syscall:
+ *
+ *   0  magic "BCPM"       16 CLOCK_BOOTTIME ms (le64)
+ *   4  version            24 boot_id (16 bytes)
+ *   5  op                 40 CRC-32 of bytes 0-39 (le32)
+ *   6  backend index
+ *   7  result (int8)
+ *   8  flags: 1 = old value valid, 2 = new value valid
+ *   9  reserved
+ *  10  old value (le16)
+ *  12  new value (le16)
+ *  14  reserved
+ *
+ * Other programs may share pmsg, so the reader scans for the magic and
+ * accepts a record only if its CRC matches.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "bootid.h"
+#include "crc32.h"
+#include "pmsg.h"
+
+#define PMSG_HAS_OLD 0x01
+#define PMSG_HAS_NEW 0x02
+#define PMSG_MAX_FILE (1024 * 1024)
+
+static int g_fd = -1;
+
+static void put_le(uint8_t *p, uint64_t v, int len)
+{
+    for (int i = 0; i < len; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, int len)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < len; i++)
+        v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+bool pmsg_enabled(void)
+{
+    const char *path = getenv(PMSG_ENV);
+    return path && *path;
+}
+
+void pmsg_emit(enum history_op op, const struct platform *plat,
+               int32_t old_val, int32_t new_val, int result)
+{
+    uint8_t rec[PMSG_RECORD_SIZE] = { 0 };
+    struct timespec ts;
+
+    if (!pmsg_enabled())
+        return;
+    if (g_fd < 0) {
+        const char *path = getenv(PMSG_ENV);
+        g_fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (g_fd < 0) {
+            DEBUG_PRINTF("pmsg: cannot open %s (%s)\n", path, strerror(errno));
+            return;
+        }
+    }
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    memcpy(rec, PMSG_MAGIC, 4);
+    rec[4] = PMSG_VERSION;
+    rec[5] = (uint8_t)op;
+    rec[6] = platform_index(plat);
+    rec[7] = (uint8_t)(int8_t)result;
+    rec[8] = (old_val >= 0 ? PMSG_HAS_OLD : 0) | (new_val >= 0 ? PMSG_HAS_NEW : 0);
+    put_le(rec + 10, old_val >= 0 ? (uint16_t)old_val : 0, 2);
+    put_le(rec + 12, new_val >= 0 ? (uint16_t)new_val : 0, 2);
+    put_le(rec + 16, (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000, 8);
+    bootid_read_raw(rec + 24);
+    put_le(rec + 40, crc32(0, rec, 40), 4);
+
+    if (write(g_fd, rec, sizeof(rec)) != (ssize_t)sizeof(rec))
+        DEBUG_PRINTF("pmsg: write failed (%s)\n", strerror(errno));
+}
+
+static const char *backend_name(uint8_t idx)
+{
+    const char *name = platform_index_name(idx);
+    return name ? name : "-";
+}
+
+static void print_value(FILE *out, bool valid, unsigned val)
+{
+    if (valid)
+        fprintf(out, "%u", val);
+    else
+        fprintf(out, "-");
+}
+
+/* Scan one pstore file.  *last is set to the newest record's resulting value, if any. */
+static int scan_file(const char *path, FILE *out, int32_t *last, unsigned *count)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return E_DEVICE;
+    }
+    uint8_t *buf = malloc(PMSG_MAX_FILE);
+    if (!buf) {
+        close(fd);
+        return E_DEVICE;
+    }
+    ssize_t len = 0, r;
+    while (len < PMSG_MAX_FILE && (r = read(fd, buf + len, PMSG_MAX_FILE - len)) > 0)
+        len += r;
+    close(fd);
+
+    for (ssize_t i = 0; i + PMSG_RECORD_SIZE <= len; i++) {
+        const uint8_t *rec = buf + i;
+        if (memcmp(rec, PMSG_MAGIC, 4) != 0 || rec[4] != PMSG_VERSION ||
+            get_le(rec + 40, 4) != crc32(0, rec, 40))
+            continue;
+
+        uint64_t up_ms = get_le(rec + 16, 8);
+        bool has_old = rec[8] & PMSG_HAS_OLD, has_new = rec[8] & PMSG_HAS_NEW;
+        const char *op = history_op_name(rec[5]);
+
+        fprintf(out, "boot=%02x%02x%02x%02x up=%lu.%03lus %-9s ", rec[24], rec[25], rec[26], rec[27],
+                (unsigned long)(up_ms / 1000), (unsigned long)(up_ms % 1000), op);
+        print_value(out, has_old, (unsigned)get_le(rec + 10, 2));
+        fprintf(out, " -> ");
+        print_value(out, has_new, (unsigned)get_le(rec + 12, 2));
+        fprintf(out, " rc=%d (%s)\n", (int8_t)rec[7], backend_name(rec[6]));
+
+        /* a failed CAS records the value it wanted, not the one stored */
+        if (has_new && rec[7] == 0)
+            *last = (int32_t)get_le(rec + 12, 2);
+        (*count)++;
+        i += PMSG_RECORD_SIZE - 1;
+    }
+    free(buf);
+    return 0;
+}
+
+int pmsg_print(const char *path, const struct platform *plat, FILE *out)
+{
+    int32_t last = HISTORY_NO_VALUE;
+    unsigned count = 0;
+    int err = 0;
+
+    if (path) {
+        err = scan_file(path, out, &last, &count);
+    } else {
+        glob_t g;
+        if (glob(PMSG_PSTORE_GLOB, 0, NULL, &g) != 0) {
+            fprintf(stderr, "No pmsg records in " PMSG_PSTORE_GLOB "\n");
+            return E_DEVICE;
+        }
+        for (size_t i = 0; i < g.gl_pathc && err == 0; i++)
+            err = scan_file(g.gl_pathv[i], out, &last, &count);
+        globfree(&g);
+    }
+    if (err)
+        return err;
+
+    fprintf(out, "%u records\n", count);
+
+    /* U-Boot increments the counter on every boot attempt after the last record */
+    uint16_t cur;
+    if (plat && last >= 0 && plat->read_bootcount(&cur) == 0)
+        fprintf(out, "last recorded %ld, current %u (%ld boot attempts since)\n",
+                (long)last, cur, (long)cur - last);
+    return 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * Boot-event records in pstore pmsg
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "history.h"
+#include "platform.h"
+
+/* Set BOOTCOUNT_PMSG to /dev/pmsg0 (or a regular file for testing) to emit records */
+#define PMSG_ENV "BOOTCOUNT_PMSG"
+/* Where pstore shows the previous boot's pmsg buffer */
+#define PMSG_PSTORE_GLOB "/sys/fs/pstore/pmsg-ramoops-*"
+
+#define PMSG_MAGIC "BCPM"
+#define PMSG_VERSION 1
+#define PMSG_RECORD_SIZE 44
+
+bool pmsg_enabled(void);
+
+/* Emit one record with a single write().  plat may be NULL (failed detection). */
+void pmsg_emit(enum history_op op, const struct platform *plat,
+               int32_t old_val, int32_t new_val, int result);
+
+/*
+ * Print the records found in path, or in every PMSG_PSTORE_GLOB file if path
+ * is NULL.  If plat is given, compare the last recorded value with the
+ * current counter.  Returns 0 or an E_* code.
+ */
+int pmsg_print(const char *path, const struct platform *plat, FILE *out);
@@ -0,0 +1,272 @@
+/**
+ * Redundant storage across every detected backend
+ *
+ * A board may have several places U-Boot can keep the bootcount, e.g. an
+ * SoC backup register and an RTC.  With --all every one of them is used:
+ * each operation runs on all backends at once, one thread per backend, so
+ * a write takes about as long as the slowest device rather than the sum.
+ * The set is exposed as one more struct platform, so every action, --batch
+ * and the read-modify-write helpers work on it unchanged.
+ *
+ * Backends that are different paths to the same cell are not combined: the
+ * raw i2c-dev backend is a fallback for the DM EEPROM/RTC before its driver
+ * binds, and the legacy fixed-address EEPROM may be the DM EEPROM.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "dm_eeprom.h"
+#include "dm_rtc.h"
+#include "i2c_dev.h"
+#include "i2c_eeprom.h"
+#include "quorum.h"
+#include "reset_cause.h"
+
+#define QUORUM_STACK_SIZE (64 * 1024)
+
+static const struct platform *g_members[QUORUM_MAX];
+static int g_n = 0;
+static struct platform g_quorum;
+
+struct job {
+    const struct platform *plat;
+    uint16_t val;
+    int err;
+    long us;
+};
+
+static long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+static void *read_job(void *arg)
+{
+    struct job *j = arg;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    j->err = j->plat->read_bootcount(&j->val);
+    j->us = elapsed_us(&start);
+    return NULL;
+}
+
+static void *write_job(void *arg)
+{
+    struct job *j = arg;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    j->err = j->plat->write_bootcount(j->val);
+    j->us = elapsed_us(&start);
+    return NULL;
+}
+
+/* Run fn on every job: the first in this thread, the others in their own */
+static void run_jobs(struct job *jobs, void *(*fn)(void *))
+{
+    pthread_t tids[QUORUM_MAX];
+    bool started[QUORUM_MAX] = { false };
+    pthread_attr_t attr;
+
+    /* the jobs only make a few system calls; skip mapping default 8 MiB stacks */
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, QUORUM_STACK_SIZE);
+    for (int i = 1; i < g_n; i++)
+        started[i] = pthread_create(&tids[i], &attr, fn, &jobs[i]) == 0;
+    pthread_attr_destroy(&attr);
+    fn(&jobs[0]);
+    for (int i = 1; i < g_n; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        else
+            fn(&jobs[i]);
+    }
+}
+
+static void report(const struct job *jobs, const char *what, int chosen)
+{
+    fprintf(stderr, "Warning: backends %s:", what);
+    for (int i = 0; i < g_n; i++) {
+        if (jobs[i].err == 0)
+            fprintf(stderr, " %s=%u", jobs[i].plat->name, jobs[i].val);
+        else
+            fprintf(stderr, " %s=error %d", jobs[i].plat->name, jobs[i].err);
+    }
+    if (chosen >= 0)
+        fprintf(stderr, "; using %d", chosen);
+    fprintf(stderr, "\n");
+}
+
+static int quorum_read(uint16_t *val)
+{
+    struct job jobs[QUORUM_MAX];
+    struct timespec start;
+    int best = -1, best_votes = 0;
+
+    for (int i = 0; i < g_n; i++)
+        jobs[i] = (struct job){ .plat = g_members[i] };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_jobs(jobs, read_job);
+    DEBUG_PRINTF("Quorum read of %d backends in %ld us\n", g_n, elapsed_us(&start));
+
+    /* votes for each valid value; ties go to the more trusted (earlier) backend */
+    for (int i = 0; i < g_n; i++) {
+        int votes = 0;
+        if (jobs[i].err != 0)
+            continue;
+        for (int k = 0; k < g_n; k++)
+            votes += jobs[k].err == 0 && jobs[k].val == jobs[i].val;
+        if (votes > best_votes) {
+            best = i;
+            best_votes = votes;
+        }
+    }
+
+    if (best < 0) {
+        report(jobs, "have no valid value", -1);
+        /* a blank set reads like a blank device, so -i starts from 0 */
+        for (int i = 0; i < g_n; i++) {
+            if (jobs[i].err != E_BADMAGIC)
+                return jobs[i].err;
+        }
+        return E_BADMAGIC;
+    }
+    if (best_votes != g_n)
+        report(jobs, best_votes * 2 > g_n ? "disagree" : "disagree, no majority", jobs[best].val);
+    *val = jobs[best].val;
+    return 0;
+}
+
+static int quorum_write(uint16_t val)
+{
+    struct job jobs[QUORUM_MAX];
+    struct timespec start;
+    int err = 0;
+
+    for (int i = 0; i < g_n; i++)
+        jobs[i] = (struct job){ .plat = g_members[i], .val = val };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_jobs(jobs, write_job);
+    DEBUG_PRINTF("Quorum write of %d backends in %ld us\n", g_n, elapsed_us(&start));
+
+    for (int i = 0; i < g_n; i++) {
+        DEBUG_PRINTF(" %s: %ld us, rc=%d\n", jobs[i].plat->name, jobs[i].us, jobs[i].err);
+        if (jobs[i].err != 0) {
+            fprintf(stderr, "Warning: write to %s failed (Error %d)\n", jobs[i].plat->name, jobs[i].err);
+            if (err == 0)
+                err = jobs[i].err;
+        }
+    }
+    return err;
+}
+
+static int quorum_read_reset_cause(struct reset_cause *rc, bool clear)
+{
+    for (int i = 0; i < g_n; i++) {
+        if (g_members[i]->read_reset_cause)
+            return g_members[i]->read_reset_cause(rc, clear);
+    }
+    return E_INVALID;
+}
+
+static bool quorum_nvmem_cell(const char **path, off_t *offset, const char **node)
+{
+    for (int i = 0; i < g_n; i++) {
+        if (g_members[i]->nvmem_cell && g_members[i]->nvmem_cell(path, offset, node))
+            return true;
+    }
+    return false;
+}
+
+static bool detected(const struct platform **list, int n, const char *name)
+{
+    for (int i = 0; i < n; i++) {
+        if (strcmp(list[i]->name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Drop backends that reach a cell another detected backend already covers */
+static bool same_cell(const struct platform **list, int n, const struct platform *plat)
+{
+    bool dm = detected(list, n, DM_EEPROM_NAME) || detected(list, n, DM_RTC_NAME);
+
+    if (strcmp(plat->name, I2C_DEV_NAME) == 0)
+        return dm;
+    if (strcmp(plat->name, EEPROM_NAME) == 0)
+        return dm || detected(list, n, I2C_DEV_NAME);
+    return false;
+}
+
+int quorum_detect(const struct platform **platform, bool verbose, int wait_ms)
+{
+    const struct platform *all[QUORUM_MAX];
+    const struct platform *first;
+    int n, err;
+
+    /* wait for the first backend, as without --all; the rest are probed once */
+    if (wait_ms >= 0) {
+        err = platform_detect_wait(&first, false, wait_ms);
+        if (err)
+            return err;
+    }
+    n = platform_detect_all(all, QUORUM_MAX, false);
+    if (n < 0)
+        return n;
+
+    g_n = 0;
+    for (int i = 0; i < n; i++) {
+        if (same_cell(all, n, all[i])) {
+            DEBUG_PRINTF("Skipping %s, same cell as another backend\n", all[i]->name);
+            continue;
+        }
+        if (verbose)
+            printf("Detected %s\n", all[i]->name);
+        g_members[g_n++] = all[i];
+    }
+
+    g_quorum = (struct platform){
+        .name = QUORUM_NAME,
+        .max = UINT16_MAX,
+        .read_bootcount = quorum_read,
+        .write_bootcount = quorum_write,
+        .nvmem_cell = quorum_nvmem_cell,
+    };
+    /* the set saturates where its narrowest member does */
+    for (int i = 0; i < g_n; i++) {
+        if (g_members[i]->max < g_quorum.max)
+            g_quorum.max = g_members[i]->max;
+        if (g_members[i]->read_reset_cause)
+            g_quorum.read_reset_cause = quorum_read_reset_cause;
+    }
+    if (verbose)
+        printf("Using %d backend%s\n", g_n, g_n == 1 ? "" : "s");
+    *platform = &g_quorum;
+    return 0;
+}
@@ -0,0 +1,37 @@
+/**
+ * Redundant storage across every detected backend
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "platform.h"
+
+#define QUORUM_NAME "QUORUM"
+#define QUORUM_MAX 8
+
+/*
+ * Detect all backends and return a platform that reads and writes them
+ * together, in parallel: reads return the majority value (or, without a
+ * majority, the value of the most trusted backend, i.e. the earliest in
+ * platforms[]), writes go to every backend.  Disagreements and per-backend
+ * failures are reported on stderr.  If wait_ms >= 0, waits for the first
+ * backend like platform_detect_wait().
+ */
+int quorum_detect(const struct platform **platform, bool verbose, int wait_ms);
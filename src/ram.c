@@ -0,0 +1,250 @@
+/**
+ * Reserved-RAM bootcount backend
+ * Ref: https://github.com/u-boot/u-boot/blob/master/drivers/bootcount/bootcount_ram.c
+ *
+ * With CONFIG_BOOTCOUNT_RAM, U-Boot keeps the counter in DRAM that survives a
+ * warm reset, as an array of ulong:
+ *
+ *   [0]       counter (32 bits)
+ *   [1]       CONFIG_SYS_BOOTCOUNT_MAGIC
+ *   [3..1002] test pattern, checked for bit errors before the counter is
+ *             trusted
+ *
+ * Each entry takes a U-Boot ulong, so the stride is 8 bytes on 64-bit U-Boot,
+ * whatever the word size of this build (a 32-bit userland may run on a board
+ * with 64-bit U-Boot).  The stride comes from the node's u-boot,word-size
+ * property, else from whichever stride the stored pattern is intact at, else
+ * from the kernel's word size as reported by uname.  Linux must keep its hands
+ * off that region, so it is described by a reserved-memory node, which is how
+ * this backend finds it:
+ *
+ *    chosen {
+ *        u-boot,bootcount-device = &bootcount_ram;
+ *    };
+ *    reserved-memory {
+ *        #address-cells = <1>;
+ *        #size-cells = <1>;
+ *        ranges;
+ *        bootcount_ram: bootcount@9ffff000 {
+ *            compatible = "u-boot,bootcount-ram";
+ *            reg = <0x9ffff000 0x1000>;
+ *            u-boot,word-size = <4>;
+ *            no-map;
+ *        };
+ *    };
+ *
+ * Where userspace can clean the data cache (arm64, x86), the region is mapped
+ * cacheable: reads and the pattern check run at cache speed, and a write
+ * cleans just the lines it touched to DRAM, so U-Boot finds it after reset.
+ * Elsewhere (32-bit ARM) it is mapped uncached.  A no-map region is uncached
+ * either way, as the kernel maps memory outside its linear map that way.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/utsname.h>
+
+#include "constants.h"
+#include "dt.h"
+#include "memory.h"
+#include "ram.h"
+#include "trace.h"
+
+#define RAM_COMPAT "u-boot,bootcount-ram"
+
+/* from bootcount_ram.c */
+#define RAM_OFFS_PATTERN 3
+#define RAM_REPEAT_PATTERN 1000
+static const uint32_t patterns[] = { 0x00000000, 0xFFFFFFFF, 0xFF00FF00, 0x0F0F0F0F, 0xF0F0F0F0 };
+#define RAM_NBR_OF_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+/* U-Boot indexes a ulong array but writes 32-bit words; stride is in 32-bit words */
+#define RAM_LEN(stride) ((RAM_OFFS_PATTERN + RAM_REPEAT_PATTERN) * (stride) * sizeof(uint32_t))
+
+static bool g_inited = false;
+static uint64_t g_addr;
+static uint64_t g_size;
+static unsigned int g_stride = 0; /* 0 until known */
+static volatile uint32_t *g_mem = NULL;
+
+static bool discover_ram(void)
+{
+    if (g_inited)
+        return true;
+    DEBUG_PRINTF("Discovering reserved RAM bootcount region...\n");
+
+    char bc_node[PATH_MAX];
+    if (!dt_get_chosen_bootcount_node(RAM_COMPAT, bc_node, sizeof(bc_node)))
+        return false;
+    DEBUG_PRINTF(" Found bootcount node %s\n", bc_node);
+
+    if (!dt_node_read_reg(bc_node, &g_addr, &g_size)) {
+        DEBUG_PRINTF(" No usable reg property\n");
+        return false;
+    }
+    DEBUG_PRINTF(" Region 0x%llx, %llu bytes\n", (unsigned long long)g_addr, (unsigned long long)g_size);
+
+    uint32_t word_size;
+    if (dt_node_read_u32(bc_node, "u-boot,word-size", &word_size)) {
+        if (word_size != 4 && word_size != 8) {
+            DEBUG_PRINTF(" Bad u-boot,word-size %lu\n", (unsigned long)word_size);
+            return false;
+        }
+        g_stride = word_size / sizeof(uint32_t);
+        DEBUG_PRINTF(" U-Boot word size %lu\n", (unsigned long)word_size);
+    }
+    /* the smallest layout must fit; the actual one is checked once the stride is known */
+    if (g_size < RAM_LEN(g_stride ? g_stride : 1)) {
+        DEBUG_PRINTF(" Region is smaller than the %lu bytes U-Boot uses\n",
+                     (unsigned long)RAM_LEN(g_stride ? g_stride : 1));
+        return false;
+    }
+    g_inited = true;
+    return true;
+}
+
+static volatile uint32_t *word_at(unsigned int stride, unsigned int i)
+{
+    return g_mem + i * stride;
+}
+
+static volatile uint32_t *word(unsigned int i)
+{
+    return word_at(g_stride, i);
+}
+
+/* Index of the first pattern word that does not match at this stride, or RAM_REPEAT_PATTERN */
+static unsigned int pattern_intact_at(unsigned int stride)
+{
+    unsigned int i;
+    for (i = 0; i < RAM_REPEAT_PATTERN; i++) {
+        if (memory_read(word_at(stride, RAM_OFFS_PATTERN + i)) != patterns[i % RAM_NBR_OF_PATTERNS])
+            break;
+    }
+    return i;
+}
+
+static unsigned int pattern_intact(void)
+{
+    return pattern_intact_at(g_stride);
+}
+
+/* Stride of a blank region: U-Boot runs at the kernel's word size, not ours */
+static unsigned int kernel_stride(void)
+{
+    struct utsname u;
+    if (uname(&u) == 0) {
+        size_t n = strlen(u.machine);
+        if (n >= 2 && strcmp(u.machine + n - 2, "64") == 0)
+            return 2;
+    }
+    return 1;
+}
+
+/* Map once; later calls reuse the mapping */
+static int ram_map(void)
+{
+    if (g_mem)
+        return 0;
+    if (RAM_LEN(g_stride) > g_size)
+        return E_DEVICE;
+    /* without u-boot,word-size, map enough for either layout and look for the pattern */
+    size_t len = RAM_LEN(g_stride ? g_stride : (g_size >= RAM_LEN(2) ? 2 : 1));
+    void *mem = memory_can_clean() ? memory_open_cached((off_t)g_addr, len)
+                                   : memory_open((off_t)g_addr, len);
+    if (mem == (void *)E_DEVICE)
+        return E_DEVICE;
+    g_mem = mem;
+
+    if (!g_stride) {
+        if (len >= RAM_LEN(2) && pattern_intact_at(2) == RAM_REPEAT_PATTERN)
+            g_stride = 2;
+        else if (pattern_intact_at(1) == RAM_REPEAT_PATTERN)
+            g_stride = 1;
+        else
+            g_stride = kernel_stride();
+        DEBUG_PRINTF("U-Boot word size %u bytes\n", g_stride * (unsigned int)sizeof(uint32_t));
+        if (RAM_LEN(g_stride) > len) {
+            DEBUG_PRINTF("Region is smaller than the %lu bytes U-Boot uses\n", (unsigned long)RAM_LEN(g_stride));
+            g_mem = NULL; /* g_stride stays set, so later calls fail before mapping */
+            return E_DEVICE;
+        }
+    }
+    return 0;
+}
+
+bool ram_exists(void)
+{
+    return discover_ram();
+}
+
+int ram_read_bootcount(uint16_t *val)
+{
+    if (!discover_ram() || ram_map() != 0)
+        return E_DEVICE;
+
+    uint32_t counter = memory_read(word(0));
+    uint32_t magic = memory_read(word(1));
+    trace_event(TRACE_READ, "/dev/mem", (uint32_t)g_addr, counter, 0);
+
+    /* U-Boot reads a damaged pattern as 0; without the magic nothing was stored since power-on */
+    unsigned int intact = pattern_intact();
+    if (magic != BOOTCOUNT_MAGIC || intact != RAM_REPEAT_PATTERN) {
+        DEBUG_PRINTF("Magic 0x%08lx, pattern intact for %u words\n", (unsigned long)magic, intact);
+        trace_event(TRACE_BADMAGIC, "/dev/mem", (uint32_t)g_addr, magic, E_BADMAGIC);
+        return E_BADMAGIC;
+    }
+    *val = counter > UINT16_MAX ? UINT16_MAX : (uint16_t)counter;
+    return 0;
+}
+
+int ram_write_bootcount(uint16_t val)
+{
+    uint16_t cur_val;
+    int err = ram_read_bootcount(&cur_val);
+
+    if (err == 0 && cur_val == val) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", val);
+        trace_event(TRACE_SKIP, "/dev/mem", (uint32_t)g_addr, cur_val, 0);
+        return 0;
+    }
+    if (err != 0 && err != E_BADMAGIC)
+        return err;
+
+    /* the pattern only needs rewriting after a cold boot, i.e. when it is broken */
+    size_t len = 2 * g_stride * sizeof(uint32_t);
+    memory_write(word(0), val);
+    memory_write(word(1), BOOTCOUNT_MAGIC);
+    if (err == E_BADMAGIC) {
+        for (unsigned int i = 0; i < RAM_REPEAT_PATTERN; i++)
+            memory_write(word(RAM_OFFS_PATTERN + i), patterns[i % RAM_NBR_OF_PATTERNS]);
+        len = RAM_LEN(g_stride);
+    }
+    if (memory_can_clean())
+        memory_clean(g_mem, len);
+    trace_event(TRACE_WRITE, "/dev/mem", (uint32_t)g_addr, val, 0);
+
+    if (ram_read_bootcount(&cur_val) != 0 || cur_val != val) {
+        trace_event(TRACE_VERIFY, "/dev/mem", (uint32_t)g_addr, cur_val, E_WRITE_FAILED);
+        return E_WRITE_FAILED;
+    }
+    return 0;
+}
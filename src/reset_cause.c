@@ -0,0 +1,84 @@
+/**
+ * SoC reset-status registers
+ *
+ * The SoCs with a register bootcount also latch why they were last reset in
+ * a status register next to the blocks we already map.  The bits are sticky
+ * and write-one-to-clear on every supported part, so one helper serves all
+ * of them; each SoC file only provides the address and its bit table.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "constants.h"
+#include "memory.h"
+#include "reset_cause.h"
+#include "trace.h"
+
+int reset_cause_read_reg(off_t phys_addr, const struct reset_flag *flags, bool clear,
+                         struct reset_cause *rc)
+{
+    volatile uint32_t *reg = memory_open(phys_addr, sizeof(uint32_t));
+    if (reg == (void *)E_DEVICE)
+        return E_DEVICE;
+
+    rc->raw = memory_read(reg);
+    rc->flags = flags;
+    rc->cleared = false;
+    trace_event(TRACE_READ, "/dev/mem", (uint32_t)phys_addr, rc->raw, 0);
+
+    if (clear && rc->raw) {
+        memory_write(reg, rc->raw);
+        trace_event(TRACE_WRITE, "/dev/mem", (uint32_t)phys_addr, rc->raw, 0);
+        rc->cleared = true;
+        DEBUG_PRINTF("Cleared reset status 0x%08lx, now 0x%08lx\n",
+                     (unsigned long)rc->raw, (unsigned long)memory_read(reg));
+    }
+    return 0;
+}
+
+void reset_cause_print(const struct reset_cause *rc, FILE *out, bool json)
+{
+    const struct reset_flag *f;
+    const char *sep = "";
+
+    if (json) {
+        fprintf(out, "\"reset_raw\":%lu,\"reset_cause\":[", (unsigned long)rc->raw);
+        for (f = rc->flags; f->mask; f++) {
+            if (rc->raw & f->mask) {
+                fprintf(out, "%s{\"flag\":\"%s\",\"cause\":\"%s\"}", sep, f->name, f->cause);
+                sep = ",";
+            }
+        }
+        fprintf(out, "],\"reset_cleared\":%s", rc->cleared ? "true" : "false");
+        return;
+    }
+
+    fprintf(out, "Reset cause:");
+    for (f = rc->flags; f->mask; f++) {
+        if (rc->raw & f->mask) {
+            fprintf(out, "%s %s (%s)", sep, f->cause, f->name);
+            sep = ",";
+        }
+    }
+    if (*sep == '\0')
+        fprintf(out, " unknown");
+    fprintf(out, " [0x%08lx]%s\n", (unsigned long)rc->raw, rc->cleared ? " cleared" : "");
+}
@@ -0,0 +1,48 @@
+/**
+ * SoC reset-status registers
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* One status bit of a reset-status register */
+struct reset_flag {
+    uint32_t mask;
+    const char *name;       /* the reference manual's bit name */
+    const char *cause;      /* power-on, watchdog, thermal, software, external, ... */
+};
+
+struct reset_cause {
+    uint32_t raw;
+    const struct reset_flag *flags;     /* table of the SoC, terminated by mask 0 */
+    bool cleared;
+};
+
+/*
+ * Read the write-one-to-clear status register at phys_addr through the
+ * shared /dev/mem session, and clear the bits that were set if asked to.
+ */
+int reset_cause_read_reg(off_t phys_addr, const struct reset_flag *flags, bool clear,
+                         struct reset_cause *rc);
+
+/* "Reset cause: watchdog (WDT1_RST)" or a JSON object member list */
+void reset_cause_print(const struct reset_cause *rc, FILE *out, bool json);
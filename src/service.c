@@ -0,0 +1,317 @@
+/**
+ * Resident service mode
+ *
+ * For supervisors that must reset or force the bootcount within a deadline
+ * after a watchdog decision, even when the system is short of CPU and
+ * memory, `bootcount --serve[=<fifo>]` stays resident and takes --batch
+ * commands (read, set, reset, force, inc, ...) one per line:
+ *
+ *   - the backend is detected and read once at startup, which opens its
+ *     nvmem/EEPROM fd or maps and touches its /dev/mem page;
+ *   - buffers are static, stdout gets a static buffer, and the stack is
+ *     prefaulted before mlockall(MCL_CURRENT | MCL_FUTURE), so no command
+ *     takes a page fault or allocates;
+ *   - optionally the process runs SCHED_FIFO (--rt) pinned to one CPU (--cpu);
+ *   - the loop sleeps in poll() on the command fd and a signalfd, so
+ *     SIGTERM/SIGINT end it between commands.
+ *
+ * With --coalesce, writes are merged in memory and flushed once per window
+ * (see coalesce.c); "flush" writes the pending value now and "coalesced"
+ * prints how many backend writes were avoided.
+ *
+ * A FIFO is opened read-write so the service never sees EOF when a writer
+ * goes away.  Besides the batch commands, "latency" prints the time from
+ * the wakeup for a command to its completion (hardware write included) in
+ * us: count, min, avg and max since startup.  The wakeup delay itself can
+ * only be seen by the sender (bench/fifostat.c).
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "batch.h"
+#include "coalesce.h"
+#include "lock.h"
+#include "service.h"
+
+#define SERVICE_LINE_MAX 128
+#define SERVICE_STACK_PREFAULT (64 * 1024)
+#define SERVICE_FLUSH_TRIES 3
+#define SERVICE_FLUSH_RETRY_MS 20
+
+static char g_in[SERVICE_LINE_MAX * 16];
+static size_t g_in_len = 0;
+static char g_stdout_buf[4096];
+
+static struct {
+    unsigned long count;
+    unsigned long min_us;
+    unsigned long max_us;
+    unsigned long long total_us;
+} g_latency = { .min_us = ~0ul };
+
+static unsigned long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - start->tv_sec) * 1000000L +
+                           (now.tv_nsec - start->tv_nsec) / 1000L);
+}
+
+/* Touch the stack we will use so those pages are resident before mlockall() */
+static void prefault_stack(void)
+{
+    volatile char stack[SERVICE_STACK_PREFAULT];
+    memset((char *)stack, 0, sizeof(stack));
+}
+
+static void setup_realtime(const struct service_opts *opts)
+{
+    if (opts->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(opts->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            fprintf(stderr, "Warning: cannot pin to CPU %d (%s)\n", opts->cpu, strerror(errno));
+    }
+    if (opts->rt_prio > 0) {
+        struct sched_param sp = { .sched_priority = opts->rt_prio };
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0)
+            fprintf(stderr, "Warning: cannot set SCHED_FIFO %d (%s)\n", opts->rt_prio, strerror(errno));
+    }
+
+    prefault_stack();
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "Warning: mlockall failed (%s)\n", strerror(errno));
+}
+
+static int open_input(const char *path)
+{
+    struct stat st;
+
+    if (!path)
+        return STDIN_FILENO;
+    if (stat(path, &st) != 0 && mkfifo(path, 0600) != 0) {
+        fprintf(stderr, "Cannot create FIFO %s (%s)\n", path, strerror(errno));
+        return E_INVALID;
+    }
+    /* read-write: a FIFO with no writer left would otherwise read EOF forever */
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        fprintf(stderr, "Cannot open %s (%s)\n", path, strerror(errno));
+    return fd < 0 ? E_INVALID : fd;
+}
+
+static void service_flush(void)
+{
+    if (coalesce_due_ms() < 0)
+        return;
+    int lock_fd = bootcount_lock();
+    coalesce_flush();
+    bootcount_unlock(lock_fd);
+}
+
+/* At exit there is no next window: retry a failed flush a few times */
+static void service_final_flush(void)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = SERVICE_FLUSH_RETRY_MS * 1000000L };
+
+    for (int i = 0; i < SERVICE_FLUSH_TRIES && coalesce_due_ms() >= 0; i++) {
+        if (i > 0)
+            nanosleep(&ts, NULL);
+        service_flush();
+    }
+}
+
+/* Commands of the service itself; returns false for a batch command */
+static bool service_builtin(const char *cmd)
+{
+    if (strcmp(cmd, "latency") == 0) {
+        printf("count=%lu min_us=%lu avg_us=%lu max_us=%lu\n", g_latency.count,
+               g_latency.count ? g_latency.min_us : 0,
+               g_latency.count ? (unsigned long)(g_latency.total_us / g_latency.count) : 0,
+               g_latency.max_us);
+        return true;
+    }
+    if (strcmp(cmd, "flush") == 0) {
+        int lock_fd = bootcount_lock();
+        int err = coalesce_flush();
+        bootcount_unlock(lock_fd);
+        if (err != 0)
+            printf("Error %d\n", err);
+        else
+            printf("OK\n");
+        return true;
+    }
+    if (strcmp(cmd, "coalesced") == 0) {
+        const struct coalesce_stats *st = coalesce_stats();
+        printf("requests=%lu writes=%lu failed=%lu avoided=%lu pending=%lu overwritten=%lu\n",
+               st->requests, st->writes, st->failed, st->avoided, st->pending, st->overwritten);
+        return true;
+    }
+    return false;
+}
+
+static void service_command(const struct platform *plat, char *line, const struct timespec *arrival)
+{
+    char *p = line + strspn(line, " \t\r");
+
+    if (*p == '\0' || *p == '#')
+        return;
+    size_t len = strcspn(p, " \t\r");
+    if (p[len + strspn(p + len, " \t\r")] == '\0') {
+        p[len] = '\0';
+        if (service_builtin(p)) {
+            fflush(stdout);
+            return;
+        }
+    }
+
+    int lock_fd = bootcount_lock();
+    batch_command(plat, p, stdout);
+    bootcount_unlock(lock_fd);
+
+    unsigned long us = elapsed_us(arrival);
+    g_latency.count++;
+    g_latency.total_us += us;
+    if (us < g_latency.min_us)
+        g_latency.min_us = us;
+    if (us > g_latency.max_us)
+        g_latency.max_us = us;
+    fflush(stdout);
+}
+
+/* Run every complete line in g_in; keep a trailing partial line */
+static void service_input(const struct platform *plat, const struct timespec *arrival)
+{
+    char *start = g_in, *nl;
+
+    while ((nl = memchr(start, '\n', g_in_len - (size_t)(start - g_in)))) {
+        *nl = '\0';
+        service_command(plat, start, arrival);
+        start = nl + 1;
+    }
+    g_in_len -= (size_t)(start - g_in);
+    memmove(g_in, start, g_in_len);
+    if (g_in_len == sizeof(g_in)) {
+        fprintf(stderr, "Command line too long, discarded\n");
+        g_in_len = 0;
+    }
+}
+
+/* Undo the setup of service_run(); sig_fd may be -1 */
+static void service_cleanup(int in_fd, int sig_fd, const sigset_t *oldmask)
+{
+    if (sig_fd >= 0)
+        close(sig_fd);
+    sigprocmask(SIG_SETMASK, oldmask, NULL);
+    if (in_fd != STDIN_FILENO)
+        close(in_fd);
+}
+
+int service_run(const struct platform *plat, const struct service_opts *opts)
+{
+    struct pollfd fds[2];
+    sigset_t mask, oldmask;
+    uint16_t val;
+
+    setvbuf(stdout, g_stdout_buf, _IOFBF, sizeof(g_stdout_buf));
+
+    int in_fd = open_input(opts->path);
+    if (in_fd < 0)
+        return in_fd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &oldmask);
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (sig_fd < 0) {
+        /* with the signals blocked and unread, only SIGKILL could stop us */
+        perror("signalfd");
+        service_cleanup(in_fd, sig_fd, &oldmask);
+        return E_DEVICE;
+    }
+
+    /* open the device fd or map and touch the register page now */
+    int err = plat->read_bootcount(&val);
+    if (err != 0 && err != E_BADMAGIC) {
+        fprintf(stderr, "Cannot read the bootcount on %s (Error %d)\n", plat->name, err);
+        service_cleanup(in_fd, sig_fd, &oldmask);
+        return err;
+    }
+    if (opts->coalesce_ms > 0)
+        plat = coalesce_wrap(plat, opts->coalesce_ms);
+    setup_realtime(opts);
+    DEBUG_PRINTF("Serving %s on %s\n", plat->name, opts->path ? opts->path : "stdin");
+
+    fds[0] = (struct pollfd){ .fd = in_fd, .events = POLLIN };
+    fds[1] = (struct pollfd){ .fd = sig_fd, .events = POLLIN };
+    for (;;) {
+        struct timespec arrival;
+
+        int n = poll(fds, 2, coalesce_due_ms());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0) {
+            service_flush();
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &arrival);
+        if (fds[1].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si))
+                DEBUG_PRINTF("Signal %u, stopping\n", si.ssi_signo);
+            break;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t r = read(in_fd, g_in + g_in_len, sizeof(g_in) - g_in_len);
+            if (r == 0)
+                break;  /* EOF on stdin */
+            if (r < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                break;
+            }
+            g_in_len += (size_t)r;
+            service_input(plat, &arrival);
+        }
+    }
+
+    /* whatever is still pending must reach the backend before a reboot */
+    service_final_flush();
+    service_cleanup(in_fd, sig_fd, &oldmask);
+    return 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * Resident service mode
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "platform.h"
+
+#define SERVICE_RT_PRIO_DEFAULT 50
+#define SERVICE_COALESCE_DEFAULT_MS 1000
+
+struct service_opts {
+    const char *path;   /* FIFO to read commands from, or NULL for stdin */
+    int rt_prio;        /* SCHED_FIFO priority, 0 to keep the default policy */
+    int cpu;            /* CPU to pin to, or -1 */
+    int coalesce_ms;    /* write coalescing window, 0 to write every command */
+};
+
+/*
+ * Prepare everything for bounded-latency commands, then run batch commands
+ * from the FIFO (or stdin) until SIGTERM/SIGINT, or EOF on stdin.
+ * Returns 0, or an error from the setup.
+ */
+int service_run(const struct platform *plat, const struct service_opts *opts);
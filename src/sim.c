@@ -0,0 +1,370 @@
+/**
+ * Fleet simulator for bootcount-sim
+ *
+ * Each simulated device holds the storage of one backend: the 32-bit
+ * SCRATCH2/LPGPR0 register (plus the AM33xx KICK registers) or the two nvmem
+ * bytes of an EEPROM/RTC cell.  Reads and writes follow the same rules as
+ * the real backends and U-Boot's drivers:
+ *
+ *   - registers hold (BOOTCOUNT_MAGIC & 0xffff0000) | value, 16-bit values;
+ *   - AM33xx stores unlock KICK0R/KICK1R first, as U-Boot and am33xx.c do;
+ *   - EEPROM/RTC cells hold value & 0xff, then the 0xbc magic byte, so U-Boot's
+ *     increment wraps from 255 to 0;
+ *   - a missing magic loads as 0;
+ *   - userspace writes skip an unchanged value and read back to verify.
+ *
+ * Every boot, U-Boot loads the count, stores count + 1 and runs 'altbootcmd'
+ * (a rollback) when it exceeds 'bootlimit'.  Then the device's pattern says
+ * what happens next: 'g' the system comes up and resets the count, 'f' it
+ * fails and the watchdog reboots it, 'p' power is lost, clearing the
+ * registers that have no backup supply.  A rolled-back image is assumed
+ * healthy.
+ *
+ * Each thread owns a slice of the fleet and runs its own event loop: a
+ * binary heap of next-boot times in simulated milliseconds.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "sim.h"
+
+/* See am33xx.c */
+#define KICK0_MAGIC 0x83E70B13ul
+#define KICK1_MAGIC 0x95A4F1E0ul
+/* See i2c_eeprom.c and dm_rtc.c */
+#define SIM_CELL_MAGIC 0xbc
+
+struct sim_device {
+    uint32_t id;
+    uint8_t backend;
+    uint8_t pattern;
+    uint16_t step;              /* position in the pattern */
+    uint32_t boots;
+    uint32_t rng;
+    uint32_t reg[3];            /* SCRATCH2 or LPGPR0, KICK0R, KICK1R */
+    uint8_t cell[2];            /* value, magic */
+};
+
+struct sim_event {
+    uint64_t ms;
+    uint32_t dev;
+};
+
+struct sim_thread {
+    const struct sim_config *cfg;
+    struct sim_device *devs;
+    uint32_t ndevs;
+    struct sim_event *heap;
+    uint32_t nheap;
+    struct sim_stats stats;
+    struct timespec start;
+};
+
+static const char *backend_names[SIM_BACKENDS] = {
+    [SIM_AM33XX] = "am33xx",
+    [SIM_IMX8M] = "imx8m",
+    [SIM_I2C_EEPROM] = "i2c-eeprom",
+    [SIM_DM_RTC] = "dm-rtc",
+};
+
+/* Whether the storage survives a power loss (battery-backed RTC, EEPROM) */
+static const bool backend_retained[SIM_BACKENDS] = {
+    [SIM_I2C_EEPROM] = true,
+    [SIM_DM_RTC] = true,
+};
+
+int sim_backend_parse(const char *name, size_t len)
+{
+    for (int i = 0; i < SIM_BACKENDS; i++) {
+        if (strlen(backend_names[i]) == len && strncmp(name, backend_names[i], len) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *sim_backend_name(enum sim_backend backend)
+{
+    return backend_names[backend];
+}
+
+bool sim_pattern_valid(const char *pattern)
+{
+    return *pattern && strspn(pattern, "gfp") == strlen(pattern);
+}
+
+static bool is_register(const struct sim_device *d)
+{
+    return d->backend == SIM_AM33XX || d->backend == SIM_IMX8M;
+}
+
+static int dev_read(struct sim_device *d, struct sim_stats *st, uint16_t *val)
+{
+    st->reads++;
+    if (is_register(d)) {
+        if ((d->reg[0] & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000))
+            return E_BADMAGIC;
+        *val = (uint16_t)(d->reg[0] & 0xffff);
+        return 0;
+    }
+    if (d->cell[1] != SIM_CELL_MAGIC)
+        return E_BADMAGIC;
+    *val = d->cell[0];
+    return 0;
+}
+
+/* The raw store, as U-Boot's drivers do it: no skip, no verify */
+static void dev_store(struct sim_device *d, struct sim_stats *st, uint16_t val)
+{
+    st->writes++;
+    if (is_register(d)) {
+        if (d->backend == SIM_AM33XX) {
+            d->reg[1] = KICK0_MAGIC;
+            d->reg[2] = KICK1_MAGIC;
+        }
+        d->reg[0] = (BOOTCOUNT_MAGIC & 0xffff0000) | val;
+        return;
+    }
+    d->cell[0] = (uint8_t)(val & 0xff);
+    d->cell[1] = SIM_CELL_MAGIC;
+}
+
+/* A userspace write, as the bootcount backends do it */
+static int dev_write(struct sim_device *d, struct sim_stats *st, uint16_t val)
+{
+    uint16_t cur;
+    uint16_t stored = is_register(d) ? val : (val & 0xff);
+
+    if (dev_read(d, st, &cur) == 0 && cur == stored) {
+        st->skipped++;
+        return 0;
+    }
+    dev_store(d, st, val);
+    if (dev_read(d, st, &cur) != 0 || cur != stored)
+        return E_WRITE_FAILED;
+    return 0;
+}
+
+static void power_loss(struct sim_device *d)
+{
+    if (!backend_retained[d->backend])
+        memset(d->reg, 0, sizeof(d->reg));
+}
+
+/* xorshift32, per device so results do not depend on the thread split */
+static uint32_t dev_random(struct sim_device *d)
+{
+    d->rng ^= d->rng << 13;
+    d->rng ^= d->rng >> 17;
+    d->rng ^= d->rng << 5;
+    return d->rng;
+}
+
+static void boot(struct sim_thread *t, struct sim_device *d)
+{
+    const struct sim_config *cfg = t->cfg;
+    struct sim_stats *st = &t->stats;
+    uint16_t val = 0;
+    uint32_t count;
+
+    /* U-Boot: bootcount = load + 1, a bad magic loads as 0 */
+    if (dev_read(d, st, &val) != 0) {
+        st->badmagic++;
+        val = 0;
+    }
+    count = (uint32_t)val + 1;
+    if (count > (is_register(d) ? 0xffffu : 0xffu))
+        st->wraps++;
+    dev_store(d, st, (uint16_t)count);
+    bool rollback = count > cfg->bootlimit;
+    if (rollback)
+        st->rollbacks++;
+    st->boots++;
+    d->boots++;
+
+    const char *pattern = cfg->patterns[d->pattern];
+    char outcome = rollback ? 'g' : pattern[d->step];
+    d->step = pattern[d->step + 1] ? d->step + 1 : 0;
+
+    /* userspace: what the orchestrator is told, then the health decision */
+    int err = dev_read(d, st, &val);
+    if (cfg->report)
+        fprintf(cfg->report, "{\"device\":%u,\"backend\":\"%s\",\"boot\":%u,\"bootcount\":%d,"
+                "\"rollback\":%s,\"outcome\":\"%s\"}\n", d->id, backend_names[d->backend],
+                d->boots, err ? err : val, rollback ? "true" : "false",
+                outcome == 'g' ? "good" : outcome == 'f' ? "failed" : "powerloss");
+    if (outcome == 'g')
+        dev_write(d, st, 0);
+    else if (outcome == 'p')
+        power_loss(d);
+}
+
+static void heap_push(struct sim_thread *t, uint64_t ms, uint32_t dev)
+{
+    uint32_t i = t->nheap++;
+
+    while (i > 0 && t->heap[(i - 1) / 2].ms > ms) {
+        t->heap[i] = t->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    t->heap[i] = (struct sim_event){ .ms = ms, .dev = dev };
+}
+
+static struct sim_event heap_pop(struct sim_thread *t)
+{
+    struct sim_event top = t->heap[0], last = t->heap[--t->nheap];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= t->nheap)
+            break;
+        if (c + 1 < t->nheap && t->heap[c + 1].ms < t->heap[c].ms)
+            c++;
+        if (t->heap[c].ms >= last.ms)
+            break;
+        t->heap[i] = t->heap[c];
+        i = c;
+    }
+    if (t->nheap)
+        t->heap[i] = last;
+    return top;
+}
+
+static void sleep_until(const struct timespec *start, uint64_t ms)
+{
+    struct timespec at = *start;
+
+    at.tv_sec += (time_t)(ms / 1000);
+    at.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (at.tv_nsec >= 1000000000L) {
+        at.tv_sec++;
+        at.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+        ;
+}
+
+static void *sim_thread_main(void *arg)
+{
+    struct sim_thread *t = arg;
+    const struct sim_config *cfg = t->cfg;
+    struct timespec cpu;
+
+    /* the first boots are spread over one boot period */
+    for (uint32_t i = 0; i < t->ndevs; i++)
+        heap_push(t, dev_random(&t->devs[i]) % cfg->boot_ms, i);
+
+    while (t->nheap) {
+        struct sim_event ev = heap_pop(t);
+        struct sim_device *d = &t->devs[ev.dev];
+
+        if (cfg->realtime)
+            sleep_until(&t->start, ev.ms);
+        boot(t, d);
+        if (d->boots < cfg->boots) {
+            /* +-25% jitter around the boot period */
+            uint64_t next = cfg->boot_ms * 3 / 4 + dev_random(d) % (cfg->boot_ms / 2 + 1);
+            heap_push(t, ev.ms + next, ev.dev);
+        }
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    t->stats.cpu_s = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    return NULL;
+}
+
+static void add_stats(struct sim_stats *total, const struct sim_stats *st)
+{
+    total->boots += st->boots;
+    total->reads += st->reads;
+    total->writes += st->writes;
+    total->skipped += st->skipped;
+    total->badmagic += st->badmagic;
+    total->rollbacks += st->rollbacks;
+    total->wraps += st->wraps;
+    total->cpu_s += st->cpu_s;
+}
+
+int sim_run(const struct sim_config *cfg, struct sim_stats *total)
+{
+    struct sim_device *devs = calloc(cfg->devices, sizeof(*devs));
+    struct sim_event *heap = calloc(cfg->devices, sizeof(*heap));
+    struct sim_thread *threads = calloc(cfg->threads, sizeof(*threads));
+    pthread_t *tids = calloc(cfg->threads, sizeof(*tids));
+    unsigned backends[SIM_BACKENDS], nbackends = 0;
+    struct timespec start;
+    unsigned started = 0;
+    int err = 0;
+
+    if (!devs || !heap || !threads || !tids) {
+        fprintf(stderr, "Out of memory for %u devices\n", cfg->devices);
+        err = E_INVALID;
+        goto out;
+    }
+
+    for (unsigned b = 0; b < SIM_BACKENDS; b++) {
+        if (cfg->backends & (1u << b))
+            backends[nbackends++] = b;
+    }
+    /* a new device: blank storage, so the first boot finds no magic */
+    for (unsigned i = 0; i < cfg->devices; i++) {
+        devs[i].id = i;
+        devs[i].backend = (uint8_t)backends[i % nbackends];
+        devs[i].pattern = (uint8_t)(i % cfg->npatterns);
+        devs[i].rng = 2463534242u ^ (i * 2654435761u);
+        if (devs[i].rng == 0)
+            devs[i].rng = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(total, 0, sizeof(*total));
+    for (unsigned i = 0; i < cfg->threads; i++) {
+        uint32_t first = (uint32_t)((uint64_t)cfg->devices * i / cfg->threads);
+        uint32_t last = (uint32_t)((uint64_t)cfg->devices * (i + 1) / cfg->threads);
+
+        threads[i] = (struct sim_thread){
+            .cfg = cfg, .devs = devs + first, .ndevs = last - first, .heap = heap + first, .start = start,
+        };
+        if (pthread_create(&tids[i], NULL, sim_thread_main, &threads[i]) != 0) {
+            fprintf(stderr, "Cannot start thread %u\n", i);
+            err = E_INVALID;
+            break;
+        }
+        started++;
+    }
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        add_stats(total, &threads[i].stats);
+    }
+
+out:
+    free(tids);
+    free(threads);
+    free(heap);
+    free(devs);
+    return err;
+}
@@ -0,0 +1,69 @@
+/**
+ * Fleet simulator for bootcount-sim
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum sim_backend {
+    SIM_AM33XX,         /* RTC SCRATCH2, unlocked through KICK0R/KICK1R */
+    SIM_IMX8M,          /* SNVS_LPGPR0 */
+    SIM_I2C_EEPROM,     /* legacy fixed-address EEPROM, 8-bit value */
+    SIM_DM_RTC,         /* battery-backed RTC user RAM nvmem, 8-bit value */
+    SIM_BACKENDS
+};
+
+#define SIM_PATTERN_LEN 64
+#define SIM_PATTERNS_MAX 8
+
+struct sim_config {
+    unsigned devices;
+    unsigned boots;             /* boots per device */
+    unsigned bootlimit;         /* U-Boot 'bootlimit' */
+    unsigned threads;
+    unsigned backends;          /* mask of 1 << enum sim_backend, assigned round robin */
+    unsigned boot_ms;           /* simulated time from one boot to the next */
+    unsigned npatterns;         /* patterns assigned round robin */
+    char patterns[SIM_PATTERNS_MAX][SIM_PATTERN_LEN + 1];
+    bool realtime;              /* pace boots in wall-clock time instead of running flat out */
+    FILE *report;               /* one JSON line per boot, or NULL */
+};
+
+struct sim_stats {
+    unsigned long long boots;
+    unsigned long long reads;       /* backend reads, by U-Boot or userspace */
+    unsigned long long writes;      /* backend writes that changed the stored value */
+    unsigned long long skipped;     /* userspace writes skipped, value already stored */
+    unsigned long long badmagic;    /* loads that found no valid counter */
+    unsigned long long rollbacks;   /* boots where U-Boot ran 'altbootcmd' */
+    unsigned long long wraps;       /* stores truncated by the backend width */
+    double cpu_s;                   /* CPU time of the simulating threads */
+};
+
+/* "am33xx", "imx8m", "i2c-eeprom" or "dm-rtc" to its enum, -1 if unknown */
+int sim_backend_parse(const char *name, size_t len);
+const char *sim_backend_name(enum sim_backend backend);
+
+/* Valid pattern: one or more of 'g' (healthy), 'f' (fails), 'p' (power loss) */
+bool sim_pattern_valid(const char *pattern);
+
+/* Run the fleet.  Returns 0, or E_INVALID if memory or threads are short. */
+int sim_run(const struct sim_config *cfg, struct sim_stats *total);
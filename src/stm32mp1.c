@@ -30,6 +30,8 @@
 #include "./memory.h"
 #include "./dt.h"
 #include "./stm32mp1.h"
+#include "./reset_cause.h"
+#include "./trace.h"
 
 // See https://wiki.st.com/stm32mpu/wiki/STM32MP15_backup_registers#BOOT_COUNTER
 #define TAMP_BKP0R 0x5C00A100ul
@@ -39,6 +41,27 @@
 #define STM32MP1_MEM_OFFSET (TAMP_BKP0R + TAMP_BKP21R_OFFSET)
 #define STM32MP1_MEM_LEN (REG_SIZE)
 
+// RCC_MP_RSTSCLRR: reset status, write 1 to clear.  See RM0436 10.7.135
+#define RCC_BASE 0x50000000ul
+#define RCC_MP_RSTSCLRR_OFFSET 0x408ul
+
+static const struct reset_flag stm32mp1_reset_flags[] = {
+    {0x0001, "PORRSTF", "power-on"},
+    {0x0002, "BORRSTF", "brown-out"},
+    {0x0004, "PADRSTF", "external"},
+    {0x0008, "HCSSRSTF", "clock-failure"},
+    {0x0010, "VCORERSTF", "power-on"},
+    {0x0040, "MPSYSRSTF", "software"},
+    {0x0080, "MCSYSRSTF", "software"},
+    {0x0100, "IWDG1RSTF", "watchdog"},
+    {0x0200, "IWDG2RSTF", "watchdog"},
+    {0x0800, "STDBYRSTF", "standby"},
+    {0x1000, "CSTDBYRSTF", "standby"},
+    {0x2000, "MPUP0RSTF", "software"},
+    {0x4000, "MPUP1RSTF", "software"},
+    {0, NULL, NULL}
+};
+
 bool is_stm32mp1() {
     return is_compatible_soc("st,stm32mp153") || is_compatible_soc("st,stm32mp157");
 }
@@ -51,18 +74,29 @@ int stm32mp1_read_bootcount(uint16_t* val) {
     }
 
     //printf("%08" PRIx32 "\n", *bkp21r);
+    uint32_t bkp21r_val = *bkp21r;
+    trace_event(TRACE_READ, "/dev/mem", STM32MP1_MEM_OFFSET, bkp21r_val, 0);
 
     // low two bytes are the value, high two bytes are magic
-    if ((*bkp21r & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000)) {
+    if ((bkp21r_val & 0xffff0000) != (BOOTCOUNT_MAGIC & 0xffff0000)) {
+        trace_event(TRACE_BADMAGIC, "/dev/mem", STM32MP1_MEM_OFFSET, bkp21r_val, E_BADMAGIC);
         return E_BADMAGIC;
     }
 
-    *val = (uint16_t)(*bkp21r & 0x0000ffff);
+    *val = (uint16_t)(bkp21r_val & 0x0000ffff);
     return 0;
 }
 
 
 int stm32mp1_write_bootcount(uint16_t val) {
+    // Skip the write if the register already holds this value
+    uint16_t cur_val;
+    if ( stm32mp1_read_bootcount(&cur_val) == 0 && cur_val == val ) {
+        DEBUG_PRINTF("Value %u unchanged, skipping write\n", val);
+        trace_event(TRACE_SKIP, "/dev/mem", STM32MP1_MEM_OFFSET, cur_val, 0);
+        return 0;
+    }
+
     // NOTE: These must be volatile.
     // See https://github.com/brgl/busybox/blob/master/miscutils/devmem.c
     volatile uint32_t *bkp21r =
@@ -72,13 +106,19 @@ int stm32mp1_write_bootcount(uint16_t val) {
     }
 
     *bkp21r = (BOOTCOUNT_MAGIC & 0xffff0000) | (val & 0xffff);
+    trace_event(TRACE_WRITE, "/dev/mem", STM32MP1_MEM_OFFSET, (BOOTCOUNT_MAGIC & 0xffff0000) | val, 0);
 
     // read back to verify:
     uint16_t read_val = 0;
     stm32mp1_read_bootcount(&read_val);
     if ( read_val != val ) {
+        trace_event(TRACE_VERIFY, "/dev/mem", STM32MP1_MEM_OFFSET, read_val, E_WRITE_FAILED);
         return E_WRITE_FAILED;
     }
 
     return 0;
 }
+
+int stm32mp1_read_reset_cause(struct reset_cause *rc, bool clear) {
+    return reset_cause_read_reg(RCC_BASE + RCC_MP_RSTSCLRR_OFFSET, stm32mp1_reset_flags, clear, rc);
+}
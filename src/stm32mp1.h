@@ -7,3 +7,6 @@
 bool is_stm32mp1();
 int stm32mp1_read_bootcount(uint16_t* val);
 int stm32mp1_write_bootcount(uint16_t val);
+
+struct reset_cause;
+int stm32mp1_read_reset_cause(struct reset_cause *rc, bool clear);
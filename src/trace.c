@@ -0,0 +1,272 @@
+/**
+ * In-process flight recorder
+ *
+ * Every backend records compact binary events (phase, path hash, offset, raw
+ * value, errno, timestamp) into a fixed-size, statically allocated ring.
+ * Recording is a handful of stores plus a vDSO clock read, so it is always on.
+ * Slots are claimed with an atomic add, so backends running in parallel
+ * threads (--all) can record into the same ring.
+ * The ring is only dumped when an operation fails:
+ *
+ *   BOOTCOUNT_TRACE unset     decoded text on stderr
+ *   BOOTCOUNT_TRACE=off       no dump
+ *   BOOTCOUNT_TRACE=<file>    binary dump, decode with `bootcount-trace <file>`
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "trace.h"
+
+static struct trace_event g_ring[TRACE_RING_SIZE];
+static uint32_t g_head = 0;     /* total number of events ever recorded */
+static struct trace_path g_paths[TRACE_PATH_SLOTS];
+static uint32_t g_npaths = 0;
+static char g_paths_busy;       /* spinlock for g_paths, taken only for new paths */
+
+static const char *phase_names[] = {
+    [TRACE_DETECT] = "DETECT",
+    [TRACE_OPEN] = "OPEN",
+    [TRACE_MMAP] = "MMAP",
+    [TRACE_READ] = "READ",
+    [TRACE_WRITE] = "WRITE",
+    [TRACE_VERIFY] = "VERIFY",
+    [TRACE_UNLOCK] = "UNLOCK",
+    [TRACE_BADMAGIC] = "BADMAGIC",
+    [TRACE_SKIP] = "SKIP",
+    [TRACE_WAIT] = "WAIT",
+    [TRACE_LOCK] = "LOCK",
+};
+
+static uint64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* 32-bit FNV-1a */
+static uint32_t path_hash(const char *path)
+{
+    uint32_t h = 2166136261u;
+    for (; *path; path++) {
+        h ^= (uint8_t)*path;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool path_known(uint32_t hash)
+{
+    uint32_t n = __atomic_load_n(&g_npaths, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < n; i++) {
+        if (g_paths[i].hash == hash)
+            return true;
+    }
+    return false;
+}
+
+static void remember_path(uint32_t hash, const char *path)
+{
+    if (path_known(hash))
+        return;
+    while (__atomic_test_and_set(&g_paths_busy, __ATOMIC_ACQUIRE))
+        ;
+    /* the decoder falls back to printing the hash when the table is full */
+    if (!path_known(hash) && g_npaths < TRACE_PATH_SLOTS) {
+        g_paths[g_npaths].hash = hash;
+        strncpy(g_paths[g_npaths].path, path, TRACE_PATH_LEN - 1);
+        __atomic_store_n(&g_npaths, g_npaths + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_clear(&g_paths_busy, __ATOMIC_RELEASE);
+}
+
+/* Phases whose failures come from a system call, so errno belongs to them */
+static bool syscall_phase(uint8_t phase)
+{
+    return phase == TRACE_OPEN || phase == TRACE_MMAP || phase == TRACE_READ ||
+           phase == TRACE_WRITE || phase == TRACE_LOCK;
+}
+
+void trace_event(uint8_t phase, const char *path, uint32_t offset, uint32_t raw, int rc)
+{
+    int saved_errno = errno;
+    uint32_t slot = __atomic_fetch_add(&g_head, 1, __ATOMIC_RELAXED);
+    struct trace_event *ev = &g_ring[slot & (TRACE_RING_SIZE - 1)];
+
+    ev->ts_ns = clock_ns(CLOCK_MONOTONIC);
+    ev->path_hash = 0;
+    if (path) {
+        ev->path_hash = path_hash(path);
+        remember_path(ev->path_hash, path);
+    }
+    ev->offset = offset;
+    ev->raw = raw;
+    ev->err = rc && syscall_phase(phase) ? (int16_t)saved_errno : 0;
+    ev->phase = phase;
+    ev->rc = (int8_t)rc;
+    errno = saved_errno;
+}
+
+static const char *lookup_path(const struct trace_path *paths, uint32_t npaths, uint32_t hash)
+{
+    for (uint32_t i = 0; i < npaths; i++) {
+        if (paths[i].hash == hash)
+            return paths[i].path;
+    }
+    return NULL;
+}
+
+static void print_event(FILE *out, const struct trace_header *hdr,
+                        const struct trace_path *paths, const struct trace_event *ev)
+{
+    /* wall-clock time of the event, derived from the dump's clock pair */
+    uint64_t real_ns = hdr->real_ns - (hdr->mono_ns - ev->ts_ns);
+    time_t secs = (time_t)(real_ns / 1000000000ull);
+    struct tm tm;
+    char stamp[32];
+    gmtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    const char *phase = "?";
+    if (ev->phase < sizeof(phase_names) / sizeof(phase_names[0]) && phase_names[ev->phase])
+        phase = phase_names[ev->phase];
+
+    const char *path = ev->path_hash ? lookup_path(paths, hdr->npaths, ev->path_hash) : "-";
+    fprintf(out, "%s.%06luZ %-8s %s", stamp,
+            (unsigned long)(real_ns % 1000000000ull) / 1000, phase, path ? path : "");
+    if (!path)
+        fprintf(out, "#%08lx", (unsigned long)ev->path_hash);
+    fprintf(out, " off=0x%lx raw=0x%08lx rc=%d", (unsigned long)ev->offset,
+            (unsigned long)ev->raw, ev->rc);
+    if (ev->err)
+        fprintf(out, " errno=%d (%s)", ev->err, strerror(ev->err));
+    fprintf(out, "\n");
+}
+
+static void fill_header(struct trace_header *hdr)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->version = TRACE_VERSION;
+    hdr->event_size = sizeof(struct trace_event);
+    hdr->count = g_head < TRACE_RING_SIZE ? g_head : TRACE_RING_SIZE;
+    hdr->dropped = g_head - hdr->count;
+    hdr->npaths = g_npaths;
+    hdr->mono_ns = clock_ns(CLOCK_MONOTONIC);
+    hdr->real_ns = clock_ns(CLOCK_REALTIME);
+}
+
+/* Events in chronological order: oldest surviving event first */
+static const struct trace_event *ring_at(uint32_t count, uint32_t i)
+{
+    return &g_ring[(g_head - count + i) & (TRACE_RING_SIZE - 1)];
+}
+
+int trace_dump_binary(int fd)
+{
+    struct trace_header hdr;
+    fill_header(&hdr);
+
+    if (write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr))
+        return E_DEVICE;
+    if (write(fd, g_paths, hdr.npaths * sizeof(g_paths[0])) != (ssize_t)(hdr.npaths * sizeof(g_paths[0])))
+        return E_DEVICE;
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        if (write(fd, ring_at(hdr.count, i), sizeof(struct trace_event)) != (ssize_t)sizeof(struct trace_event))
+            return E_DEVICE;
+    }
+    return 0;
+}
+
+void trace_dump_on_failure(void)
+{
+    const char *dest = getenv(TRACE_ENV);
+
+    if (g_head == 0)
+        return;
+
+    if (dest && strcmp(dest, "off") == 0)
+        return;
+
+    if (dest && *dest) {
+        int fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("trace: open failed");
+            return;
+        }
+        if (trace_dump_binary(fd) != 0) {
+            perror("trace: write failed");
+            close(fd);
+            return;
+        }
+        close(fd);
+        fprintf(stderr, "Trace written to %s\n", dest);
+        return;
+    }
+
+    struct trace_header hdr;
+    fill_header(&hdr);
+    fprintf(stderr, "Trace (%lu events, %lu dropped):\n",
+            (unsigned long)hdr.count, (unsigned long)hdr.dropped);
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        fprintf(stderr, "  ");
+        print_event(stderr, &hdr, g_paths, ring_at(hdr.count, i));
+    }
+}
+
+int trace_decode(FILE *in, FILE *out)
+{
+    struct trace_header hdr;
+    struct trace_path paths[TRACE_PATH_SLOTS];
+    struct trace_event ev;
+
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "Not a bootcount trace dump\n");
+        return E_BADMAGIC;
+    }
+    if (hdr.version != TRACE_VERSION || hdr.event_size != sizeof(ev) || hdr.npaths > TRACE_PATH_SLOTS) {
+        fprintf(stderr, "Unsupported trace dump version %u\n", hdr.version);
+        return E_BADMAGIC;
+    }
+    if (fread(paths, sizeof(paths[0]), hdr.npaths, in) != hdr.npaths)
+        return E_DEVICE;
+    /* the dump is untrusted input */
+    for (uint32_t i = 0; i < hdr.npaths; i++)
+        paths[i].path[TRACE_PATH_LEN - 1] = '\0';
+
+    fprintf(out, "%lu events, %lu dropped\n", (unsigned long)hdr.count, (unsigned long)hdr.dropped);
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        if (fread(&ev, sizeof(ev), 1, in) != 1) {
+            fprintf(stderr, "Truncated dump after %lu events\n", (unsigned long)i);
+            return E_DEVICE;
+        }
+        print_event(out, &hdr, paths, &ev);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/**
+ * In-process flight recorder
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Number of events kept in the ring; must be a power of two */
+#define TRACE_RING_SIZE 64
+/* Number of distinct paths remembered so the decoder can print names, not just hashes */
+#define TRACE_PATH_SLOTS 8
+#define TRACE_PATH_LEN 60
+
+#define TRACE_MAGIC "BCTR"
+#define TRACE_VERSION 1
+
+/* Set BOOTCOUNT_TRACE to a file name to get a binary dump, or "off" to disable */
+#define TRACE_ENV "BOOTCOUNT_TRACE"
+
+enum trace_phase {
+    TRACE_DETECT = 1,   /* raw = platform index, rc = 0 if detected */
+    TRACE_OPEN,         /* open() of a device or sysfs file */
+    TRACE_MMAP,         /* offset = physical address */
+    TRACE_READ,         /* raw = value read from the device */
+    TRACE_WRITE,        /* raw = value written to the device */
+    TRACE_VERIFY,       /* raw = value read back after a write */
+    TRACE_UNLOCK,       /* write protection disabled (e.g. AM33xx KICK registers) */
+    TRACE_BADMAGIC,     /* raw = word that failed the magic check */
+    TRACE_SKIP,         /* write skipped, raw = value already stored */
+    TRACE_WAIT,         /* waited for the device to appear, raw = milliseconds */
+    TRACE_LOCK,         /* took the cross-process lock, raw = microseconds waited */
+};
+
+/* One record in the ring.  Fixed size and layout, it is dumped as-is. */
+struct trace_event {
+    uint64_t ts_ns;     /* CLOCK_MONOTONIC */
+    uint32_t path_hash; /* FNV-1a of the device path */
+    uint32_t offset;    /* file offset or physical address */
+    uint32_t raw;
+    int16_t err;        /* errno of a failed open/mmap/read/write/lock, else 0 */
+    uint8_t phase;      /* enum trace_phase */
+    int8_t rc;          /* 0 or one of the E_* codes */
+};
+
+struct trace_path {
+    uint32_t hash;
+    char path[TRACE_PATH_LEN];
+};
+
+/* Header of the binary dump; followed by npaths trace_path and count trace_event */
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t event_size;
+    uint32_t count;
+    uint32_t dropped;   /* events overwritten before the dump */
+    uint32_t npaths;
+    uint32_t reserved;
+    uint64_t mono_ns;   /* CLOCK_MONOTONIC at dump time */
+    uint64_t real_ns;   /* CLOCK_REALTIME at dump time */
+};
+
+void trace_event(uint8_t phase, const char *path, uint32_t offset, uint32_t raw, int rc);
+
+/* Dump the ring as configured by $BOOTCOUNT_TRACE.  Call only when an operation failed. */
+void trace_dump_on_failure(void);
+
+/* Write the binary dump to fd.  Returns 0 on success. */
+int trace_dump_binary(int fd);
+
+/* Decode a binary dump read from `in` as text.  Returns 0 on success. */
+int trace_decode(FILE *in, FILE *out);
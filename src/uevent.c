@@ -0,0 +1,128 @@
+/**
+ * Kernel uevent listener used to wait for late-probing devices
+ *
+ * `bootcount --wait` subscribes to the kernel's uevent multicast group and
+ * re-runs detection only when a device is added or bound in one of the
+ * subsystems the DM, i2c-dev and fs-file backends look at, so detection
+ * continues the moment the at24/RTC driver finishes (deferred) probe or the
+ * boot partition appears, instead of after a sleep interval.  If the socket cannot be opened we fall back to polling.
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "constants.h"
+#include "uevent.h"
+
+#define UEVENT_BUF_SIZE 4096
+#define UEVENT_POLL_FALLBACK_MS 50
+
+int uevent_open(void)
+{
+    struct sockaddr_nl addr;
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        DEBUG_PRINTF("uevent socket failed (%s), polling instead\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    /* kernel uevents, and udev's once its rules ran: /dev/disk/by-* links only exist then */
+    addr.nl_groups = 1 | 2;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        DEBUG_PRINTF("uevent bind failed (%s), polling instead\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * The kernel's payload is "action@devpath\0KEY=value\0KEY=value\0...", and
+ * udev's the same properties after a binary header, which just never matches.
+ */
+static bool uevent_relevant(const char *buf, size_t len)
+{
+    bool action = false, subsystem = false;
+
+    for (const char *p = buf; p < buf + len; p += strlen(p) + 1) {
+        if (strcmp(p, "ACTION=add") == 0 || strcmp(p, "ACTION=bind") == 0)
+            action = true;
+        else if (strcmp(p, "SUBSYSTEM=i2c") == 0 || strcmp(p, "SUBSYSTEM=i2c-dev") == 0 ||
+                 strcmp(p, "SUBSYSTEM=nvmem") == 0 || strcmp(p, "SUBSYSTEM=block") == 0)
+            subsystem = true;
+    }
+    if (action && subsystem)
+        DEBUG_PRINTF("uevent %s\n", buf);
+    return action && subsystem;
+}
+
+bool uevent_wait(int fd, long timeout_ms)
+{
+    char buf[UEVENT_BUF_SIZE];
+    struct timespec start, now;
+
+    if (fd < 0) {
+        if (timeout_ms > UEVENT_POLL_FALLBACK_MS)
+            timeout_ms = UEVENT_POLL_FALLBACK_MS;
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = timeout_ms * 1000000L };
+        nanosleep(&ts, NULL);
+        return true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long remaining = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000L +
+                                       (now.tv_nsec - start.tv_nsec) / 1000000L);
+        if (remaining <= 0)
+            return false;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int n = poll(&pfd, 1, (int)remaining);
+        if (n < 0 && errno != EINTR)
+            return false;
+        if (n <= 0)
+            continue;
+
+        ssize_t r = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (r <= 0) {
+            /* ENOBUFS: events were dropped, let the caller re-probe */
+            return r < 0 && errno == ENOBUFS;
+        }
+        buf[r] = '\0';
+        if (uevent_relevant(buf, (size_t)r))
+            return true;
+    }
+}
+
+void uevent_close(int fd)
+{
+    if (fd >= 0)
+        close(fd);
+}
@@ -0,0 +1,35 @@
+/**
+ * Kernel uevent listener used to wait for late-probing devices
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/* Open a NETLINK_KOBJECT_UEVENT socket.  Returns the fd, or -1 (callers then poll). */
+int uevent_open(void);
+
+/*
+ * Block until a uevent that could make a bootcount device appear arrives
+ * (add/bind in the i2c, i2c-dev, nvmem or block subsystems), or timeout_ms
+ * passes.
+ * With fd < 0 this just sleeps a short poll interval.
+ */
+bool uevent_wait(int fd, long timeout_ms);
+
+void uevent_close(int fd);
@@ -0,0 +1,160 @@
+/**
+ * Watch the bootcount for changes
+ *
+ * Registers and nvmem files give no change notification, so `--watch`
+ * polls the one detected backend, whose fd or mapping stays open.  The
+ * interval starts at WATCH_MIN_MS and doubles after every read that sees
+ * no change, up to WATCH_MAX_MS; a change drops it back to the minimum.
+ * The minimum is raised to 60000 / reads_per_min ms if needed, so a burst of
+ * changes never reads an I2C device more often than allowed.
+ *
+ * Each change prints the old and new value (or error), when it was seen and
+ * when the old value was last seen, which brackets the moment it happened:
+ *
+ *   2026-10-18T09:14:02.123Z 3 -> 65534 last_seen=2026-10-18T09:14:01.823Z
+ *   {"time":"...","last_seen":"...","old":3,"new":65534}
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "constants.h"
+#include "lock.h"
+#include "watch.h"
+
+/*
+ * A read result: the value, or a negative E_* code.  The read takes the
+ * lock, so it never meets an EEPROM in its write cycle (a NAK or a half
+ * written value) and reports an error that was never stored.
+ */
+static int32_t read_state(const struct platform *plat)
+{
+    uint16_t val;
+    int lock_fd = bootcount_lock();
+    int err = plat->read_bootcount(&val);
+    bootcount_unlock(lock_fd);
+    return err ? err : val;
+}
+
+static void format_time(const struct timespec *ts, char *buf, size_t len)
+{
+    struct tm tm;
+    char stamp[24];
+    gmtime_r(&ts->tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf, len, "%s.%03ldZ", stamp, ts->tv_nsec / 1000000L);
+}
+
+static void print_state(FILE *out, int32_t state, bool json)
+{
+    if (state >= 0)
+        fprintf(out, "%ld", (long)state);
+    else if (json)
+        fprintf(out, "{\"error\":%ld}", (long)state);
+    else
+        fprintf(out, "Error %ld", (long)state);
+}
+
+static void print_event(FILE *out, bool json, int32_t old, int32_t cur,
+                        const struct timespec *now, const struct timespec *last_seen, bool initial)
+{
+    char now_s[40], seen_s[40];
+
+    format_time(now, now_s, sizeof(now_s));
+    format_time(last_seen, seen_s, sizeof(seen_s));
+    if (json) {
+        fprintf(out, "{\"time\":\"%s\",", now_s);
+        if (initial) {
+            fprintf(out, "\"last_seen\":null,\"old\":null,\"new\":");
+        } else {
+            fprintf(out, "\"last_seen\":\"%s\",\"old\":", seen_s);
+            print_state(out, old, true);
+            fprintf(out, ",\"new\":");
+        }
+        print_state(out, cur, true);
+        fprintf(out, "}\n");
+    } else {
+        fprintf(out, "%s ", now_s);
+        if (!initial) {
+            print_state(out, old, false);
+            fprintf(out, " -> ");
+        }
+        print_state(out, cur, false);
+        if (!initial)
+            fprintf(out, " last_seen=%s", seen_s);
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
+
+static void add_ms(struct timespec *ts, long ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+int watch_run(const struct platform *plat, unsigned reads_per_min, bool json, FILE *out)
+{
+    long min_ms = WATCH_MIN_MS, interval;
+    struct timespec next, now, last_seen;
+
+    if (reads_per_min && 60000L / reads_per_min > min_ms)
+        min_ms = 60000L / reads_per_min;
+    interval = min_ms;
+    DEBUG_PRINTF("Watching %s every %ld..%ld ms\n", plat->name, min_ms,
+                 min_ms > WATCH_MAX_MS ? min_ms : WATCH_MAX_MS);
+
+    int32_t state = read_state(plat);
+    if (clock_gettime(CLOCK_MONOTONIC, &next) != 0)
+        return E_INVALID;
+    clock_gettime(CLOCK_REALTIME, &last_seen);
+    print_event(out, json, state, state, &last_seen, &last_seen, true);
+
+    for (;;) {
+        add_ms(&next, interval);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+            ;
+
+        int32_t cur = read_state(plat);
+        clock_gettime(CLOCK_REALTIME, &now);
+        /*
+         * The next read is an interval after this one ended: after waiting
+         * for the lock or a slow device, earlier deadlines are long past and
+         * would otherwise come back to back, over the per-minute cap.
+         */
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        if (cur != state) {
+            print_event(out, json, state, cur, &now, &last_seen, false);
+            state = cur;
+            interval = min_ms;
+        } else if (interval < WATCH_MAX_MS) {
+            interval *= 2;
+            if (interval > WATCH_MAX_MS)
+                interval = WATCH_MAX_MS;
+        }
+        last_seen = now;
+    }
+}
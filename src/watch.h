@@ -0,0 +1,38 @@
+/**
+ * Watch the bootcount for changes
+ *
+ * This file is part of the uboot-bootcount (https://github.com/VoltServer/uboot-bootcount).
+ * Copyright (c) 2018 VoltServer.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "platform.h"
+
+/* Poll interval right after a change, and the ceiling it backs off to */
+#define WATCH_MIN_MS 100
+#define WATCH_MAX_MS 5000
+/* Default cap on backend reads per minute */
+#define WATCH_READS_PER_MIN 600
+
+/*
+ * Poll plat until killed, printing the initial value and then one line (or
+ * JSON object) per change.  At most reads_per_min reads are made in any
+ * minute.  Returns only if the clock cannot be read.
+ */
+int watch_run(const struct platform *plat, unsigned reads_per_min, bool json, FILE *out);